@@ -20,32 +20,25 @@ namespace apex {
     address_resolution * ar = address_resolution::instance();
     stringstream location;
     address_resolution::my_hash_node * node = nullptr;
+    // BFD isn't thread safe, and the table may be growing, so only one
+    // thread looks up an address at a time
+    std::lock_guard<std::mutex> lock(ar->_bfd_mutex);
     const std::unordered_map<uintptr_t,
                       address_resolution::my_hash_node*>::const_iterator it = ar->my_hash_table.find(ip);
     // address not found? We need to resolve it.
     if (it == ar->my_hash_table.end()) {
-      // only one thread should resolve it.
-      std::lock_guard<std::mutex> lock(ar->_bfd_mutex);
-      // now that we have the lock, did someone else resolve it?
-      const std::unordered_map<uintptr_t,
-            address_resolution::my_hash_node*>::const_iterator it2 = ar->my_hash_table.find(ip);
-      if (it2 == ar->my_hash_table.end()) {
-        // ...no - so go get it!
-        node = new address_resolution::my_hash_node();
-        Apex_bfd_resolveBfdInfo(ar->my_bfd_unit_handle, ip, node->info);
-        if (node->info.funcname) {
-          location << node->info.funcname ;
-        }
-        location << " [{" ;
-        if (node->info.filename) {
-          location << node->info.filename ;
-        }
-        location << "} {" << node->info.lineno << ",0}]";
-        node->location = new string(location.str());
-        ar->my_hash_table[ip] = node;
-      } else {
-        node = it2->second;
+      node = new address_resolution::my_hash_node();
+      Apex_bfd_resolveBfdInfo(ar->my_bfd_unit_handle, ip, node->info);
+      if (node->info.funcname) {
+        location << node->info.funcname ;
       }
+      location << " [{" ;
+      if (node->info.filename) {
+        location << node->info.filename ;
+      }
+      location << "} {" << node->info.lineno << ",0}]";
+      node->location = new string(location.str());
+      ar->my_hash_table[ip] = node;
     } else {
       node = it->second;
     }
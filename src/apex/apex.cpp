@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string>
 #include <memory>
+#include <cmath>
 #if APEX_USE_PLUGINS
 #include <dlfcn.h>
 #endif
@@ -20,7 +21,11 @@
 #include "concurrency_handler.hpp"
 #include "policy_handler.hpp"
 #include "thread_instance.hpp"
+#include "profiler_pool.hpp"
+#include "clock_source.hpp"
+#include "profiler_ring.hpp"
 #include "utils.hpp"
+#include "finalize_pipeline.hpp"
 
 #ifdef APEX_HAVE_TAU
 #include "tau_listener.hpp"
@@ -75,6 +80,10 @@ apex::~apex()
         listeners.pop_back();
         delete el;
     }
+    delete dispatch.load();
+    for (dispatch_table * table : m_retired_dispatch) {
+        delete table;
+    }
 #if APEX_HAVE_PROC
     if (pd_reader != nullptr) {
         delete pd_reader;
@@ -136,6 +145,7 @@ void apex::_initialize()
 #endif
     this->m_pInstance = this;
     this->m_policy_handler = nullptr;
+    this->dispatch = new dispatch_table();
     stringstream tmp;
 #if defined (GIT_TAG)
     tmp << GIT_TAG;
@@ -194,6 +204,12 @@ void apex::_initialize()
         tau_listener::initialize_tau(m_argc, m_argv);
     }
 #endif
+    // choose the clock before anything reads it
+    if (!clock_source::select(apex_options::clock_source())) {
+        std::cerr << "APEX Warning : unknown or unavailable APEX_CLOCK_SOURCE \""
+                  << apex_options::clock_source() << "\", using \""
+                  << clock_source::name(clock_source::get()) << "\"." << std::endl;
+    }
     // this is always the first listener!
     this->the_profiler_listener = new profiler_listener();
     listeners.push_back(the_profiler_listener);
@@ -230,10 +246,30 @@ void apex::_initialize()
         pd_reader = nullptr;
     }
 #endif
+    update_dispatch();
     this->resize_state(1);
     this->set_state(0, APEX_BUSY);
 }
 
+void apex::update_dispatch(void)
+{
+    std::unique_lock<std::mutex> l(m_dispatch_mutex);
+    dispatch_table * table = new dispatch_table();
+    for (event_listener * el : listeners) {
+        uint32_t mask = el->interest();
+        if (mask & APEX_INTEREST_START) { table->on_start.push_back(el); }
+        if (mask & APEX_INTEREST_STOP) { table->on_stop.push_back(el); }
+        if (mask & APEX_INTEREST_YIELD) { table->on_yield.push_back(el); }
+        if (mask & APEX_INTEREST_RESUME) { table->on_resume.push_back(el); }
+        if (mask & APEX_INTEREST_NEW_TASK) { table->on_new_task.push_back(el); }
+        if (mask & APEX_INTEREST_SAMPLE_VALUE) { table->on_sample_value.push_back(el); }
+        if (mask & APEX_INTEREST_CUSTOM_EVENT) { table->on_custom_event.push_back(el); }
+        if (mask & APEX_INTEREST_SEND) { table->on_send.push_back(el); }
+        if (mask & APEX_INTEREST_RECV) { table->on_recv.push_back(el); }
+    }
+    m_retired_dispatch.push_back(dispatch.exchange(table));
+}
+
 /*  
     This function is called to create an instance of the class.
     Calling the constructor publicly is not allowed. The constructor
@@ -278,6 +314,7 @@ policy_handler * apex::get_policy_handler(uint64_t const& period)
     {
         period_handlers[period] = new policy_handler(period);
         listeners.push_back(period_handlers[period]);
+        update_dispatch();
     }
     return period_handlers[period];
 }
@@ -338,6 +375,7 @@ void init(const char * thread_name) {
     if (apex_options::use_screen_output() && instance->get_node_id() == 0) {
 	  std::cout << version() << std::endl;
       apex_options::print_options();
+      clock_source::benchmark();
 	}
     if (apex_options::throttle_energy() && apex_options::throttle_concurrency() ) {
       setup_power_cap_throttling();
@@ -373,6 +411,7 @@ void init(int argc, char** argv, const char * thread_name) {
     if (apex_options::use_screen_output() && instance->get_node_id() == 0) {
 	  std::cout << version() << std::endl;
       apex_options::print_options();
+      clock_source::benchmark();
 	}
     if (apex_options::throttle_energy() && apex_options::throttle_concurrency() ) {
       setup_power_cap_throttling();
@@ -386,16 +425,36 @@ string& version() {
     return instance->version_string;
 }
 
-profiler* start(const std::string &timer_name)
+task_identifier * register_timer(const std::string &timer_name)
 {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
     if (starts_with(timer_name, string("apex_internal"))) {
-        return profiler::get_disabled_profiler(); // don't process our own events - queue scrubbing tasks.
+        return nullptr; // don't process our own events - queue scrubbing tasks.
     }
     if (starts_with(timer_name, string("shutdown_all"))) {
-        return profiler::get_disabled_profiler();
+        return nullptr;
     }
+    task_identifier * id = task_identifier::get_task_id(timer_name);
+    // there are too many timers to measure this one
+    return id->is_overflow() ? nullptr : id;
+}
+
+task_identifier * register_timer(apex_function_address function_address)
+{
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return nullptr; }
+    task_identifier * id = task_identifier::get_task_id(function_address);
+    // there are too many timers to measure this one
+    return id->is_overflow() ? nullptr : id;
+}
+
+profiler* start(task_identifier * task_id)
+{
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return nullptr; }
+    // a null handle is an internal timer, or one that can't be measured.
+    if (task_id == nullptr) { return profiler::get_disabled_profiler(); }
 #ifdef APEX_DEBUG
     _starts++;
 #endif
@@ -404,11 +463,8 @@ profiler* start(const std::string &timer_name)
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return nullptr; // protect against calls after finalization
     if (_notify_listeners) {
-        bool success = true;
-		task_identifier * id = new task_identifier(timer_name);
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            success = instance->listeners[i]->on_start(id);
-            if (!success) {
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_start) {
+            if (!el->on_start(task_id)) {
                 return profiler::get_disabled_profiler();
             }
         }
@@ -419,34 +475,38 @@ profiler* start(const std::string &timer_name)
     return thread_instance::instance().get_current_profiler();
 }
 
+profiler* start(const std::string &timer_name)
+{
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return nullptr; }
+    return start(register_timer(timer_name));
+}
+
 profiler* start(apex_function_address function_address) {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
+    return start(register_timer(function_address));
+}
+
+profiler* resume(task_identifier * task_id) {
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return nullptr; }
+    // a null handle is an internal timer, or one that can't be measured.
+    if (task_id == nullptr) { return profiler::get_disabled_profiler(); }
 #ifdef APEX_DEBUG
-    _starts++;
+    _resumes++;
 #endif
     // if APEX is suspended, do nothing.
     if (apex_options::suspend() == true) { return profiler::get_disabled_profiler(); }
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return nullptr; // protect against calls after finalization
     if (_notify_listeners) {
-        bool success = true;
-		task_identifier * id = new task_identifier(function_address);
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            success = instance->listeners[i]->on_start(id);
-            if (!success) {
-                return profiler::get_disabled_profiler();
+        try {
+            for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_resume) {
+                el->on_resume(task_id);
             }
-        }
-    }
-#ifdef APEX_DEBUG
-    /*
-    if (instance->get_node_id() == 0) { 
-        printf("%lu Start: %s %p\n", thread_instance::get_id(), lookup_address((uintptr_t)function_address, false)->c_str(), thread_instance::instance().get_current_profiler());
-        fflush(stdout); 
+        } catch (disabled_profiler_exception e) { return profiler::get_disabled_profiler(); }
     }
-    */
-#endif
 #ifdef APEX_DEBUG
     thread_instance::instance().add_open_profiler(thread_instance::instance().get_current_profiler());
 #endif
@@ -456,60 +516,16 @@ profiler* start(apex_function_address function_address) {
 profiler* resume(const std::string &timer_name) {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
-#ifdef APEX_DEBUG
-    _resumes++;
-#endif
-    // if APEX is suspended, do nothing.
-    if (apex_options::suspend() == true) { return profiler::get_disabled_profiler(); }
-    apex* instance = apex::instance(); // get the Apex static instance
-    if (!instance || _exited) return nullptr; // protect against calls after finalization
     if (starts_with(timer_name, string("apex_internal"))) {
         return profiler::get_disabled_profiler(); // don't process our own events
     }
-    if (_notify_listeners) {
-        task_identifier * id = new task_identifier(timer_name);
-        try {
-            for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-                instance->listeners[i]->on_resume(id);
-            }
-        } catch (disabled_profiler_exception e) { return profiler::get_disabled_profiler(); }
-    }
-#ifdef APEX_DEBUG
-    thread_instance::instance().add_open_profiler(thread_instance::instance().get_current_profiler());
-#endif
-    return thread_instance::instance().get_current_profiler();
+    return resume(register_timer(timer_name));
 }
 
 profiler* resume(apex_function_address function_address) {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
-#ifdef APEX_DEBUG
-    _resumes++;
-#endif
-    // if APEX is suspended, do nothing.
-    if (apex_options::suspend() == true) { return profiler::get_disabled_profiler(); }
-    apex* instance = apex::instance(); // get the Apex static instance
-    if (!instance || _exited) return nullptr; // protect against calls after finalization
-    if (_notify_listeners) {
-        task_identifier * id = new task_identifier(function_address);
-        try {
-            for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-                instance->listeners[i]->on_resume(id);
-            }
-        } catch (disabled_profiler_exception e) { return profiler::get_disabled_profiler(); }
-    }
-#ifdef APEX_DEBUG
-/*
-    if (instance->get_node_id() == 0) { 
-        printf("%lu Resume: %s %p\n", thread_instance::get_id(), lookup_address((uintptr_t)function_address, false)->c_str(), thread_instance::instance().get_current_profiler());
-        fflush(stdout); 
-    }
-*/
-#endif
-#ifdef APEX_DEBUG
-    thread_instance::instance().add_open_profiler(thread_instance::instance().get_current_profiler());
-#endif
-    return thread_instance::instance().get_current_profiler();
+    return resume(register_timer(function_address));
 }
 
 void reset(const std::string &timer_name) {
@@ -517,7 +533,7 @@ void reset(const std::string &timer_name) {
     if (apex_options::disable() == true) { return; }
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return; // protect against calls after finalization
-    task_identifier * id = new task_identifier(timer_name);
+    task_identifier * id = task_identifier::get_task_id(timer_name);
     instance->the_profiler_listener->reset(id);
 }
 
@@ -529,7 +545,7 @@ void reset(apex_function_address function_address) {
 	if (function_address == APEX_NULL_FUNCTION_ADDRESS) {
         instance->the_profiler_listener->reset_all();
 	} else {
-    	task_identifier * id = new task_identifier(function_address);
+    	task_identifier * id = task_identifier::get_task_id(function_address);
     	instance->the_profiler_listener->reset(id);
     }
 }
@@ -552,12 +568,12 @@ void stop(profiler* the_profiler) {
 
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return; // protect against calls after finalization
-    if (the_profiler == nullptr || the_profiler->stopped) return;
+    if (the_profiler == nullptr || the_profiler->stopped.load(std::memory_order_acquire)) return;
 #ifdef APEX_DEBUG
     thread_instance::instance().remove_open_profiler(thread_instance::instance().get_id(), the_profiler);
     thread_instance::instance().clear_current_profiler();
 #endif
-    std::shared_ptr<profiler> p{the_profiler};
+    profiler_ptr p{the_profiler};
     /*
     std::shared_ptr<profiler> p;
     // A null profiler is OK, it means the application didn't store it. We have it.
@@ -577,8 +593,8 @@ void stop(profiler* the_profiler) {
     */
 #endif
     if (_notify_listeners) {
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_stop(p);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_stop) {
+            el->on_stop(p);
         }
     }
 }
@@ -594,12 +610,12 @@ void yield(profiler* the_profiler)
 
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return; // protect against calls after finalization
-    if (the_profiler == nullptr || the_profiler->stopped) return;
+    if (the_profiler == nullptr || the_profiler->stopped.load(std::memory_order_acquire)) return;
 #ifdef APEX_DEBUG
     thread_instance::instance().remove_open_profiler(thread_instance::instance().get_id(), the_profiler);
     thread_instance::instance().clear_current_profiler();
 #endif
-    std::shared_ptr<profiler> p{the_profiler};
+    profiler_ptr p{the_profiler};
     /*
     std::shared_ptr<profiler> p;
     if (the_profiler == nullptr) {
@@ -618,8 +634,8 @@ void yield(profiler* the_profiler)
     */
 #endif
     if (_notify_listeners) {
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_yield(p);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_yield) {
+            el->on_yield(p);
         }
     }
 }
@@ -679,13 +695,43 @@ void sample_value(const std::string &name, double value)
         data = new sample_value_event_data(0, name, value);
     }
     if (_notify_listeners) {
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_sample_value(*data);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_sample_value) {
+            el->on_sample_value(*data);
         }
     }
     delete(data);
 }
 
+counter_handle register_counter(const std::string &name, apex_counter_kind kind)
+{
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return nullptr; }
+    return counter_identifier::get_counter_id(name, kind);
+}
+
+void sample_value(counter_handle counter, double value)
+{
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return; }
+    if (counter == nullptr) { return; }
+    // if APEX is suspended, do nothing.
+    if (apex_options::suspend() == true) { return; }
+    apex* instance = apex::instance(); // get the Apex static instance
+    if (!instance || _exited) return; // protect against calls after finalization
+    if (counter->kind == APEX_COUNTER_MONOTONIC) {
+        // record the increase since the last sample, if there was one
+        double last = counter->last_value.exchange(value, std::memory_order_relaxed);
+        if (std::isnan(last)) { return; }
+        value = value - last;
+    }
+    if (_notify_listeners) {
+        sample_value_event_data data(0, counter->id, value);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_sample_value) {
+            el->on_sample_value(data);
+        }
+    }
+}
+
 void new_task(const std::string &timer_name, uint64_t task_id)
 {
     // if APEX is disabled, do nothing.
@@ -695,9 +741,9 @@ void new_task(const std::string &timer_name, uint64_t task_id)
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return; // protect against calls after finalization
     if (_notify_listeners) {
-        task_identifier * id = new task_identifier(timer_name);
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_new_task(id, task_id);
+        task_identifier * id = task_identifier::get_task_id(timer_name);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_new_task) {
+            el->on_new_task(id, task_id);
         }
     }
 }
@@ -710,9 +756,9 @@ void new_task(apex_function_address function_address, uint64_t task_id) {
     apex* instance = apex::instance(); // get the Apex static instance
     if (!instance || _exited) return; // protect against calls after finalization
     if (_notify_listeners) {
-        task_identifier * id = new task_identifier(function_address);
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_new_task(id, task_id);
+        task_identifier * id = task_identifier::get_task_id(function_address);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_new_task) {
+            el->on_new_task(id, task_id);
         }
     }
 }
@@ -741,8 +787,8 @@ void custom_event(apex_event_type event_type, void * custom_data) {
     if (!instance || _exited) return; // protect against calls after finalization
     custom_event_data data(event_type, custom_data);
     if (_notify_listeners) {
-        for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-            instance->listeners[i]->on_custom_event(data);
+        for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_custom_event) {
+            el->on_custom_event(data);
         }
     }
 }
@@ -937,11 +983,16 @@ void finalize()
         ss << instance->get_node_id();
         shutdown_event_data data(instance->get_node_id(), thread_instance::get_id());
         _notify_listeners = false;
+        // the clock's scale is final before the outputs use it
+        tsc::stop_background();
+        finalize_pipeline::begin();
         //if (_notify_listeners) {
             for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
                 instance->listeners[i]->on_shutdown(data);
             }
         //}
+        // write the output the listeners have queued
+        finalize_pipeline::run();
     }
 }
 
@@ -1016,6 +1067,12 @@ void exit_thread(void)
             instance->listeners[i]->on_exit_thread(data);
         }
     }
+    // let the next new thread adopt this thread's profiler pool, ring
+    // and profile table
+    profiler_pool::release_thread_pool();
+    profiler_ring::release_thread_ring();
+    profiler_listener::release_thread_profiles();
+    task_identifier::release_thread_caches();
 }
 
 apex_policy_handle* register_policy(const apex_event_type when,
@@ -1028,6 +1085,8 @@ apex_policy_handle* register_policy(const apex_event_type when,
     if(handler != nullptr)
     {
         id = handler->register_policy(when, f);
+        // the handler may be interested in a new event now
+        apex::instance()->update_dispatch();
     }
     apex_policy_handle * handle = new apex_policy_handle();
     handle->id = id;
@@ -1084,6 +1143,7 @@ void deregister_policy(apex_policy_handle * handle) {
     policy_handler * handler = apex::instance()->get_policy_handler();
     if(handler != nullptr) {
         handler->deregister_policy(handle);
+        apex::instance()->update_dispatch();
     }
     //_notify_listeners = true;
     delete(handle);
@@ -1092,23 +1152,52 @@ void deregister_policy(apex_policy_handle * handle) {
 apex_profile* get_profile(apex_function_address action_address) {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
-	task_identifier id = task_identifier(action_address);
+	task_identifier * id = task_identifier::get_task_id(action_address);
     profile * tmp = apex::__instance()->the_profiler_listener->get_profile(id);
-    if (tmp != nullptr)
+    if (tmp != nullptr) {
         return tmp->get_profile();
+    }
     return nullptr;
 }
 
 apex_profile* get_profile(const std::string &timer_name) {
     // if APEX is disabled, do nothing.
     if (apex_options::disable() == true) { return nullptr; }
-	task_identifier id = task_identifier(timer_name);
+	task_identifier * id = task_identifier::get_task_id(timer_name);
     profile * tmp = apex::__instance()->the_profiler_listener->get_profile(id);
-    if (tmp != nullptr)
+    if (tmp != nullptr) {
         return tmp->get_profile();
+    }
     return nullptr;
 }
 
+bool get_profile_snapshot(apex_function_address action_address, apex_profile &snapshot) {
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return false; }
+    task_identifier * id = task_identifier::get_task_id(action_address);
+    return apex::__instance()->the_profiler_listener->get_profile_snapshot(id, snapshot);
+}
+
+bool get_profile_snapshot(const std::string &timer_name, apex_profile &snapshot) {
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return false; }
+    task_identifier * id = task_identifier::get_task_id(timer_name);
+    return apex::__instance()->the_profiler_listener->get_profile_snapshot(id, snapshot);
+}
+
+std::vector<std::pair<std::string, apex_profile> > get_profile_snapshots(void) {
+    std::vector<std::pair<std::string, apex_profile> > result;
+    // if APEX is disabled, do nothing.
+    if (apex_options::disable() == true) { return result; }
+    std::vector<std::pair<task_identifier*, apex_profile> > snapshots;
+    apex::__instance()->the_profiler_listener->get_profile_snapshots(snapshots);
+    result.reserve(snapshots.size());
+    for (auto &it : snapshots) {
+        result.push_back(std::make_pair(it.first->get_name(), it.second));
+    }
+    return result;
+}
+
 /*
 std::vector<std::string> get_available_profiles() {
     return apex::__instance()->the_profiler_listener->get_available_profiles();
@@ -1135,8 +1224,8 @@ void send (uint64_t tag, uint64_t size, uint64_t target) {
     if (_notify_listeners) {
         message_event_data data(tag, size, instance->get_node_id(), target);
         if (_notify_listeners) {
-            for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-                instance->listeners[i]->on_send(data);
+            for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_send) {
+                el->on_send(data);
             }
         }
     }
@@ -1155,8 +1244,8 @@ void recv (uint64_t tag, uint64_t size, uint64_t source) {
     if (_notify_listeners) {
         message_event_data data(tag, size, source, instance->get_node_id());
         if (_notify_listeners) {
-            for (unsigned int i = 0 ; i < instance->listeners.size() ; i++) {
-                instance->listeners[i]->on_recv(data);
+            for (event_listener * el : instance->dispatch.load(std::memory_order_acquire)->on_recv) {
+                el->on_recv(data);
             }
         }
     }
@@ -1264,6 +1353,15 @@ extern "C" {
         sample_value(tmp, value);
     }
 
+    apex_counter_handle apex_register_counter(const char * name,
+        apex_counter_kind kind) {
+        return (apex_counter_handle)register_counter(string(name), kind);
+    }
+
+    void apex_sample_counter(apex_counter_handle counter, double value) {
+        sample_value((counter_handle)counter, value);
+    }
+
     void apex_new_task(apex_profiler_type type, void * identifier, 
                        unsigned long long task_id) {
         if (type == APEX_FUNCTION_ADDRESS) {
@@ -1359,6 +1457,20 @@ extern "C" {
         return nullptr;
     }
 
+    int apex_get_profile_snapshot(apex_profiler_type type, void * identifier,
+                                  apex_profile * snapshot) {
+        assert(identifier);
+        assert(snapshot);
+        bool found;
+        if (type == APEX_FUNCTION_ADDRESS) {
+            found = get_profile_snapshot((apex_function_address)(identifier), *snapshot);
+        } else {
+            string tmp((const char *)identifier);
+            found = get_profile_snapshot(tmp, *snapshot);
+        }
+        return found ? APEX_NOERROR : APEX_ERROR;
+    }
+
     double apex_current_power_high() {
         return current_power_high();
     }
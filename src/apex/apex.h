@@ -211,6 +211,35 @@ APEX_EXPORT void apex_set_state(apex_thread_state state);
  */
 APEX_EXPORT void apex_sample_value(const char * name, double value);
 
+/**
+ \brief Register a counter with APEX.
+
+ This function will look up (or create) the counter once, and return a
+ handle to it. Sampling the counter with the handle doesn't copy or
+ parse the name, allocate memory or take a lock.
+ 
+ \param name The name of the counter
+ \param kind Whether each sample is the current value, or a running
+             total. See @ref apex_counter_kind.
+ \return The handle for the counter. NULL if APEX is disabled.
+ \sa @ref apex_sample_counter
+ */
+APEX_EXPORT apex_counter_handle apex_register_counter(const char * name,
+    apex_counter_kind kind);
+
+/**
+ \brief Sample a registered counter.
+
+ This function will retain a sample of the counter, like
+ apex_sample_value.
+ 
+ \param counter The handle from apex_register_counter
+ \param value The sampled value
+ \return No return value.
+ \sa @ref apex_register_counter
+ */
+APEX_EXPORT void apex_sample_counter(apex_counter_handle counter, double value);
+
 /**
  \brief Create a new task (dependency).
 
@@ -376,6 +405,8 @@ APEX_EXPORT void apex_deregister_policy(apex_policy_handle * handle);
  This function will return the current profile for the specified profiler id.
  Because profiles are updated out-of-band, it is possible that this profile
  value is out of date.  This profile can be either a timer or a sampled value.
+ The quantiles (p50 to p999) are only filled in at finalize; before that,
+ use @ref apex_get_profile_snapshot for them.
  
  \param type The type of the address to be returned. This can be one of the @ref
              apex_profiler_type values.
@@ -385,6 +416,25 @@ APEX_EXPORT void apex_deregister_policy(apex_policy_handle * handle);
  */
 APEX_EXPORT apex_profile * apex_get_profile(apex_profiler_type type, void * identifier);
 
+/**
+ \brief Get a consistent copy of the profile for the specified id.
+
+ Unlike @ref apex_get_profile, which returns the profile the consumer
+ thread keeps updating, this copies the profile as of one update, so
+ that for example calls and accumulated agree. The consumer thread is
+ never made to wait; a copy that overlaps an update is simply retried.
+ 
+ \param type The type of the address to be returned. This can be one of the @ref
+             apex_profiler_type values.
+ \param identifier The function address of the function to be returned, or a "const
+             char *" pointer to the name of the timer / counter.
+ \param snapshot Where to copy the profile.
+ \return APEX_NOERROR, or APEX_ERROR if there is no profile for the id yet.
+ \sa @ref apex_get_profile
+ */
+APEX_EXPORT int apex_get_profile_snapshot(apex_profiler_type type, void * identifier,
+                                          apex_profile * snapshot);
+
 /**
  \brief Get the current power reading
 
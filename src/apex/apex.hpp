@@ -19,6 +19,7 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 #include <stdint.h>
 #include "apex_types.h"
 #include "apex_config.h"
@@ -62,6 +63,24 @@ namespace apex
 // Main class for the APEX project
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
+/*
+ The listeners to call for each frequent event, in the order they appear
+ in apex::listeners. See event_listener::interest().
+ */
+class dispatch_table
+{
+public:
+    std::vector<event_listener*> on_start;
+    std::vector<event_listener*> on_stop;
+    std::vector<event_listener*> on_yield;
+    std::vector<event_listener*> on_resume;
+    std::vector<event_listener*> on_new_task;
+    std::vector<event_listener*> on_sample_value;
+    std::vector<event_listener*> on_custom_event;
+    std::vector<event_listener*> on_send;
+    std::vector<event_listener*> on_recv;
+};
+
 /*
  The APEX class is only instantiated once per process (i.e. it is a
  singleton object). The instance itself is only used internally. The
@@ -92,6 +111,9 @@ private:
     void _initialize();
     policy_handler * m_policy_handler;
     std::map<int, policy_handler*> period_handlers;
+    // replaced tables are kept until exit, in case an event is using one
+    std::vector<dispatch_table*> m_retired_dispatch;
+    std::mutex m_dispatch_mutex;
     std::vector<apex_thread_state> thread_states;
 #ifdef APEX_HAVE_HPX3
     hpx::runtime * m_hpx_runtime;
@@ -101,6 +123,10 @@ public:
     proc_data_reader * pd_reader;
     std::string version_string;
     std::vector<event_listener*> listeners;
+    std::atomic<dispatch_table*> dispatch;
+    /* Rebuild the dispatch table, after listeners are added or one of
+     * them changes its interest() */
+    void update_dispatch(void);
     std::vector<int (*)()> finalize_functions;
     std::string m_my_locality;
     std::unordered_map<int, std::string> custom_event_names;
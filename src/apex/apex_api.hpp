@@ -143,6 +143,51 @@ APEX_EXPORT profiler * start(const std::string &timer_name);
  */
 APEX_EXPORT profiler * start(apex_function_address function_address);
 
+/**
+ \brief Register a timer name with APEX.
+
+ This function will look up (or create) the identifier for the named
+ timer once, and return a handle to it. Starting a timer with the
+ handle avoids copying and hashing the name on every call.
+ 
+ \param timer_name The name of the timer.
+ \return The handle for the timer identifier. The handle is valid for
+         the lifetime of the process. nullptr if APEX is disabled, or
+         if there are too many distinct timers to measure another.
+ \sa @ref apex::start, @ref apex::resume
+ */
+APEX_EXPORT task_identifier * register_timer(const std::string &timer_name);
+
+/**
+ \brief Register a function address with APEX.
+
+ This function will look up (or create) the identifier for the 
+ function address once, and return a handle to it.
+ 
+ \param function_address The address of the function to be timed
+ \return The handle for the timer identifier. The handle is valid for
+         the lifetime of the process. nullptr if APEX is disabled, or
+         if there are too many distinct timers to measure another.
+ \sa @ref apex::start, @ref apex::resume
+ */
+APEX_EXPORT task_identifier * register_timer(apex_function_address function_address);
+
+/**
+ \brief Start a timer.
+
+ This function will create a profiler object in APEX, and return a
+ handle to the object.  The object will be associated with the 
+ timer handle passed in to this function.
+ 
+ \param task_id The timer handle from apex::register_timer
+ \return The handle for the timer object in APEX. Not intended to be
+         queried by the application. Should be retained locally, if
+         possible, and passed in to the matching apex::stop
+         call when the timer should be stopped.
+ \sa @ref apex::register_timer, @ref apex::stop, @ref apex::yield, @ref apex::resume
+ */
+APEX_EXPORT profiler * start(task_identifier * task_id);
+
 /**
  \brief Stop a timer.
 
@@ -209,6 +254,25 @@ APEX_EXPORT profiler * resume(const std::string &timer_name);
  */
 APEX_EXPORT profiler * resume(apex_function_address function_address);
 
+/**
+ \brief Resume a timer.
+
+ This function will create a profiler object in APEX, and return a
+ handle to the object.  The object will be associated with the 
+ timer handle passed in to this function.
+ The difference between this function and the apex::start
+ function is that the number of calls to that
+ timer will not be incremented.
+ 
+ \param task_id The timer handle from apex::register_timer
+ \return The handle for the timer object in APEX. Not intended to be
+         queried by the application. Should be retained locally, if
+         possible, and passed in to the matching apex::stop
+         call when the timer should be stopped.
+ \sa apex::register_timer, apex::stop, apex::yield, apex::start
+ */
+APEX_EXPORT profiler * resume(task_identifier * task_id);
+
 /*
  * Functions for resetting timer values
  */
@@ -263,6 +327,39 @@ APEX_EXPORT void set_state(apex_thread_state state);
  */
 APEX_EXPORT void sample_value(const std::string &name, double value);
 
+/**
+ \brief Register a counter with APEX.
+
+ This function will look up (or create) the counter once, and return a
+ handle to it. Sampling the counter with the handle doesn't copy or
+ parse the name, allocate memory or take a lock, so it is cheap enough
+ to call millions of times per second.
+ 
+ \param name The name of the counter
+ \param kind Whether each sample is the current value, or a running
+             total. See @ref apex_counter_kind.
+ \return The handle for the counter. The handle is valid for the
+         lifetime of the process. nullptr if APEX is disabled.
+ \sa @ref apex::sample_value
+ */
+APEX_EXPORT counter_handle register_counter(const std::string &name,
+    apex_counter_kind kind = APEX_COUNTER_GAUGE);
+
+/**
+ \brief Sample a registered counter.
+
+ This function will retain a sample of the counter. The profile
+ for the counter will store the min, mean, max, total
+ and standard deviation for all the samples (for an
+ APEX_COUNTER_MONOTONIC counter, of the increases between samples).
+ 
+ \param counter The handle from apex::register_counter
+ \param value The sampled value
+ \return No return value.
+ \sa @ref apex::register_counter
+ */
+APEX_EXPORT void sample_value(counter_handle counter, double value);
+
 /**
  \brief Create a new task (dependency).
 
@@ -451,7 +548,8 @@ APEX_EXPORT void deregister_policy(apex_policy_handle * handle);
 
  This function will return the current profile for the specified address.
  Because profiles are updated out-of-band, it is possible that this profile
- value is out of date. 
+ value is out of date. The quantiles (p50 to p999) are only filled in at
+ finalize; before that, use @ref apex::get_profile_snapshot for them.
  
  \param function_address The address of the function.
  \return The current profile for that timed function.
@@ -464,12 +562,57 @@ APEX_EXPORT apex_profile* get_profile(apex_function_address function_address);
  This function will return the current profile for the specified address.
  Because profiles are updated out-of-band, it is possible that this profile
  value is out of date.  This profile can be either a timer or a sampled value.
+ The quantiles (p50 to p999) are only filled in at finalize; before that,
+ use @ref apex::get_profile_snapshot for them.
  
  \param timer_name The name of the function
  \return The current profile for that timed function or sampled value.
  */
 APEX_EXPORT apex_profile* get_profile(const std::string &timer_name);
 
+/**
+ \brief Get a consistent copy of the profile for the specified function address.
+
+ Unlike @ref apex::get_profile, which returns the profile the consumer
+ thread keeps updating, this copies the profile as of one update, so
+ that for example calls and accumulated agree. The consumer thread is
+ never made to wait; a copy that overlaps an update is simply retried.
+ 
+ \param function_address The address of the function.
+ \param snapshot The copy of the profile.
+ \return false if there is no profile for the function yet.
+ \sa @ref apex::get_profile_snapshots
+ */
+APEX_EXPORT bool get_profile_snapshot(apex_function_address function_address,
+    apex_profile &snapshot);
+
+/**
+ \brief Get a consistent copy of the profile for the specified timer or counter.
+
+ Unlike @ref apex::get_profile, which returns the profile the consumer
+ thread keeps updating, this copies the profile as of one update, so
+ that for example calls and accumulated agree. The consumer thread is
+ never made to wait; a copy that overlaps an update is simply retried.
+ 
+ \param timer_name The name of the function or sampled value.
+ \param snapshot The copy of the profile.
+ \return false if there is no profile for the timer or counter yet.
+ \sa @ref apex::get_profile_snapshots
+ */
+APEX_EXPORT bool get_profile_snapshot(const std::string &timer_name,
+    apex_profile &snapshot);
+
+/**
+ \brief Get a consistent copy of every profile.
+
+ Each profile is copied as with @ref apex::get_profile_snapshot. The
+ profiles are copied one at a time, so each is consistent, but they were
+ not all taken at the same instant. Intended for periodic exporters.
+ 
+ \return The name and a copy of the profile of each timer and counter.
+ */
+APEX_EXPORT std::vector<std::pair<std::string, apex_profile> > get_profile_snapshots(void);
+
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 
 /**
@@ -746,5 +889,68 @@ APEX_EXPORT void send (uint64_t tag, uint64_t size, uint64_t target);
  */
 APEX_EXPORT void recv (uint64_t tag, uint64_t size, uint64_t source);
 
+/**
+ \brief A timer that runs for the lifetime of the object.
+
+ The timer is started when the object is constructed, and stopped when
+ it is destroyed. The Tag type names the timer with a static function,
+ <tt>static const char * name(void)</tt>. The timer is registered once,
+ the first time a scoped_timer for the Tag is constructed, so starting
+ it does not look up the name. If APEX is disabled at runtime, the
+ registered handle is nullptr, and the timer costs one branch.
+ Usually created with the @ref APEX_SCOPED_TIMER macro.
+
+ \sa @ref APEX_SCOPED_TIMER, @ref apex::register_timer
+ */
+template <typename Tag>
+class scoped_timer {
+private:
+    profiler * _p;
+    static task_identifier * get_task_id(void) {
+        static task_identifier * id = register_timer(std::string(Tag::name()));
+        return id;
+    }
+public:
+    scoped_timer(void) : _p(nullptr) {
+        task_identifier * id = get_task_id();
+        if (id != nullptr) {
+            _p = start(id);
+        }
+    }
+    ~scoped_timer(void) {
+        if (_p != nullptr) {
+            stop(_p);
+        }
+    }
+    scoped_timer(const scoped_timer&) = delete;
+    scoped_timer& operator=(const scoped_timer&) = delete;
+};
+
 } //namespace apex
 
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define APEX_CONCAT_IMPL(a, b) a##b
+#define APEX_CONCAT(a, b) APEX_CONCAT_IMPL(a, b)
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+/**
+ \brief Time the rest of the enclosing scope.
+
+ Creates an @ref apex::scoped_timer named timer_name, which must be a
+ string literal (or a constant string). If the application is compiled
+ with APEX_NO_INSTRUMENTATION defined, the macro expands to nothing.
+
+ \param timer_name The name of the timer.
+ \sa @ref apex::scoped_timer
+ */
+#if defined(APEX_NO_INSTRUMENTATION)
+#define APEX_SCOPED_TIMER(timer_name)
+#else
+#define APEX_SCOPED_TIMER(timer_name) \
+    struct APEX_CONCAT(apex_scoped_timer_tag_, __LINE__) { \
+        static const char * name(void) { return timer_name; } \
+    }; \
+    apex::scoped_timer<APEX_CONCAT(apex_scoped_timer_tag_, __LINE__)> \
+        APEX_CONCAT(apex_scoped_timer_, __LINE__)
+#endif
+
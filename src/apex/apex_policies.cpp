@@ -257,11 +257,17 @@ int apex_throughput_throttling_policy(apex_context const context) {
       return APEX_NOERROR;
     }
 
+    // a consistent copy, so calls and accumulated agree
+    apex_profile snapshot;
     apex_profile * function_profile = NULL;
     if(thread_cap_tuning_session->function_of_interest != APEX_NULL_FUNCTION_ADDRESS) {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
     } else {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_name_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_name_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
     }
     double current_mean = function_profile->accumulated / function_profile->calls;
     //printf("%d Calls: %f, Accum: %f, Mean: %f\n", tuning_session->test_pp, function_profile->calls, function_profile->accumulated, current_mean);
@@ -272,6 +278,7 @@ int apex_throughput_throttling_policy(apex_context const context) {
         thread_cap_tuning_session->function_baseline.accumulated = function_profile->accumulated;
         thread_cap_tuning_session->function_history.calls = function_profile->calls;
         thread_cap_tuning_session->function_history.accumulated = function_profile->accumulated;
+        thread_cap_tuning_session->function_history.p99 = function_profile->p99;
         thread_cap_tuning_session->throughput_delay = MAX_WINDOW_SIZE;
         thread_cap_tuning_session->last_action = BASELINE;
         //printf("%d Got baseline.\n", tuning_session->test_pp);
@@ -339,6 +346,20 @@ int apex_throughput_throttling_policy(apex_context const context) {
         } else {
         // otherwise, nothing to do.
         }
+    } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_TAIL_LATENCY) {
+        double old_p99 = thread_cap_tuning_session->function_history.p99;
+        double current_p99 = function_profile->p99;
+        // is the tail at least 5% longer? If so, reverse course
+        if (current_p99 > (1.05*old_p99)) {
+            if (thread_cap_tuning_session->last_action == DECREASE) { do_increase = true; }
+            else if (thread_cap_tuning_session->last_action == INCREASE) { do_decrease = true; }
+        // is it at least 5% shorter? If so, do more adjustment
+        } else if (current_p99 < (0.95*old_p99)) {
+            if (thread_cap_tuning_session->last_action == INCREASE) { do_increase = true; }
+            else if (thread_cap_tuning_session->last_action == DECREASE) { do_decrease = true; }
+        } else {
+        // otherwise, nothing to do.
+        }
     }
 
     if (do_decrease) {
@@ -346,6 +367,7 @@ int apex_throughput_throttling_policy(apex_context const context) {
         // save this as our new history
         thread_cap_tuning_session->function_history.calls = function_profile->calls;
         thread_cap_tuning_session->function_history.accumulated = function_profile->accumulated;
+        thread_cap_tuning_session->function_history.p99 = function_profile->p99;
         __decrease_cap_gradual();
         thread_cap_tuning_session->last_action = DECREASE;
     } else if (do_increase) {
@@ -353,6 +375,7 @@ int apex_throughput_throttling_policy(apex_context const context) {
         // save this as our new history
         thread_cap_tuning_session->function_history.calls = function_profile->calls;
         thread_cap_tuning_session->function_history.accumulated = function_profile->accumulated;
+        thread_cap_tuning_session->function_history.p99 = function_profile->p99;
         __increase_cap_gradual();
         thread_cap_tuning_session->last_action = INCREASE;
     }
@@ -380,13 +403,19 @@ int apex_throughput_throttling_dhc_policy(apex_context const context) {
     static bool got_low = false;
     static bool got_high = false;
 
+    // a consistent copy, so calls and accumulated agree
+    apex_profile snapshot;
     apex_profile * function_profile = NULL;
     // get a measurement of our current setting
     if(thread_cap_tuning_session->function_of_interest != APEX_NULL_FUNCTION_ADDRESS) {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
         //reset(tuning_session->function_of_interest); // we want new measurements!
     } else {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_name_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_name_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
         //reset(tuning_session->function_name_of_interest); // we want new measurements!
     }
     // if we have no data yet, return.
@@ -411,6 +440,9 @@ int apex_throughput_throttling_dhc_policy(apex_context const context) {
     if (thread_cap_tuning_session->throttling_criteria == APEX_MAXIMIZE_THROUGHPUT) {
         new_value = function_profile->calls - previous_value;
         previous_value = function_profile->calls;
+    } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_TAIL_LATENCY) {
+        // the quantiles aren't additive, so use the latest one
+        new_value = function_profile->p99;
     } else {
         new_value = function_profile->accumulated - previous_value;
         previous_value = function_profile->accumulated;
@@ -515,12 +547,18 @@ int apex_throughput_throttling_ah_policy(apex_context const context) {
     }
 
     // get a measurement of our current setting
+    // a consistent copy, so calls and accumulated agree
+    apex_profile snapshot;
     apex_profile * function_profile = NULL;
     if(thread_cap_tuning_session->function_of_interest != APEX_NULL_FUNCTION_ADDRESS) {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
         //reset(thread_cap_tuning_session->function_of_interest); // we want new measurements!
     } else {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_name_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_name_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
         //reset(thread_cap_tuning_session->function_name_of_interest); // we want new measurements!
     }
     // if we have no data yet, return.
@@ -541,6 +579,9 @@ int apex_throughput_throttling_ah_policy(apex_context const context) {
     } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_ACCUMULATED) {
         new_value = function_profile->accumulated - previous_value;
         previous_value = function_profile->accumulated;
+    } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_TAIL_LATENCY) {
+        // the quantiles aren't additive, so use the latest one
+        new_value = function_profile->p99;
     }
     cout << "Cap: " << thread_cap_tuning_session->thread_cap << " New: " << abs(new_value) << " Prev: " << previous_value << endl;
 
@@ -591,11 +632,17 @@ int apex_throughput_tuning_policy(apex_context const context) {
     }
 
     // get a measurement of our current setting
+    // a consistent copy, so calls and accumulated agree
+    apex_profile snapshot;
     apex_profile * function_profile = NULL;
     if(thread_cap_tuning_session->function_of_interest != APEX_NULL_FUNCTION_ADDRESS) {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
     } else {
-        function_profile = apex::get_profile(thread_cap_tuning_session->function_name_of_interest);
+        if (apex::get_profile_snapshot(thread_cap_tuning_session->function_name_of_interest, snapshot)) {
+            function_profile = &snapshot;
+        }
     }
     // if we have no data yet, return.
     if (function_profile == NULL) { 
@@ -613,6 +660,9 @@ int apex_throughput_tuning_policy(apex_context const context) {
     } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_ACCUMULATED) {
         new_value = function_profile->accumulated - previous_value;
         previous_value = function_profile->accumulated;
+    } else if (thread_cap_tuning_session->throttling_criteria == APEX_MINIMIZE_TAIL_LATENCY) {
+        // the quantiles aren't additive, so use the latest one
+        new_value = function_profile->p99;
     }
 
     /* Report the performance we've just measured. */
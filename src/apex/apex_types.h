@@ -98,8 +98,10 @@ typedef enum {APEX_MAXIMIZE_THROUGHPUT,   /*!< maximize the number of calls to a
                                               timer/counter */
               APEX_MAXIMIZE_ACCUMULATED,  /*!< maximize the accumulated value of
                                               a timer/counter */
-              APEX_MINIMIZE_ACCUMULATED   /*!< minimize the accumulated value of
+              APEX_MINIMIZE_ACCUMULATED,  /*!< minimize the accumulated value of
                                               a timer/counter */
+              APEX_MINIMIZE_TAIL_LATENCY  /*!< minimize the 99th percentile
+                                              value of a timer/counter */
 } apex_optimization_criteria_t;
 
 /**
@@ -154,6 +156,21 @@ typedef struct _context
                        for a custom_event */
 } apex_context;
 
+/** What the values sampled for a counter mean, for apex_register_counter
+ */
+typedef enum _apex_counter_kind {
+  APEX_COUNTER_GAUGE = 0, /*!< Each sample is the current value, such as a
+                               queue length */
+  APEX_COUNTER_MONOTONIC  /*!< Each sample is a running total, such as the
+                               bytes sent so far. The profile records the
+                               increase since the previous sample. */
+} apex_counter_kind;
+
+/** The address of a registered counter in APEX, from
+ * apex_register_counter
+ */
+typedef void* apex_counter_handle;
+
 /** The type of a profiler object
  * 
  */
@@ -176,6 +193,16 @@ typedef struct _profile
     double maximum;       /*!< Maximum value seen by the timer or counter */
     apex_profile_type type; /*!< Whether this is a timer or a counter */
     double papi_metrics[8];  /*!< Array of accumulated PAPI hardware metrics */
+    double p50;           /*!< Estimated median value, in the same units as
+                              the minimum and maximum. The quantiles are
+                              only filled in at finalize, or in a copy
+                              from get_profile_snapshot */
+    double p90;           /*!< Estimated 90th percentile value */
+    double p99;           /*!< Estimated 99th percentile value */
+    double p999;          /*!< Estimated 99.9th percentile value */
+    double exclusive;     /*!< Accumulated exclusive time: the time not spent
+                              in other timers started inside this one, on
+                              the same thread */
 } apex_profile;
 
 /** Rather than use void pointers everywhere, be explicit about
@@ -207,10 +234,55 @@ typedef uint32_t apex_tuning_session_handle;
  * Special profile counter for derived idle rate 
  **/
 #define APEX_IDLE_RATE "APEX Idle Rate"
+/**
+ * Special profile counter for the rate (events per second) at which
+ * the profiler_listener consumer thread processes timer events
+ **/
+#define APEX_CONSUMER_DRAIN_RATE "APEX Consumer Drain Rate"
+/**
+ * Special profile counter for the most timer events seen waiting in the
+ * event rings since the last sample (sampled about once a second)
+ **/
+#define APEX_QUEUE_DEPTH "APEX Queue Depth"
+/**
+ * Special profile counter for the fraction of the time the
+ * profiler_listener consumer threads spent processing events
+ * since the last sample, from 0 to 1
+ **/
+#define APEX_CONSUMER_BUSY "APEX Consumer Busy Fraction"
+/**
+ * Special profile counter for the longest time, in seconds, a timer event
+ * waited in an event ring before a consumer thread processed it, since
+ * the last sample
+ **/
+#define APEX_EVENT_LATENCY "APEX Event Latency"
+/**
+ * Special profile counters for the number of timer events lost
+ * because an event ring was full: dropped, or skipped by the
+ * "sample" overflow policy. Per-timer counts are reported at exit
+ * with the timer name appended.
+ **/
+#define APEX_DROPPED_EVENTS "APEX Dropped Events"
+#define APEX_SAMPLED_EVENTS "APEX Sampled Events"
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 
 
+/* Building with APEX_THROTTLE turns timer throttling on by default */
+#if defined(APEX_THROTTLE)
+#define APEX_THROTTLE_TIMERS_DEFAULT true
+#else
+#define APEX_THROTTLE_TIMERS_DEFAULT false
+#endif
+
+/* Without a TSC, or when built with APEX_USE_CLOCK_TIMESTAMP, timers read
+ * CLOCK_MONOTONIC by default */
+#if defined(APEX_USE_CLOCK_TIMESTAMP) || !(defined(__x86_64__) || defined(__i386__))
+#define APEX_CLOCK_SOURCE_DEFAULT "monotonic"
+#else
+#define APEX_CLOCK_SOURCE_DEFAULT "tsc"
+#endif
+
 /**
  * for each of these macros, there are 5 values.
  *  - The environment variable
@@ -232,6 +304,11 @@ typedef uint32_t apex_tuning_session_handle;
     macro (APEX_PROFILE_OUTPUT, use_profile_output, int, false) \
     macro (APEX_CSV_OUTPUT, use_csv_output, int, false) \
     macro (APEX_TASKGRAPH_OUTPUT, use_taskgraph_output, bool, false) \
+    macro (APEX_BINARY_OUTPUT, use_binary_output, bool, false) \
+    macro (APEX_FINALIZE_THREADS, finalize_threads, int, 0) \
+    macro (APEX_FINALIZE_TIME_BUDGET, finalize_time_budget, int, 0) \
+    macro (APEX_CALLPATH_DEPTH, callpath_depth, int, 0) \
+    macro (APEX_PROFILE_SNAPSHOT_PERIOD, profile_snapshot_period, int, 0) \
     macro (APEX_PROC_CPUINFO, use_proc_cpuinfo, bool, false) \
     macro (APEX_PROC_MEMINFO, use_proc_meminfo, bool, false) \
     macro (APEX_PROC_NET_DEV, use_proc_net_dev, bool, false) \
@@ -247,14 +324,24 @@ typedef uint32_t apex_tuning_session_handle;
     macro (APEX_PTHREAD_WRAPPER_STACK_SIZE, pthread_wrapper_stack_size, int, 0) \
     macro (APEX_OMPT_REQUIRED_EVENTS_ONLY, ompt_required_events_only, bool, false) \
     macro (APEX_OMPT_HIGH_OVERHEAD_EVENTS, ompt_high_overhead_events, bool, false) \
-    macro (APEX_TASK_SCATTERPLOT, task_scatterplot, bool, false)
+    macro (APEX_TASK_SCATTERPLOT, task_scatterplot, bool, false) \
+    macro (APEX_TASK_SCATTERPLOT_SAMPLES, task_scatterplot_samples, int, 1000) \
+    macro (APEX_EVENT_RING_SIZE, event_ring_size, int, 16384) \
+    macro (APEX_NUM_CONSUMERS, num_consumers, int, 1) \
+    macro (APEX_OVERFLOW_TIMEOUT, overflow_timeout, int, 0) \
+    macro (APEX_THROTTLE_TIMERS, throttle_timers, bool, APEX_THROTTLE_TIMERS_DEFAULT) \
+    macro (APEX_THROTTLE_OVERHEAD, throttle_overhead, int, 1)
 
 #define FOREACH_APEX_STRING_OPTION(macro) \
     macro (APEX_PAPI_METRICS, papi_metrics, char*, "") \
+    macro (APEX_PERF_METRICS, perf_metrics, char*, "") \
     macro (APEX_PLUGINS, plugins, char*, "") \
     macro (APEX_PLUGINS_PATH, plugins_path, char*, "./") \
     macro (APEX_OTF2_ARCHIVE_PATH, otf2_archive_path, char*, "OTF2_archive") \
-    macro (APEX_OTF2_ARCHIVE_NAME, otf2_archive_name, char*, "APEX") 
+    macro (APEX_OTF2_ARCHIVE_NAME, otf2_archive_name, char*, "APEX") \
+    macro (APEX_AGGREGATION, aggregation, char*, "consumer") \
+    macro (APEX_OVERFLOW_POLICY, overflow_policy, char*, "block") \
+    macro (APEX_CLOCK_SOURCE, clock_source, char*, APEX_CLOCK_SOURCE_DEFAULT)
 
 #if defined(__linux) || defined(__linux__)
 #  define APEX_NATIVE_TLS __thread
@@ -0,0 +1,90 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "callpath.hpp"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace apex {
+
+struct callpath_node {
+  uint32_t parent;
+  uint32_t leaf;
+};
+
+/* every call path interned so far, by its ID */
+static std::mutex _nodes_mutex;
+static std::unordered_map<uint32_t, callpath_node> _nodes;
+static std::atomic<bool> _have_nodes(false);
+
+struct cached_callpath {
+  std::vector<uint32_t> ids;
+  task_identifier * id;
+};
+
+static APEX_NATIVE_TLS std::unordered_map<uint64_t, cached_callpath> * _cache = nullptr;
+
+static inline uint64_t hash_path(const uint32_t * ids, size_t depth) {
+  // FNV-1a, over the IDs
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0 ; i < depth ; i++) {
+    hash = (hash ^ ids[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Intern the path, and all of the shorter paths it extends */
+static task_identifier * intern(const uint32_t * ids, size_t depth) {
+  task_identifier * leaf = task_identifier::from_id(ids[depth-1]);
+  if (depth == 1) {
+    return leaf;
+  }
+  task_identifier * parent = intern(ids, depth - 1);
+  task_identifier * id = task_identifier::get_task_id(
+      parent->get_name() + APEX_CALLPATH_SEPARATOR + leaf->get_name());
+  std::unique_lock<std::mutex> l(_nodes_mutex);
+  _nodes.emplace(id->id, callpath_node{parent->id, leaf->id});
+  _have_nodes.store(true, std::memory_order_release);
+  return id;
+}
+
+task_identifier * callpath::get_callpath_id(const uint32_t * ids, size_t depth) {
+  if (_cache == nullptr) {
+    _cache = new std::unordered_map<uint64_t, cached_callpath>();
+  }
+  uint64_t hash = hash_path(ids, depth);
+  auto it = _cache->find(hash);
+  if (it != _cache->end()) {
+    const std::vector<uint32_t> &cached = it->second.ids;
+    if (cached.size() == depth && std::equal(cached.begin(), cached.end(), ids)) {
+      return it->second.id;
+    }
+    // a different path with the same hash, which isn't cached
+    return intern(ids, depth);
+  }
+  task_identifier * id = intern(ids, depth);
+  _cache->emplace(hash, cached_callpath{std::vector<uint32_t>(ids, ids + depth), id});
+  return id;
+}
+
+bool callpath::is_callpath(uint32_t id, uint32_t &parent, uint32_t &leaf) {
+  if (!_have_nodes.load(std::memory_order_acquire)) {
+    return false;
+  }
+  std::unique_lock<std::mutex> l(_nodes_mutex);
+  auto it = _nodes.find(id);
+  if (it == _nodes.end()) {
+    return false;
+  }
+  parent = it->second.parent;
+  leaf = it->second.leaf;
+  return true;
+}
+
+}
@@ -0,0 +1,41 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "task_identifier.hpp"
+#include <stdint.h>
+
+/* The deepest call path APEX_CALLPATH_DEPTH can ask for */
+#define APEX_MAX_CALLPATH_DEPTH 64
+/* Between the timers in a call path's name, as TAU writes them */
+#define APEX_CALLPATH_SEPARATOR " => "
+
+namespace apex {
+
+/* Call paths, for APEX_CALLPATH_DEPTH. A call path is the list of the IDs
+ * of the timers that were running on a thread when one of them stopped,
+ * outermost first. Each path of two or more timers is interned as a
+ * task_identifier named "outer => inner", so it gets a profile of its own
+ * like any other timer, and TAU shows it as a call tree.
+ *
+ * Each thread caches the identifiers it has looked up, keyed by a hash of
+ * the path, so a stop only builds the name the first time the thread
+ * sees the path. */
+class callpath {
+public:
+  /* The identifier for the path, which must be at least two long */
+  static task_identifier * get_callpath_id(const uint32_t * ids, size_t depth);
+  /* Is the ID a call path? If so, find its parent (the path without the
+   * innermost timer, which is a plain timer for a path of two) and the
+   * innermost timer. */
+  static bool is_callpath(uint32_t id, uint32_t &parent, uint32_t &leaf);
+  static bool is_callpath(uint32_t id) {
+    uint32_t parent, leaf;
+    return is_callpath(id, parent, leaf);
+  }
+};
+
+}
@@ -0,0 +1,150 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "clock_source.hpp"
+#include "apex_options.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+/* How many reads of each clock the startup benchmark times */
+#define APEX_CLOCK_BENCHMARK_READS 10000
+
+namespace apex {
+
+// see APEX_CLOCK_SOURCE_DEFAULT in apex_types.h
+#if defined(APEX_USE_CLOCK_TIMESTAMP) || !(defined(__x86_64__) || defined(__i386__))
+std::atomic<int> clock_source::_source(clock_monotonic);
+#else
+std::atomic<int> clock_source::_source(clock_tsc);
+#endif
+
+static const char * _clock_names[clock_source_count + 1] = {
+  "tsc", "monotonic", "monotonic_coarse", "realtime", "monotonic (in TSC ticks)"
+};
+
+/* where clock_tsc_fallback took over from the TSC, and its scale */
+static uint64_t _fallback_ticks = 0;
+static uint64_t _fallback_ns = 0;
+static double _fallback_ticks_per_ns = 0.0;
+
+static bool available(clock_source_type source) {
+#if !(defined(__x86_64__) || defined(__i386__))
+  if (source == clock_tsc) {
+    return false;
+  }
+#endif
+#if !defined(CLOCK_MONOTONIC_COARSE)
+  if (source == clock_monotonic_coarse) {
+    return false;
+  }
+#endif
+  APEX_UNUSED(source);
+  return true;
+}
+
+bool clock_source::select(const std::string &name) {
+  for (int i = 0 ; i < clock_source_count ; i++) {
+    if (name == _clock_names[i] && available((clock_source_type)i)) {
+      if (i == clock_tsc && !tsc::is_invariant()) {
+        // its rate can change with the CPU frequency
+        if (apex_options::use_screen_output()) {
+          std::cout << "The TSC is not invariant, so timers use the monotonic clock."
+                    << std::endl;
+        }
+        i = clock_monotonic;
+      }
+      _source.store(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void clock_source::tsc_unreliable(void) {
+  if (get() != clock_tsc) {
+    return;
+  }
+  _fallback_ticks = tsc::read();
+  _fallback_ns = read_clock(CLOCK_MONOTONIC);
+  _fallback_ticks_per_ns = 1.0e-9 / tsc::seconds_per_tick();
+  _source.store(clock_tsc_fallback, std::memory_order_release);
+}
+
+uint64_t clock_source::read_fallback(void) {
+  // pairs with the release in tsc_unreliable(), so the anchor is seen
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t ns = read_clock(CLOCK_MONOTONIC);
+  return _fallback_ticks + (uint64_t)((double)(ns - _fallback_ns) * _fallback_ticks_per_ns);
+}
+
+uint64_t clock_source::to_nanoseconds(uint64_t ticks) {
+  // the clock and CLOCK_REALTIME, read together the first time, when
+  // the TSC calibration stops being refined
+  struct anchor {
+    uint64_t ticks;
+    uint64_t ns;
+    anchor(void) : ticks(read()), ns(read_clock(CLOCK_REALTIME)) {
+      tsc::freeze();
+    }
+  };
+  static const anchor start;
+  double since = (double)(int64_t)(ticks - start.ticks) * seconds_per_tick() * 1.0e9;
+  return start.ns + (int64_t)since;
+}
+
+const char * clock_source::name(clock_source_type source) {
+  return _clock_names[source];
+}
+
+double clock_source::seconds_per_tick(clock_source_type source) {
+  if (source == clock_tsc || source == clock_tsc_fallback) {
+    return tsc::seconds_per_tick();
+  }
+  return 1.0e-9;
+}
+
+void clock_source::benchmark(void) {
+  std::streamsize precision = std::cout.precision();
+  std::cout << "Clock sources (cost per read, resolution):" << std::endl;
+  for (int i = 0 ; i < clock_source_count ; i++) {
+    clock_source_type source = (clock_source_type)i;
+    if (!available(source)) {
+      continue;
+    }
+    // don't let the compiler skip the reads
+    volatile uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int j = 0 ; j < APEX_CLOCK_BENCHMARK_READS ; j++) {
+      sink = read(source);
+    }
+    auto end = std::chrono::steady_clock::now();
+    (void)sink;
+    double cost = std::chrono::duration<double, std::nano>(end - start).count() /
+                  APEX_CLOCK_BENCHMARK_READS;
+    double resolution = seconds_per_tick(source) * 1.0e9;
+    if (source != clock_tsc) {
+      struct timespec ts;
+#if defined(CLOCK_MONOTONIC_COARSE)
+      clockid_t id = source == clock_monotonic_coarse ? CLOCK_MONOTONIC_COARSE :
+                     source == clock_realtime ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+#else
+      clockid_t id = source == clock_realtime ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+#endif
+      if (clock_getres(id, &ts) == 0) {
+        resolution = (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+      }
+    }
+    std::cout << "  " << std::left << std::setw(17) << name(source) << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8) << cost << " ns, "
+              << std::setw(10) << resolution << " ns"
+              << (source == get() ? " (selected)" : "") << std::endl;
+  }
+  std::cout.unsetf(std::ios_base::floatfield);
+  std::cout.precision(precision);
+}
+
+}
+
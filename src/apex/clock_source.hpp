@@ -0,0 +1,89 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "tsc.hpp"
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+
+namespace apex {
+
+/* The clocks timers can be read from */
+enum clock_source_type {
+  clock_tsc,              // the time stamp counter, see tsc.hpp
+  clock_monotonic,        // clock_gettime(CLOCK_MONOTONIC), usually a vDSO call
+  clock_monotonic_coarse, // clock_gettime(CLOCK_MONOTONIC_COARSE) - cheap, but only as fine as the scheduler tick
+  clock_realtime,         // clock_gettime(CLOCK_REALTIME)
+  clock_source_count,
+  // what clock_tsc becomes if the cores' TSCs turn out to disagree: the
+  // monotonic clock, counted in TSC ticks, so the times already taken
+  // stay comparable with the ones taken after
+  clock_tsc_fallback = clock_source_count
+};
+
+/* The clock all timers are read from, chosen once at startup with
+ * APEX_CLOCK_SOURCE. The TSC counts in its own ticks, the others in
+ * nanoseconds; seconds_per_tick() converts either way. The TSC is only
+ * used if it is invariant, and is replaced by the monotonic clock if the
+ * background check in tsc.cpp finds the cores' counters disagree. */
+class clock_source {
+private:
+  static std::atomic<int> _source;
+  static uint64_t read_fallback(void);
+public:
+  static inline uint64_t read_clock(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  }
+  static inline uint64_t read(clock_source_type source) {
+    switch (source) {
+      case clock_tsc:
+        return tsc::read();
+      case clock_monotonic_coarse:
+#if defined(CLOCK_MONOTONIC_COARSE)
+        return read_clock(CLOCK_MONOTONIC_COARSE);
+#else
+        return read_clock(CLOCK_MONOTONIC);
+#endif
+      case clock_realtime:
+        return read_clock(CLOCK_REALTIME);
+      case clock_tsc_fallback:
+        return read_fallback();
+      default:
+        return read_clock(CLOCK_MONOTONIC);
+    }
+  }
+  static inline uint64_t read(void) {
+    return read((clock_source_type)_source.load(std::memory_order_relaxed));
+  }
+  static clock_source_type get(void) {
+    return (clock_source_type)_source.load(std::memory_order_relaxed);
+  }
+  /* Choose the clock by name. Has to happen before any timer is started.
+   * Returns false (and keeps the current clock) if the name is unknown or
+   * the clock isn't available on this platform. A TSC that isn't invariant
+   * is replaced by the monotonic clock. */
+  static bool select(const std::string &name);
+  /* Replace the TSC by clock_tsc_fallback, if it is the clock in use */
+  static void tsc_unreliable(void);
+  static const char * name(clock_source_type source);
+  /* The length of one tick of the clock, in seconds */
+  static double seconds_per_tick(clock_source_type source);
+  static double seconds_per_tick(void) { return seconds_per_tick(get()); }
+  /* Convert a reading of the clock to nanoseconds since the epoch. The
+   * first conversion freezes the TSC calibration, so every timestamp is
+   * converted with the same scale and they stay in order. */
+  static uint64_t to_nanoseconds(uint64_t ticks);
+  /* Time reading each available clock, and write the cost per read and
+   * the resolution of each to the screen. */
+  static void benchmark(void);
+};
+
+}
+
@@ -21,6 +21,8 @@
 #include <fstream>
 #include <utility>
 #include "utils.hpp"
+#include "output_buffer.hpp"
+#include "finalize_pipeline.hpp"
 
 #ifdef APEX_HAVE_BFD
 #include "address_resolution.hpp"
@@ -147,7 +149,7 @@ bool concurrency_handler::on_resume(task_identifier * id) {
   }
 }
 
-void concurrency_handler::on_stop(std::shared_ptr<profiler> &p) {
+void concurrency_handler::on_stop(profiler_ptr &p) {
   if (!_terminate) {
     int i = thread_instance::get_id();
     stack<task_identifier>* my_stack = get_event_stack(i);
@@ -160,7 +162,7 @@ void concurrency_handler::on_stop(std::shared_ptr<profiler> &p) {
   APEX_UNUSED(p);
 }
 
-void concurrency_handler::on_yield(std::shared_ptr<profiler> &p) {
+void concurrency_handler::on_yield(profiler_ptr &p) {
     on_stop(p);
 }
 
@@ -177,7 +179,8 @@ void concurrency_handler::on_exit_thread(event_data &data) {
 
 void concurrency_handler::on_shutdown(shutdown_event_data &data) {
     cancel();
-    output_samples(data.node_id);
+    int node_id = data.node_id;
+    finalize_pipeline::add_output("concurrency output", [this, node_id]() { output_samples(node_id); });
 }
 
 inline stack<task_identifier>* concurrency_handler::get_event_stack(unsigned int tid) {
@@ -206,12 +209,11 @@ bool sort_functions(pair<task_identifier,int> first, pair<task_identifier,int> s
 }
 
 void concurrency_handler::output_samples(int node_id) {
-  //cout << _states.size() << " samples seen:" << endl;
-  ofstream myfile;
+  //cout << _states.size() << " samples seen:" << '\n';
   stringstream datname;
   datname << "concurrency." << node_id << ".dat";
-  myfile.open(datname.str().c_str());
   _function_mutex.lock();
+  output_buffer myfile(1024 + _states.size() * (MAX_FUNCTIONS_IN_CHART + 4) * 8);
   // limit ourselves to N functions.
   map<task_identifier, int> func_count;
   // initialize the map
@@ -246,32 +248,20 @@ void concurrency_handler::output_samples(int node_id) {
   }
   for (set<task_identifier>::iterator it=_functions.begin(); it!=_functions.end(); ++it) {
     if (top_x.find(*it) != top_x.end()) {
-      //string* tmp = demangle(*it);
-      task_identifier tmp_id = *it;
-      string tmp = tmp_id.get_name();
+      // the timers' names were resolved when the profiler listener was
+      // told of the shutdown; leave off their source locations
+      string tmp = it->id == APEX_NULL_TASK_ID ? task_identifier(*it).get_name() :
+                   finalize_pipeline::name(it->id);
 #ifdef APEX_HAVE_BFD
-      std::size_t pos = tmp.find("UNRESOLVED ADDR ");
+      std::size_t pos = tmp.find(" [{");
       if (pos != string::npos) {
-        string trimmed = tmp.substr(pos+16);
-        uintptr_t function_address = std::stoul(trimmed, nullptr, 16);
-        string * tmp2 = lookup_address(function_address, true);
-        pos = tmp2->find(" [{");
-        if (pos != string::npos) {
-            trimmed = tmp2->substr(0, pos);
-            myfile << "\"" << trimmed << "\"\t";
-        } else {
-            myfile << "\"" << *tmp2 << "\"\t";
-        }
-        delete (tmp2);
-      } else {
-        myfile << "\"" << tmp << "\"\t";
+        tmp = tmp.substr(0, pos);
       }
-#else
-      myfile << "\"" << tmp << "\"\t";
 #endif
+      myfile << "\"" << tmp << "\"\t";
     }
   }
-  myfile << "\"other\"" << endl;
+  myfile << "\"other\"" << '\n';
 
   size_t max_Y = 0;
   double max_Power = 0.0;
@@ -304,50 +294,50 @@ void concurrency_handler::output_samples(int node_id) {
         tmp_max += (*(_states[i]))[*it];
       }
     }
-    myfile << other << "\t" << endl;
+    myfile << other << "\t" << '\n';
     tmp_max += other;
     if (tmp_max > max_Y) max_Y = tmp_max;
     if ((size_t)(_thread_cap_samples[i]) > max_Y) max_Y = _thread_cap_samples[i];
     if (_power_samples[i] > max_Power) max_Power = _power_samples[i];
   }
   _function_mutex.unlock();
-  myfile.close();
+  myfile.write(datname.str());
 
   if (max_Power == 0.0) max_Power = 100;
   stringstream plotname;
   plotname << "concurrency." << node_id << ".gnuplot";
-  myfile.open(plotname.str().c_str());
-  myfile << "everyNth(col) = (int(column(col))%" << (int)(max_X/10) << "==0)?stringcolumn(1):\"\";" << endl;
-  myfile << "set key outside bottom center invert box" << endl;
-  myfile << "set xtics auto" << endl;
-  myfile << "set ytics 4" << endl;
-  myfile << "set y2tics auto" << endl;
-  myfile << "set xrange[0:" << max_X << "]" << endl;
-  myfile << "set yrange[0:" << max_Y << "]" << endl;
-  myfile << "set y2range[0:" << max_Power << "]" << endl;
-  myfile << "set xlabel \"Time\"" << endl;
-  myfile << "set ylabel \"Concurrency\"" << endl;
-  myfile << "set y2label \"Power\"" << endl;
-  myfile << "# Select histogram data" << endl;
-  myfile << "set style data histogram" << endl;
-  myfile << "# Give the bars a plain fill pattern, and draw a solid line around them." << endl;
-  myfile << "set style fill solid border" << endl;
-  myfile << "set style histogram rowstacked" << endl;
-  myfile << "set boxwidth 1.0 relative" << endl;
-  myfile << "set palette rgb 33,13,10" << endl;
-  myfile << "unset colorbox" << endl;
-  myfile << "set key noenhanced" << endl; // this allows underscores in names
-  myfile << "plot for [COL=" << (4+num_params) << ":" << top_x.size()+num_params+4;
-  myfile << "] '" << datname.str().c_str();
-  myfile << "' using COL:xticlabel(everyNth(1)) palette frac (COL-" << (3+num_params) << ")/" << top_x.size()+1;
-  myfile << ". title columnheader axes x1y1, '"  << datname.str().c_str();
-  myfile << "' using 2 with lines linecolor rgb \"red\" axes x1y1 title columnheader, '" << datname.str().c_str();
-  myfile << "' using 3 with lines linecolor rgb \"black\" axes x1y2 title columnheader,";
+  output_buffer plot;
+  plot << "everyNth(col) = (int(column(col))%" << (int)(max_X/10) << "==0)?stringcolumn(1):\"\";" << '\n';
+  plot << "set key outside bottom center invert box" << '\n';
+  plot << "set xtics auto" << '\n';
+  plot << "set ytics 4" << '\n';
+  plot << "set y2tics auto" << '\n';
+  plot << "set xrange[0:" << max_X << "]" << '\n';
+  plot << "set yrange[0:" << max_Y << "]" << '\n';
+  plot << "set y2range[0:" << max_Power << "]" << '\n';
+  plot << "set xlabel \"Time\"" << '\n';
+  plot << "set ylabel \"Concurrency\"" << '\n';
+  plot << "set y2label \"Power\"" << '\n';
+  plot << "# Select histogram data" << '\n';
+  plot << "set style data histogram" << '\n';
+  plot << "# Give the bars a plain fill pattern, and draw a solid line around them." << '\n';
+  plot << "set style fill solid border" << '\n';
+  plot << "set style histogram rowstacked" << '\n';
+  plot << "set boxwidth 1.0 relative" << '\n';
+  plot << "set palette rgb 33,13,10" << '\n';
+  plot << "unset colorbox" << '\n';
+  plot << "set key noenhanced" << '\n'; // this allows underscores in names
+  plot << "plot for [COL=" << (4+num_params) << ":" << top_x.size()+num_params+4;
+  plot << "] '" << datname.str().c_str();
+  plot << "' using COL:xticlabel(everyNth(1)) palette frac (COL-" << (3+num_params) << ")/" << top_x.size()+1;
+  plot << ". title columnheader axes x1y1, '"  << datname.str().c_str();
+  plot << "' using 2 with lines linecolor rgb \"red\" axes x1y1 title columnheader, '" << datname.str().c_str();
+  plot << "' using 3 with lines linecolor rgb \"black\" axes x1y2 title columnheader,";
   for(int p = 0; p < num_params; ++p) {
-    myfile << "'" << datname.str().c_str() << "' using " << (4+p) << " with linespoints axes x1y2 title columnheader,";
+    plot << "'" << datname.str().c_str() << "' using " << (4+p) << " with linespoints axes x1y2 title columnheader,";
   }
-  myfile << endl;
-  myfile.close();
+  plot << '\n';
+  plot.write(plotname.str());
 }
 
 }
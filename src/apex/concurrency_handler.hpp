@@ -46,14 +46,15 @@ public:
   concurrency_handler (unsigned int period);
   concurrency_handler (unsigned int period, int option);
   ~concurrency_handler (void) { };
+  uint32_t interest(void) { return APEX_INTEREST_TIMERS; }
   void on_startup(startup_event_data &data) { APEX_UNUSED(data); };
   void on_shutdown(shutdown_event_data &data);
   void on_new_node(node_event_data &data) { APEX_UNUSED(data); };
   void on_new_thread(new_thread_event_data &data);
   void on_exit_thread(event_data &data);
   bool on_start(task_identifier * id);
-  void on_stop(std::shared_ptr<profiler> &p);
-  void on_yield(std::shared_ptr<profiler> &p);
+  void on_stop(profiler_ptr &p);
+  void on_yield(profiler_ptr &p);
   bool on_resume(task_identifier * id);
   void on_new_task(task_identifier * id, uint64_t task_id) 
        { APEX_UNUSED(id); APEX_UNUSED(task_id); };
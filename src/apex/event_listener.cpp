@@ -16,11 +16,11 @@ namespace apex {
 
 /* this object never actually gets instantiated. too much overhead. */
 timer_event_data::timer_event_data(task_identifier * id) : task_id(id) {
-  this->my_profiler = std::make_shared<profiler>();
+  this->my_profiler = profiler_ptr(new profiler());
 }
 
 /* this object never actually gets instantiated. too much overhead. */
-timer_event_data::timer_event_data(std::shared_ptr<profiler> &the_profiler) : my_profiler(the_profiler) {
+timer_event_data::timer_event_data(profiler_ptr &the_profiler) : my_profiler(the_profiler) {
   this->task_id = the_profiler->task_id; 
 }
 
@@ -41,10 +41,24 @@ sample_value_event_data::sample_value_event_data(int thread_id, string counter_n
   this->thread_id = thread_id;
   this->counter_name = new string(counter_name);
   this->counter_value = counter_value;
+  this->counter_id = nullptr;
+  this->_owns_name = true;
+}
+
+sample_value_event_data::sample_value_event_data(int thread_id, task_identifier * counter_id, double counter_value) {
+  this->event_type_ = APEX_SAMPLE_VALUE;
+  this->is_counter = true;
+  this->thread_id = thread_id;
+  this->counter_name = &(counter_id->name);
+  this->counter_value = counter_value;
+  this->counter_id = counter_id;
+  this->_owns_name = false;
 }
 
 sample_value_event_data::~sample_value_event_data() {
-  delete(counter_name);
+  if (_owns_name) {
+    delete(counter_name);
+  }
 }
 
 custom_event_data::custom_event_data(apex_event_type event_type, void * custom_data) {
@@ -29,9 +29,9 @@ public:
 class timer_event_data : public event_data {
 public:
   task_identifier * task_id;
-  std::shared_ptr<profiler> my_profiler;
+  profiler_ptr my_profiler;
   timer_event_data(task_identifier * id);
-  timer_event_data(std::shared_ptr<profiler> &the_profiler);
+  timer_event_data(profiler_ptr &the_profiler);
   ~timer_event_data();
 };
 
@@ -57,8 +57,15 @@ public:
   std::string * counter_name;
   double counter_value;
   bool is_counter;
+  // the interned identifier for the counter, if the caller has it
+  task_identifier * counter_id;
   sample_value_event_data(int thread_id, std::string counter_name, double counter_value);
+  /* For a registered counter - the name belongs to the identifier, so
+   * nothing is copied or allocated. */
+  sample_value_event_data(int thread_id, task_identifier * counter_id, double counter_value);
   ~sample_value_event_data();
+private:
+  bool _owns_name;
 };
 
 class startup_event_data : public event_data {
@@ -92,6 +99,22 @@ public:
   ~custom_event_data();
 };
 
+/* The frequent events a listener can declare an interest in, with
+ * event_listener::interest(). The other events are rare, and every
+ * listener is told about them. */
+#define APEX_INTEREST_START        0x1
+#define APEX_INTEREST_STOP         0x2
+#define APEX_INTEREST_YIELD        0x4
+#define APEX_INTEREST_RESUME       0x8
+#define APEX_INTEREST_NEW_TASK     0x10
+#define APEX_INTEREST_SAMPLE_VALUE 0x20
+#define APEX_INTEREST_CUSTOM_EVENT 0x40
+#define APEX_INTEREST_SEND         0x80
+#define APEX_INTEREST_RECV         0x100
+#define APEX_INTEREST_ALL          0x1ff
+#define APEX_INTEREST_TIMERS (APEX_INTEREST_START | APEX_INTEREST_STOP | \
+                              APEX_INTEREST_YIELD | APEX_INTEREST_RESUME)
+
 /* Abstract class for creating an Event Listener class */
 
 class event_listener
@@ -99,6 +122,10 @@ class event_listener
 public:
   // virtual destructor
   virtual ~event_listener() {};
+  /* The APEX_INTEREST_* bits for the frequent events this listener
+   * handles - the handlers for the others are never called. If the
+   * answer changes, call apex::update_dispatch(). */
+  virtual uint32_t interest(void) { return APEX_INTEREST_ALL; }
   // all methods in the interface that a handler has to override
   virtual void on_startup(startup_event_data &data) = 0;
   virtual void on_shutdown(shutdown_event_data &data) = 0;
@@ -106,8 +133,8 @@ public:
   virtual void on_new_thread(new_thread_event_data &data) = 0;
   virtual void on_exit_thread(event_data &data) = 0;
   virtual bool on_start(task_identifier *id) = 0;
-  virtual void on_stop(std::shared_ptr<profiler> &p) = 0;
-  virtual void on_yield(std::shared_ptr<profiler> &p) = 0;
+  virtual void on_stop(profiler_ptr &p) = 0;
+  virtual void on_yield(profiler_ptr &p) = 0;
   virtual bool on_resume(task_identifier * id) = 0;
   virtual void on_new_task(task_identifier * id, uint64_t task_id) = 0;
   virtual void on_sample_value(sample_value_event_data &data) = 0;
@@ -0,0 +1,159 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifdef APEX_HAVE_HPX3
+#include <hpx/config.hpp>
+#endif
+
+#include "finalize_pipeline.hpp"
+#include "apex_options.hpp"
+#include "task_identifier.hpp"
+#include "utils.hpp"
+#if APEX_HAVE_BFD
+#include "address_resolution.hpp"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <stdlib.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace apex {
+
+/* how many names each task resolves */
+#define APEX_NAMES_PER_TASK 64
+
+static std::chrono::steady_clock::time_point _deadline;
+static bool _have_deadline = false;
+static std::unordered_map<uint32_t, std::string> _names;
+static std::mutex _outputs_mutex;
+static std::vector<std::pair<std::string, std::function<void()> > > _outputs;
+
+void finalize_pipeline::begin(void) {
+  int budget = apex_options::finalize_time_budget();
+  _have_deadline = budget > 0;
+  _deadline = std::chrono::steady_clock::now() + std::chrono::seconds(budget);
+}
+
+bool finalize_pipeline::expired(void) {
+  return _have_deadline && std::chrono::steady_clock::now() >= _deadline;
+}
+
+/* Run the tasks over the pool; the calling thread is one of the workers.
+ * Tasks not started before the budget runs out are marked as skipped.
+ * Returns how many were. */
+static size_t run_tasks(std::vector<std::function<void()> > &tasks,
+                        std::vector<char> &skipped) {
+  skipped.assign(tasks.size(), 0);
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> num_skipped(0);
+  auto worker = [&]() {
+    for (size_t i = next++ ; i < tasks.size() ; i = next++) {
+      if (finalize_pipeline::expired()) {
+        skipped[i] = 1;
+        num_skipped++;
+        continue;
+      }
+      tasks[i]();
+    }
+  };
+  size_t threads = apex_options::finalize_threads() > 0 ?
+      (size_t)apex_options::finalize_threads() : (size_t)hardware_concurrency();
+  threads = std::max((size_t)1, std::min(threads, tasks.size()));
+  std::vector<std::thread> pool;
+  for (size_t i = 1 ; i < threads ; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &t : pool) {
+    t.join();
+  }
+  return num_skipped;
+}
+
+static std::string resolve_name(uint32_t id) {
+  std::string name(task_identifier::from_id(id)->get_name());
+#if APEX_HAVE_BFD
+  // a call path has one address for each timer in it
+  const char * unresolved = "UNRESOLVED ADDR ";
+  size_t pos = name.find(unresolved);
+  while (pos != std::string::npos) {
+    const char * start = name.c_str() + pos;
+    char * end = nullptr;
+    uintptr_t address = strtoull(start + strlen(unresolved), &end, 16);
+    std::string * location = lookup_address(address, true);
+    name.replace(pos, end - start, *location);
+    pos = name.find(unresolved, pos + location->size());
+  }
+#endif
+  return name;
+}
+
+void finalize_pipeline::resolve_names(const std::vector<uint32_t> &ids) {
+  std::vector<std::string> resolved(ids.size());
+  std::vector<std::function<void()> > tasks;
+  for (size_t start = 0 ; start < ids.size() ; start += APEX_NAMES_PER_TASK) {
+    size_t end = std::min(ids.size(), start + APEX_NAMES_PER_TASK);
+    tasks.push_back([&ids, &resolved, start, end]() {
+      for (size_t i = start ; i < end ; i++) {
+        resolved[i] = resolve_name(ids[i]);
+      }
+    });
+  }
+  std::vector<char> skipped;
+  if (run_tasks(tasks, skipped) > 0) {
+    std::cerr << "APEX Warning : the finalize time budget ran out, so some "
+              << "timer names were not resolved." << std::endl;
+  }
+  for (size_t t = 0 ; t < tasks.size() ; t++) {
+    if (skipped[t]) {
+      continue;
+    }
+    size_t end = std::min(ids.size(), (t + 1) * APEX_NAMES_PER_TASK);
+    for (size_t i = t * APEX_NAMES_PER_TASK ; i < end ; i++) {
+      _names[ids[i]] = std::move(resolved[i]);
+    }
+  }
+}
+
+std::string finalize_pipeline::name(uint32_t id) {
+  auto it = _names.find(id);
+  if (it != _names.end()) {
+    return it->second;
+  }
+  return task_identifier::from_id(id)->get_name();
+}
+
+void finalize_pipeline::add_output(const std::string &what, std::function<void()> output) {
+  std::unique_lock<std::mutex> l(_outputs_mutex);
+  _outputs.push_back(std::make_pair(what, output));
+}
+
+void finalize_pipeline::run(void) {
+  std::vector<std::pair<std::string, std::function<void()> > > outputs;
+  {
+    std::unique_lock<std::mutex> l(_outputs_mutex);
+    outputs.swap(_outputs);
+  }
+  std::vector<std::function<void()> > tasks;
+  for (auto &output : outputs) {
+    tasks.push_back(output.second);
+  }
+  std::vector<char> skipped;
+  if (run_tasks(tasks, skipped) > 0) {
+    for (size_t i = 0 ; i < outputs.size() ; i++) {
+      if (skipped[i]) {
+        std::cerr << "APEX Warning : the finalize time budget ran out, so the "
+                  << outputs[i].first << " was not written." << std::endl;
+      }
+    }
+  }
+}
+
+}
@@ -0,0 +1,45 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace apex {
+
+/* The output APEX writes at exit. Rather than each listener writing its
+ * files in turn from on_shutdown, the listeners hand their outputs to the
+ * pipeline, and apex::finalize() runs them all at once, over a pool of
+ * APEX_FINALIZE_THREADS threads, once every listener has been told. Each
+ * output formats into its own output_buffer and writes its file with one
+ * write().
+ *
+ * The timer names the outputs use are resolved beforehand, in parallel and
+ * once each: demangled, and looked up with BFD when they are "UNRESOLVED
+ * ADDR"s. (BFD itself isn't thread safe, so the lookups are made one at a
+ * time, but each address is only looked up once.)
+ *
+ * With APEX_FINALIZE_TIME_BUDGET, no new work is started once that many
+ * seconds have passed since finalize began: names not yet resolved are
+ * written as they are, and outputs not yet started are skipped, with a
+ * warning. */
+class finalize_pipeline {
+public:
+  /* Start the clock for the time budget */
+  static void begin(void);
+  static bool expired(void);
+  /* Resolve the names of the timers, in parallel */
+  static void resolve_names(const std::vector<uint32_t> &ids);
+  /* The resolved name, or the name as it is if it wasn't resolved */
+  static std::string name(uint32_t id);
+  static void add_output(const std::string &what, std::function<void()> output);
+  /* Run the outputs, and wait for them */
+  static void run(void);
+};
+
+}
@@ -0,0 +1,191 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Each power of two is split into this many buckets, so a quantile is
+ * within about 3% of the true value */
+#define APEX_HISTOGRAM_SUB_BUCKETS 16
+#define APEX_HISTOGRAM_SUB_BITS 4
+/* The range of the histogram, 2^-32 up to 2^64. Values below go in the
+ * underflow bucket (with zero and negative values), values above in the
+ * last bucket. */
+#define APEX_HISTOGRAM_MIN_EXPONENT -32
+#define APEX_HISTOGRAM_OCTAVES 96
+
+namespace apex {
+
+/* A log-linear histogram of the values measured for one timer or counter,
+ * from which quantiles can be estimated. Histograms of the same timer can
+ * be merged. The buckets for each power of two are allocated the first
+ * time a value falls in it, and are not moved or freed until the
+ * histogram is destroyed, so a reader can walk the histogram while it is
+ * being updated (it will just see some counts from before the update and
+ * some from after). Only one thread may update it at a time. */
+class histogram {
+private:
+  std::atomic<uint64_t*> _octaves[APEX_HISTOGRAM_OCTAVES];
+  uint64_t _underflow;
+  uint64_t _count;
+  /* Which octave and bucket the value goes in. Returns false for the
+   * underflow bucket. */
+  static inline bool bucket_of(double value, int &octave, int &sub) {
+    if (!(value > 0.0)) {
+      return false;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int exponent = (int)((bits >> 52) & 0x7ff) - 1023;
+    if (exponent < APEX_HISTOGRAM_MIN_EXPONENT) {
+      return false;
+    }
+    octave = exponent - APEX_HISTOGRAM_MIN_EXPONENT;
+    if (octave >= APEX_HISTOGRAM_OCTAVES) {
+      octave = APEX_HISTOGRAM_OCTAVES - 1;
+      sub = APEX_HISTOGRAM_SUB_BUCKETS - 1;
+    } else {
+      sub = (int)((bits >> (52 - APEX_HISTOGRAM_SUB_BITS)) & (APEX_HISTOGRAM_SUB_BUCKETS - 1));
+    }
+    return true;
+  }
+  uint64_t * octave(int i) {
+    uint64_t * buckets = _octaves[i].load(std::memory_order_relaxed);
+    if (buckets == nullptr) {
+      buckets = new uint64_t[APEX_HISTOGRAM_SUB_BUCKETS]();
+      _octaves[i].store(buckets, std::memory_order_release);
+    }
+    return buckets;
+  }
+  void add_count(double value, uint64_t count) {
+    int o, sub;
+    if (bucket_of(value, o, sub)) {
+      octave(o)[sub] += count;
+    } else {
+      _underflow += count;
+    }
+    _count += count;
+  }
+public:
+  histogram(void) : _underflow(0), _count(0) {
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      _octaves[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  histogram(const histogram &other) : histogram() {
+    merge(other);
+  }
+  histogram &operator=(const histogram &) = delete;
+  ~histogram(void) {
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      delete[] _octaves[i].load(std::memory_order_relaxed);
+    }
+  }
+  inline void add(double value) {
+    add_count(value, 1);
+  }
+  /* A value that stands for weight measurements, from a throttled timer */
+  inline void add(double value, double weight) {
+    add_count(value, (uint64_t)llround(weight));
+  }
+  void merge(const histogram &other) {
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      uint64_t * theirs = other._octaves[i].load(std::memory_order_acquire);
+      if (theirs == nullptr) {
+        continue;
+      }
+      uint64_t * mine = octave(i);
+      for (int j = 0 ; j < APEX_HISTOGRAM_SUB_BUCKETS ; j++) {
+        mine[j] += theirs[j];
+      }
+    }
+    _underflow += other._underflow;
+    _count += other._count;
+  }
+  /* The buckets are numbered from 0, the underflow bucket, so a histogram
+   * can be saved as (index, count) pairs and rebuilt with add_bucket() */
+  template<typename F> void for_each_bucket(F f) const {
+    if (_underflow > 0) {
+      f((uint32_t)0, _underflow);
+    }
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      const uint64_t * buckets = _octaves[i].load(std::memory_order_acquire);
+      if (buckets == nullptr) {
+        continue;
+      }
+      for (int j = 0 ; j < APEX_HISTOGRAM_SUB_BUCKETS ; j++) {
+        if (buckets[j] > 0) {
+          f((uint32_t)(1 + i * APEX_HISTOGRAM_SUB_BUCKETS + j), buckets[j]);
+        }
+      }
+    }
+  }
+  void add_bucket(uint32_t index, uint64_t count) {
+    if (index == 0 || index > APEX_HISTOGRAM_OCTAVES * APEX_HISTOGRAM_SUB_BUCKETS) {
+      _underflow += count;
+    } else {
+      octave((index - 1) / APEX_HISTOGRAM_SUB_BUCKETS)[(index - 1) % APEX_HISTOGRAM_SUB_BUCKETS] += count;
+    }
+    _count += count;
+  }
+  /* The middle of the bucket, for moving its count to a histogram of
+   * values in other units */
+  static double bucket_value(uint32_t index) {
+    if (index == 0) {
+      return 0.0;
+    }
+    int i = (int)((index - 1) / APEX_HISTOGRAM_SUB_BUCKETS);
+    int j = (int)((index - 1) % APEX_HISTOGRAM_SUB_BUCKETS);
+    return ldexp(1.0 + (j + 0.5) / APEX_HISTOGRAM_SUB_BUCKETS, i + APEX_HISTOGRAM_MIN_EXPONENT);
+  }
+  uint64_t count(void) const { return _count; }
+  void reset(void) {
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      uint64_t * buckets = _octaves[i].load(std::memory_order_relaxed);
+      if (buckets != nullptr) {
+        memset(buckets, 0, sizeof(uint64_t) * APEX_HISTOGRAM_SUB_BUCKETS);
+      }
+    }
+    _underflow = 0;
+    _count = 0;
+  }
+  /* Estimate the q quantile (0 to 1), interpolating within the bucket it
+   * falls in. The estimate is kept between the minimum and maximum
+   * measured, which are exact. */
+  double quantile(double q, double minimum, double maximum) const {
+    if (_count == 0) {
+      return 0.0;
+    }
+    double rank = q * (double)_count;
+    double seen = (double)_underflow;
+    if (rank <= seen) {
+      return minimum;
+    }
+    for (int i = 0 ; i < APEX_HISTOGRAM_OCTAVES ; i++) {
+      const uint64_t * buckets = _octaves[i].load(std::memory_order_acquire);
+      if (buckets == nullptr) {
+        continue;
+      }
+      for (int j = 0 ; j < APEX_HISTOGRAM_SUB_BUCKETS ; j++) {
+        double count = (double)buckets[j];
+        if (count > 0.0 && seen + count >= rank) {
+          int exponent = i + APEX_HISTOGRAM_MIN_EXPONENT;
+          double low = ldexp(1.0 + (double)j / APEX_HISTOGRAM_SUB_BUCKETS, exponent);
+          double high = ldexp(1.0 + (double)(j + 1) / APEX_HISTOGRAM_SUB_BUCKETS, exponent);
+          double value = low + (high - low) * ((rank - seen) / count);
+          return fmax(minimum, fmin(maximum, value));
+        }
+        seen += count;
+      }
+    }
+    return maximum;
+  }
+};
+
+}
@@ -942,7 +942,7 @@ namespace apex {
         return on_start(id);
     }
 
-    void otf2_listener::on_stop(std::shared_ptr<profiler> &p) {
+    void otf2_listener::on_stop(profiler_ptr &p) {
         // each thread has its own event writer.  This static
         // variable will be initialized the first time we call
         // on_stop.
@@ -980,7 +980,7 @@ namespace apex {
         return;
     }
 
-    void otf2_listener::on_yield(std::shared_ptr<profiler> &p) {
+    void otf2_listener::on_yield(profiler_ptr &p) {
         on_stop(p);
     }
 
@@ -25,8 +25,7 @@ namespace apex {
         std::mutex _comm_mutex;
         static uint64_t globalOffset;
         static OTF2_TimeStamp get_time( void ) {
-            using namespace std::chrono;
-            uint64_t stamp = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+            uint64_t stamp = profiler::time_point_to_nanoseconds(MYCLOCK::now());
             //std::cout << " stamp before: " << stamp;
             stamp = stamp - globalOffset;
             //std::cout << " stamp after: " << stamp << std::endl;
@@ -256,14 +255,17 @@ namespace apex {
     public:
         otf2_listener (void);
         ~otf2_listener (void) { };
+        uint32_t interest(void) { return APEX_INTEREST_TIMERS |
+            APEX_INTEREST_SAMPLE_VALUE | APEX_INTEREST_SEND |
+            APEX_INTEREST_RECV; }
         void on_startup(startup_event_data &data);
         void on_shutdown(shutdown_event_data &data);
         void on_new_node(node_event_data &data);
         void on_new_thread(new_thread_event_data &data);
         void on_exit_thread(event_data &data);
         bool on_start(task_identifier *id);
-        void on_stop(std::shared_ptr<profiler> &p);
-        void on_yield(std::shared_ptr<profiler> &p);
+        void on_stop(profiler_ptr &p);
+        void on_yield(profiler_ptr &p);
         bool on_resume(task_identifier * id);
         void on_sample_value(sample_value_event_data &data);
         void on_new_task(task_identifier * id, uint64_t task_id)
@@ -0,0 +1,96 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace apex {
+
+/* A character buffer for formatting an output file. It is reserved up
+ * front for about the size of the output, values are printed straight
+ * into it, and the file is written with one write(). Numbers are written
+ * as an ostream with its default settings would write them. */
+class output_buffer {
+private:
+  std::vector<char> _data;
+  size_t _size;
+  void vprintf(const char * format, va_list args) {
+    va_list again;
+    va_copy(again, args);
+    int n = vsnprintf(_data.data() + _size, _data.size() - _size, format, args);
+    if (n >= 0 && (size_t)n >= _data.size() - _size) {
+      _data.resize(std::max(_data.size() * 2, _size + n + 1));
+      n = vsnprintf(_data.data() + _size, _data.size() - _size, format, again);
+    }
+    va_end(again);
+    if (n > 0) {
+      _size += n;
+    }
+  }
+  output_buffer &append(const char * s, size_t n) {
+    if (_size + n >= _data.size()) {
+      _data.resize(std::max(_data.size() * 2, _size + n + 1));
+    }
+    memcpy(_data.data() + _size, s, n);
+    _size += n;
+    return *this;
+  }
+public:
+  explicit output_buffer(size_t reserve = 4096) : _data(reserve + 1), _size(0) { }
+  output_buffer &printf(const char * format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+  {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    return *this;
+  }
+  output_buffer &operator<<(const std::string &s) { return append(s.data(), s.size()); }
+  output_buffer &operator<<(const char * s) { return append(s, strlen(s)); }
+  output_buffer &operator<<(char c) { return append(&c, 1); }
+  output_buffer &operator<<(int v) { return printf("%d", v); }
+  output_buffer &operator<<(unsigned int v) { return printf("%u", v); }
+  output_buffer &operator<<(long v) { return printf("%ld", v); }
+  output_buffer &operator<<(unsigned long v) { return printf("%lu", v); }
+  output_buffer &operator<<(long long v) { return printf("%lld", v); }
+  output_buffer &operator<<(unsigned long long v) { return printf("%llu", v); }
+  output_buffer &operator<<(double v) { return printf("%g", v); }
+  const char * data(void) const { return _data.data(); }
+  size_t size(void) const { return _size; }
+  void write(std::ostream &out) const { out.write(_data.data(), _size); }
+  /* Write the buffer to the file, in one write(). Returns false, with a
+   * warning, if it can't. */
+  bool write(const std::string &filename) const {
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ssize_t written = -1;
+    int error = errno;
+    if (fd >= 0) {
+      written = ::write(fd, _data.data(), _size);
+      error = errno;
+      ::close(fd);
+    }
+    if (written != (ssize_t)_size) {
+      std::cerr << "APEX Warning : can't write " << filename << ": "
+                << (written < 0 ? strerror(error) : "short write") << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
+
+}
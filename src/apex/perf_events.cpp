@@ -0,0 +1,426 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "perf_events.hpp"
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace apex {
+
+#if defined(__linux__)
+
+struct perf_metric {
+  const char * name;
+  uint32_t type;
+  uint64_t config;
+};
+
+static const perf_metric _known_metrics[] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+  {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+  {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES},
+  {"ref-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+  {"stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND},
+  {"stalled-cycles-backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+  {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+  {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+  {"minor-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN},
+  {"major-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+  {"alignment-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS},
+  {"emulation-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_EMULATION_FAULTS}
+};
+
+/* used when no hardware counters can be opened */
+static const char * _software_fallback = "task-clock context-switches page-faults cpu-migrations";
+
+/* the configured metrics */
+static std::vector<perf_metric> _metrics;
+static std::vector<std::string> _names;
+
+static int open_event(const perf_metric &metric, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = metric.type;
+  attr.config = metric.config;
+  // only count this thread's user space, which needs no privileges
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static inline bool is_hardware(const perf_metric &metric) {
+  return metric.type == PERF_TYPE_HARDWARE;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t rdpmc(uint32_t counter) {
+  uint32_t lo, hi;
+  asm volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (counter));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+/* The events of one group, and how to read them */
+class perf_group {
+public:
+  std::vector<size_t> metrics;  // index into _metrics of each event, in order
+  std::vector<int> fds;         // the first is the group leader
+  std::vector<struct perf_event_mmap_page*> pages;
+  std::vector<uint64_t> buffer;
+  bool use_rdpmc;
+  perf_group(void) : use_rdpmc(false) {}
+  int leader(void) { return fds.empty() ? -1 : fds[0]; }
+  /* Read each event with rdpmc, scaled up like read_group() does if it
+   * has been multiplexed, following the perf_event_mmap_page protocol.
+   * Returns false if an event isn't on a counter right now (multiplexed
+   * out), or its times can't be brought up to date, so the group has to
+   * be read. */
+  bool read_rdpmc(uint64_t * values) {
+#if defined(__x86_64__) || defined(__i386__)
+    for (size_t i = 0 ; i < pages.size() ; i++) {
+      volatile struct perf_event_mmap_page * page = pages[i];
+      uint32_t seq;
+      uint64_t count, enabled, running;
+      do {
+        seq = page->lock;
+        asm volatile("" ::: "memory");
+        uint32_t index = page->index;
+        if (index == 0) {
+          return false;
+        }
+        enabled = page->time_enabled;
+        running = page->time_running;
+        if (enabled != running) {
+          if (!page->cap_user_time) {
+            return false;
+          }
+          // the time since the kernel last updated the page
+          uint16_t shift = page->time_shift;
+          uint32_t mult = page->time_mult;
+          uint64_t cycles = rdtsc();
+          uint64_t quot = cycles >> shift;
+          uint64_t rem = cycles & (((uint64_t)1 << shift) - 1);
+          uint64_t delta = page->time_offset + quot * mult + ((rem * mult) >> shift);
+          enabled += delta;
+          running += delta;
+        }
+        count = page->offset;
+        uint64_t pmc = rdpmc(index - 1);
+        // sign extend the counter from its width
+        uint16_t width = page->pmc_width;
+        pmc <<= 64 - width;
+        count += (uint64_t)((int64_t)pmc >> (64 - width));
+        asm volatile("" ::: "memory");
+      } while (page->lock != seq);
+      if (running > 0 && running < enabled) {
+        count = (uint64_t)((double)count * ((double)enabled / (double)running));
+      }
+      values[metrics[i]] = count;
+    }
+    return true;
+#else
+    (void)values;
+    return false;
+#endif
+  }
+  /* Read the whole group at once, scaling the counts up if the group was
+   * only on the counters part of the time */
+  bool read_group(uint64_t * values) {
+    // nr, time enabled, time running, then the values
+    size_t size = (3 + fds.size()) * sizeof(uint64_t);
+    if (::read(fds[0], buffer.data(), size) != (ssize_t)size) {
+      return false;
+    }
+    double scale = 1.0;
+    if (buffer[2] > 0 && buffer[2] < buffer[1]) {
+      scale = (double)buffer[1] / (double)buffer[2];
+    }
+    for (size_t i = 0 ; i < fds.size() ; i++) {
+      values[metrics[i]] = scale == 1.0 ? buffer[3 + i] :
+                           (uint64_t)((double)buffer[3 + i] * scale);
+    }
+    return true;
+  }
+  bool read(uint64_t * values) {
+    if (fds.empty()) {
+      return true;
+    }
+    if (use_rdpmc && read_rdpmc(values)) {
+      return true;
+    }
+    return read_group(values);
+  }
+  void close_all(void) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (auto page : pages) {
+      munmap((void*)page, page_size);
+    }
+    for (int fd : fds) {
+      close(fd);
+    }
+    pages.clear();
+    fds.clear();
+  }
+};
+
+/* One thread's counters, and its totals for each timer. Never deleted, so
+ * the totals outlive the thread. */
+class perf_thread {
+private:
+  std::atomic<bool> _lock;
+public:
+  perf_group groups[2];  // hardware, software
+  bool ok;
+  std::vector<double> sums;  // num_metrics() for each timer ID
+  std::vector<uint64_t> now;
+  std::vector<uint64_t*> free_values;
+  perf_thread * next;
+  perf_thread(void) : _lock(false), ok(true), sums(), now(_metrics.size()),
+    free_values(), next(nullptr) {}
+  void lock(void) {
+    while (_lock.exchange(true, std::memory_order_acquire)) { }
+  }
+  void unlock(void) { _lock.store(false, std::memory_order_release); }
+  bool read(uint64_t * values) {
+    return groups[0].read(values) && groups[1].read(values);
+  }
+  void open(void) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t m = 0 ; m < _metrics.size() && ok ; m++) {
+      perf_group &group = groups[is_hardware(_metrics[m]) ? 0 : 1];
+      int fd = open_event(_metrics[m], group.leader());
+      if (fd < 0) {
+        ok = false;
+        break;
+      }
+      group.metrics.push_back(m);
+      group.fds.push_back(fd);
+    }
+    for (perf_group &group : groups) {
+      group.buffer.resize(3 + group.fds.size());
+    }
+    // the hardware events can be read with rdpmc, if the kernel allows it
+    perf_group &hardware = groups[0];
+    hardware.use_rdpmc = ok && !hardware.fds.empty();
+    for (size_t i = 0 ; i < hardware.fds.size() && hardware.use_rdpmc ; i++) {
+      void * page = mmap(nullptr, page_size, PROT_READ, MAP_SHARED, hardware.fds[i], 0);
+      if (page == MAP_FAILED) {
+        hardware.use_rdpmc = false;
+        break;
+      }
+      hardware.pages.push_back((struct perf_event_mmap_page*)page);
+      if (!hardware.pages.back()->cap_user_rdpmc) {
+        hardware.use_rdpmc = false;
+      }
+    }
+    if (!ok) {
+      close_all();
+    }
+  }
+  void close_all(void) {
+    groups[0].close_all();
+    groups[1].close_all();
+  }
+};
+
+static std::atomic<perf_thread*> _all_threads(nullptr);
+
+/* Closes the thread's counters when it exits */
+class perf_thread_holder {
+public:
+  perf_thread * thread;
+  perf_thread_holder(void) : thread(nullptr) {}
+  ~perf_thread_holder(void) {
+    if (thread != nullptr) {
+      thread->lock();
+      thread->ok = false;
+      thread->close_all();
+      for (uint64_t * values : thread->free_values) {
+        delete[] values;
+      }
+      thread->free_values.clear();
+      thread->unlock();
+    }
+  }
+};
+
+static thread_local perf_thread_holder _this_thread;
+
+static perf_thread * get_thread(void) {
+  perf_thread * thread = _this_thread.thread;
+  if (thread == nullptr) {
+    if (_metrics.empty()) {
+      return nullptr;
+    }
+    thread = new perf_thread();
+    thread->open();
+    thread->next = _all_threads.load(std::memory_order_relaxed);
+    while (!_all_threads.compare_exchange_weak(thread->next, thread,
+           std::memory_order_release, std::memory_order_relaxed)) { }
+    _this_thread.thread = thread;
+  }
+  return thread->ok ? thread : nullptr;
+}
+
+static void add_metrics(const std::string &metrics, bool &hardware_failed) {
+  std::stringstream names(metrics);
+  std::string name;
+  while (names >> name) {
+    bool found = false;
+    for (const perf_metric &metric : _known_metrics) {
+      if (name != metric.name) {
+        continue;
+      }
+      found = true;
+      int fd = open_event(metric, -1);
+      if (fd < 0) {
+        std::cerr << "APEX Warning : can't open the perf event \"" << name
+                  << "\": " << strerror(errno) << std::endl;
+        hardware_failed = hardware_failed || is_hardware(metric);
+      } else {
+        close(fd);
+        _metrics.push_back(metric);
+        _names.push_back(name);
+      }
+    }
+    if (!found) {
+      std::cerr << "APEX Warning : unknown perf event \"" << name << "\"." << std::endl;
+    }
+  }
+}
+
+size_t perf_events::configure(const std::string &metrics) {
+  std::string list(metrics);
+  for (char &c : list) {
+    if (c == ',') { c = ' '; }
+  }
+  bool hardware_failed = false;
+  add_metrics(list, hardware_failed);
+  if (_metrics.empty() && hardware_failed) {
+    std::cerr << "APEX Warning : no hardware counters are available, using \""
+              << _software_fallback << "\" instead." << std::endl;
+    add_metrics(_software_fallback, hardware_failed);
+  }
+  return _metrics.size();
+}
+
+size_t perf_events::num_metrics(void) {
+  return _metrics.size();
+}
+
+const std::string &perf_events::metric_name(size_t index) {
+  return _names[index];
+}
+
+uint64_t * perf_events::start(void) {
+  perf_thread * thread = get_thread();
+  if (thread == nullptr) {
+    return nullptr;
+  }
+  uint64_t * values;
+  if (thread->free_values.empty()) {
+    // the last value is the thread that read them
+    values = new uint64_t[_metrics.size() + 1];
+  } else {
+    values = thread->free_values.back();
+    thread->free_values.pop_back();
+  }
+  values[_metrics.size()] = (uint64_t)(uintptr_t)thread;
+  if (!thread->read(values)) {
+    release(values);
+    return nullptr;
+  }
+  return values;
+}
+
+void perf_events::stop(uint32_t id, uint64_t * start_values, double weight) {
+  perf_thread * thread = get_thread();
+  size_t n = _metrics.size();
+  if (thread != nullptr && start_values[n] == (uint64_t)(uintptr_t)thread &&
+      thread->read(thread->now.data())) {
+    thread->lock();
+    if (thread->sums.size() < (id + 1) * n) {
+      thread->sums.resize(std::max(thread->sums.size() * 2, (id + 1) * n), 0.0);
+    }
+    for (size_t m = 0 ; m < n ; m++) {
+      if (thread->now[m] > start_values[m]) {
+        thread->sums[id * n + m] += (double)(thread->now[m] - start_values[m]) * weight;
+      }
+    }
+    thread->unlock();
+  }
+  release(start_values);
+}
+
+void perf_events::release(uint64_t * start_values) {
+  perf_thread * thread = _this_thread.thread;
+  if (thread != nullptr && thread->ok) {
+    thread->free_values.push_back(start_values);
+  } else {
+    delete[] start_values;
+  }
+}
+
+void perf_events::totals(std::vector<double> &values) {
+  for (perf_thread * thread = _all_threads.load(std::memory_order_acquire) ;
+       thread != nullptr ; thread = thread->next) {
+    thread->lock();
+    if (values.size() < thread->sums.size()) {
+      values.resize(thread->sums.size(), 0.0);
+    }
+    for (size_t i = 0 ; i < thread->sums.size() ; i++) {
+      values[i] += thread->sums[i];
+    }
+    thread->unlock();
+  }
+}
+
+#else // not Linux
+
+static std::vector<std::string> _names;
+
+size_t perf_events::configure(const std::string &metrics) {
+  if (!metrics.empty()) {
+    std::cerr << "APEX Warning : perf events are only supported on Linux." << std::endl;
+  }
+  return 0;
+}
+
+size_t perf_events::num_metrics(void) { return 0; }
+const std::string &perf_events::metric_name(size_t index) { return _names[index]; }
+uint64_t * perf_events::start(void) { return nullptr; }
+void perf_events::stop(uint32_t id, uint64_t * start_values, double weight) {
+  (void)id; (void)start_values; (void)weight;
+}
+void perf_events::release(uint64_t * start_values) { delete[] start_values; }
+void perf_events::totals(std::vector<double> &values) { (void)values; }
+
+#endif
+
+}
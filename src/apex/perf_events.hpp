@@ -0,0 +1,50 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace apex {
+
+/* Hardware and software counters for timers, read with the Linux
+ * perf_event_open interface (no PAPI needed). The metrics are chosen
+ * once, with APEX_PERF_METRICS. Each thread opens its own counters the
+ * first time it starts a timer: the hardware events in one group and the
+ * software events in another, so each group is read at once. A hardware
+ * group is read with rdpmc, through the event's mmap'd page, when the
+ * kernel allows it; otherwise with one read() per group.
+ *
+ * The counts for each timer are added up in a table per thread, so there
+ * is no limit on the number of metrics, and the consumer threads aren't
+ * involved. */
+class perf_events {
+public:
+  /* Parse the metric names, and check that each can be opened. Hardware
+   * events that can't be (in most virtual machines, for example) are
+   * dropped with a warning, and if none of the requested metrics are
+   * left, the software events task-clock, context-switches, page-faults
+   * and cpu-migrations are used instead. Returns the number of metrics. */
+  static size_t configure(const std::string &metrics);
+  static size_t num_metrics(void);
+  static const std::string &metric_name(size_t index);
+  /* Read this thread's counters, for a timer that is starting. Returns
+   * nullptr if they can't be read. The values belong to the thread that
+   * read them; pass them to stop() or release(). */
+  static uint64_t * start(void);
+  /* Read the counters again, add the differences (times weight, for a
+   * throttled timer) to the timer's totals, and release the values.
+   * Counts are per thread, so nothing is added if the timer stops on a
+   * different thread than it started on. */
+  static void stop(uint32_t id, uint64_t * start_values, double weight);
+  static void release(uint64_t * start_values);
+  /* The totals for all timers, from all threads: num_metrics() values
+   * for each timer ID */
+  static void totals(std::vector<double> &values);
+};
+
+}
@@ -338,6 +338,19 @@ inline void policy_handler::call_policies(
   }
 }
 
+uint32_t policy_handler::interest(void) {
+    uint32_t mask = 0;
+    if (!start_event_policies.empty()) { mask |= APEX_INTEREST_START; }
+    if (!stop_event_policies.empty()) { mask |= APEX_INTEREST_STOP; }
+    if (!yield_event_policies.empty()) { mask |= APEX_INTEREST_YIELD; }
+    if (!resume_event_policies.empty()) { mask |= APEX_INTEREST_RESUME; }
+    if (!sample_value_policies.empty()) { mask |= APEX_INTEREST_SAMPLE_VALUE; }
+    for (const auto &policies : custom_event_policies) {
+        if (!policies.empty()) { mask |= APEX_INTEREST_CUSTOM_EVENT; }
+    }
+    return mask;
+}
+
 void policy_handler::on_startup(startup_event_data &data) {
     if (_terminate) return;
     if (startup_policies.empty()) return;
@@ -416,7 +429,7 @@ bool policy_handler::on_resume(task_identifier * id) {
   return true;
 }
 
-void policy_handler::on_stop(std::shared_ptr<profiler> &p) {
+void policy_handler::on_stop(profiler_ptr &p) {
     if (_terminate) return;
     if (stop_event_policies.empty()) return;
     for(const std::shared_ptr<policy_instance>& policy : stop_event_policies) {
@@ -432,7 +445,7 @@ void policy_handler::on_stop(std::shared_ptr<profiler> &p) {
     APEX_UNUSED(p);
 }
 
-void policy_handler::on_yield(std::shared_ptr<profiler> &p) {
+void policy_handler::on_yield(profiler_ptr &p) {
     if (_terminate) return;
     if (yield_event_policies.empty()) return;
     for(const std::shared_ptr<policy_instance>& policy : yield_event_policies) {
@@ -5,30 +5,65 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <string.h>
+#include <thread>
 #include <sstream>
 #include <math.h>
 #include "apex_options.hpp"
 #include "apex_types.h"
+#include "histogram.hpp"
 
 // Use this if you want the min, max and stddev.
 #define FULL_STATISTICS
 
 namespace apex {
 
+/* The statistics for one timer or counter. Only one thread updates a
+ * profile at a time, but others can read it at any time with snapshot():
+ * each update is bracketed by a sequence lock, so readers get a
+ * consistent copy without ever making the updater wait. The sequence lock
+ * doesn't serialize updates: they are made by the shard's consumer, or
+ * under the shard's lock (merges, shutdown), never by the application
+ * threads directly - a reset is sent to the consumer through the rings. The histogram
+ * of the values gives the quantiles; values measured while a timer was
+ * yielded aren't calls, so they aren't in it. */
 class profile {
 private:
     apex_profile _profile;
+    // true if some of the values were extrapolated from throttled timers
+    bool _estimated;
+    // where the last throttling window started, see window_mean()
+    double _window_calls;
+    double _window_accumulated;
+    histogram * _histogram;
+    // odd while an update is in progress
+    std::atomic<uint32_t> _version;
+    inline void begin_update(void) {
+        _version.store(_version.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    inline void end_update(void) {
+        _version.store(_version.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+    }
 public:
-    profile(double initial, int num_metrics, double * papi_metrics, bool yielded = false, apex_profile_type type = APEX_TIMER) {
+    profile(double initial, int num_metrics, double * papi_metrics, bool yielded = false, apex_profile_type type = APEX_TIMER, double children = 0.0) :
+        _estimated(false), _window_calls(0.0), _window_accumulated(0.0),
+        _histogram(new histogram()), _version(0) {
         _profile.type = type;
         if (!yielded) {
             _profile.calls = 1.0;
+            _histogram->add(initial);
         } else {
             _profile.calls = 0.0;
         }
         _profile.accumulated = initial;
+        _profile.exclusive = initial - children;
+        _profile.p50 = _profile.p90 = _profile.p99 = _profile.p999 = 0.0;
         for (int i = 0 ; i < num_metrics ; i++) {
             _profile.papi_metrics[i] = papi_metrics[i];
         }
@@ -38,8 +73,20 @@ public:
         _profile.maximum = initial;
 #endif
     };
-    void increment(double increase, int num_metrics, double * papi_metrics, bool yielded) {
+    profile(const profile &other) : _estimated(other._estimated),
+        _window_calls(other._window_calls),
+        _window_accumulated(other._window_accumulated),
+        _histogram(new histogram(*(other._histogram))), _version(0) {
+        other.snapshot(_profile);
+    }
+    profile &operator=(const profile &) = delete;
+    ~profile(void) { delete _histogram; }
+    /* Add a measurement, of which children was spent in other timers
+     * started inside this one. */
+    void increment(double increase, double children, int num_metrics, double * papi_metrics, bool yielded) {
+        begin_update();
         _profile.accumulated += increase;
+        _profile.exclusive += increase - children;
         for (int i = 0 ; i < num_metrics ; i++) {
             _profile.papi_metrics[i] += papi_metrics[i];
         }
@@ -51,18 +98,124 @@ public:
 #endif
         if (!yielded) {
           _profile.calls = _profile.calls + 1.0;
+          _histogram->add(increase);
+        } 
+        end_update();
+    }
+    /* Add a measurement that stands for weight calls, when only 1 in
+     * weight calls of a throttled timer was measured. The totals are
+     * extrapolated, so the profile becomes an estimate. */
+    void increment(double increase, double children, int num_metrics, double * papi_metrics, bool yielded, double weight) {
+        begin_update();
+        _profile.accumulated += increase * weight;
+        _profile.exclusive += (increase - children) * weight;
+        for (int i = 0 ; i < num_metrics ; i++) {
+            _profile.papi_metrics[i] += papi_metrics[i] * weight;
+        }
+#ifdef FULL_STATISTICS
+        _profile.sum_squares += (increase * increase) * weight;
+        _profile.minimum = _profile.minimum > increase ? increase : _profile.minimum;
+        _profile.maximum = _profile.maximum < increase ? increase : _profile.maximum;
+#endif
+        if (!yielded) {
+          _profile.calls = _profile.calls + weight;
+          _histogram->add(increase, weight);
         } 
+        _estimated = true;
+        end_update();
+    }
+    /* The mean of the calls made since the last window ended, which
+     * the throttler uses to notice when a timer's behavior changes.
+     * Returns false (and keeps the window open) until min_calls
+     * calls have been made. */
+    bool window_mean(double min_calls, double &mean) {
+        double calls = _profile.calls - _window_calls;
+        if (calls < min_calls) {
+            return false;
+        }
+        mean = (_profile.accumulated - _window_accumulated) / calls;
+        _window_calls = _profile.calls;
+        _window_accumulated = _profile.accumulated;
+        return true;
+    }
+    /* Add the measurements from another profile of the same timer,
+     * such as one aggregated by a single thread. */
+    void merge(profile &other, int num_metrics) {
+        begin_update();
+#ifdef FULL_STATISTICS
+        if (_profile.calls == 0.0) {
+            _profile.minimum = other._profile.minimum;
+            _profile.maximum = other._profile.maximum;
+        } else if (other._profile.calls > 0.0) {
+            _profile.minimum = _profile.minimum > other._profile.minimum ? other._profile.minimum : _profile.minimum;
+            _profile.maximum = _profile.maximum < other._profile.maximum ? other._profile.maximum : _profile.maximum;
+        }
+        _profile.sum_squares += other._profile.sum_squares;
+#endif
+        _profile.accumulated += other._profile.accumulated;
+        _profile.exclusive += other._profile.exclusive;
+        _profile.calls += other._profile.calls;
+        _estimated = _estimated || other._estimated;
+        for (int i = 0 ; i < num_metrics ; i++) {
+            _profile.papi_metrics[i] += other._profile.papi_metrics[i];
+        }
+        _histogram->merge(*(other._histogram));
+        end_update();
     }
     void reset() {
+        begin_update();
         _profile.calls = 0.0;
         _profile.accumulated = 0.0;
+        _profile.exclusive = 0.0;
         _profile.sum_squares = 0.0;
         _profile.minimum = 0.0;
         _profile.maximum = 0.0;
+        _estimated = false;
+        _window_calls = 0.0;
+        _window_accumulated = 0.0;
+        _histogram->reset();
+        end_update();
     };
+    /* Copy the statistics, retrying if an update was in progress */
+    void snapshot(apex_profile &copy) const {
+        uint32_t before, after;
+        do {
+            while ((before = _version.load(std::memory_order_acquire)) & 1) {
+                std::this_thread::yield();
+            }
+            memcpy(&copy, &_profile, sizeof(apex_profile));
+            get_quantiles(copy);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = _version.load(std::memory_order_relaxed);
+        } while (before != after);
+    }
+    /* Estimate the quantiles for the copy from the histogram */
+    void get_quantiles(apex_profile &copy) const {
+        copy.p50 = _histogram->quantile(0.5, copy.minimum, copy.maximum);
+        copy.p90 = _histogram->quantile(0.9, copy.minimum, copy.maximum);
+        copy.p99 = _histogram->quantile(0.99, copy.minimum, copy.maximum);
+        copy.p999 = _histogram->quantile(0.999, copy.minimum, copy.maximum);
+    }
+    /* Fill in the quantiles of the profile returned by get_profile().
+     * They aren't kept current as values are added, so this is only done
+     * once, at shutdown, when the profiles are gathered. */
+    void update_quantiles(void) {
+        apex_profile copy;
+        snapshot(copy);
+        _profile.p50 = copy.p50;
+        _profile.p90 = copy.p90;
+        _profile.p99 = copy.p99;
+        _profile.p999 = copy.p999;
+    }
+    double get_quantile(double q) {
+        return _histogram->quantile(q, _profile.minimum, _profile.maximum);
+    }
+    const histogram & get_histogram() const { return *_histogram; }
+    bool is_estimate() { return _estimated; }
     double get_calls() { return _profile.calls; }
     double get_mean() { return (_profile.accumulated / _profile.calls); }
     double get_accumulated() { return (_profile.accumulated); }
+    double get_exclusive() { return (_profile.exclusive); }
     double * get_papi_metrics() { return (_profile.papi_metrics); }
     double get_minimum() { return (_profile.minimum); }
     double get_maximum() { return (_profile.maximum); }
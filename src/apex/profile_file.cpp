@@ -0,0 +1,359 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "profile_file.hpp"
+#include "apex_types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace apex {
+
+static inline uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~((uint64_t)7);
+}
+
+/* Write the file with a single write() */
+static bool write_file(const std::string &filename, const char * what,
+                       const char * data, size_t size) {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "APEX Warning : can't write the " << what << " " << filename
+              << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  ssize_t written = ::write(fd, data, size);
+  int error = errno;
+  ::close(fd);
+  if (written != (ssize_t)size) {
+    std::cerr << "APEX Warning : can't write the " << what << " " << filename
+              << ": " << (written < 0 ? strerror(error) : "short write") << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/* Map the whole file, read only. Returns nullptr, with error set, if it
+ * can't, or if the file is smaller than min_size. */
+static void * map_file(const std::string &filename, size_t min_size,
+                       size_t &size, std::string &error, const char * what) {
+  size = 0;
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    error = strerror(errno);
+    ::close(fd);
+    return nullptr;
+  }
+  if ((size_t)st.st_size < min_size) {
+    error = std::string("not an APEX ") + what;
+    ::close(fd);
+    return nullptr;
+  }
+  void * data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int mmap_error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    error = strerror(mmap_error);
+    return nullptr;
+  }
+  size = (size_t)st.st_size;
+  return data;
+}
+
+profile_file_writer::profile_file_writer(uint32_t node, double elapsed, double tick_seconds) :
+    _node(node), _elapsed(elapsed), _tick_seconds(tick_seconds), _have_callpaths(false) {
+  _histogram_offsets.push_back(0);
+}
+
+uint32_t profile_file_writer::add(const std::string &name,
+    const profile_file_record &record, const histogram * values) {
+  uint32_t index = (uint32_t)_records.size();
+  _records.push_back(record);
+  _records.back().name = (uint32_t)_strings.size();
+  _strings.append(name.c_str(), name.size() + 1);
+  if (values != nullptr) {
+    values->for_each_bucket([this](uint32_t bucket, uint64_t count) {
+      _buckets.push_back(profile_file_bucket{bucket, 0, count});
+    });
+  }
+  _histogram_offsets.push_back(_buckets.size());
+  _callpaths.push_back(profile_file_callpath{APEX_PROFILE_FILE_NONE, APEX_PROFILE_FILE_NONE});
+  return index;
+}
+
+void profile_file_writer::set_callpath(uint32_t record, uint32_t parent, uint32_t leaf) {
+  _records[record].flags |= APEX_PROFILE_RECORD_CALLPATH;
+  _callpaths[record] = profile_file_callpath{parent, leaf};
+  _have_callpaths = true;
+}
+
+bool profile_file_writer::write(const std::string &filename) const {
+  profile_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, APEX_PROFILE_FILE_MAGIC, sizeof(header.magic));
+  header.version = APEX_PROFILE_FILE_VERSION;
+  header.header_size = sizeof(header);
+  header.node = _node;
+  header.num_records = (uint32_t)_records.size();
+  header.elapsed = _elapsed;
+  header.tick_seconds = _tick_seconds;
+  header.records_offset = align8(sizeof(header));
+  header.strings_offset = header.records_offset + _records.size() * sizeof(profile_file_record);
+  header.strings_size = _strings.size();
+  uint64_t offset = align8(header.strings_offset + header.strings_size);
+  if (!_buckets.empty()) {
+    header.flags |= APEX_PROFILE_FILE_HISTOGRAMS;
+    header.histograms_offset = offset;
+    offset += _histogram_offsets.size() * sizeof(uint64_t) +
+              _buckets.size() * sizeof(profile_file_bucket);
+  }
+  if (_have_callpaths) {
+    header.flags |= APEX_PROFILE_FILE_CALLPATHS;
+    header.callpaths_offset = offset;
+    offset += _callpaths.size() * sizeof(profile_file_callpath);
+  }
+  header.file_size = offset;
+
+  std::vector<char> buffer(header.file_size, 0);
+  char * data = buffer.data();
+  memcpy(data, &header, sizeof(header));
+  if (!_records.empty()) {
+    memcpy(data + header.records_offset, _records.data(),
+           _records.size() * sizeof(profile_file_record));
+  }
+  memcpy(data + header.strings_offset, _strings.data(), _strings.size());
+  if (header.histograms_offset != 0) {
+    char * histograms = data + header.histograms_offset;
+    memcpy(histograms, _histogram_offsets.data(), _histogram_offsets.size() * sizeof(uint64_t));
+    memcpy(histograms + _histogram_offsets.size() * sizeof(uint64_t), _buckets.data(),
+           _buckets.size() * sizeof(profile_file_bucket));
+  }
+  if (header.callpaths_offset != 0) {
+    memcpy(data + header.callpaths_offset, _callpaths.data(),
+           _callpaths.size() * sizeof(profile_file_callpath));
+  }
+
+  return write_file(filename, "profile", data, buffer.size());
+}
+
+profile_file::profile_file(void) : _data(nullptr), _size(0), _header(nullptr),
+    _records(nullptr), _histogram_offsets(nullptr), _buckets(nullptr),
+    _callpaths(nullptr) { }
+
+profile_file::~profile_file(void) {
+  close();
+}
+
+bool profile_file::fail(const std::string &why) {
+  _error = _filename + ": " + why;
+  close();
+  return false;
+}
+
+bool profile_file::open(const std::string &filename) {
+  close();
+  _filename = filename;
+  _error.clear();
+  std::string error;
+  _data = map_file(filename, sizeof(profile_file_header), _size, error, "profile");
+  if (_data == nullptr) {
+    return fail(error);
+  }
+  _header = (const profile_file_header *)_data;
+  const profile_file_header &h = *_header;
+  if (memcmp(h.magic, APEX_PROFILE_FILE_MAGIC, sizeof(h.magic)) != 0) {
+    return fail("not an APEX profile");
+  }
+  if (h.version != APEX_PROFILE_FILE_VERSION) {
+    return fail("unsupported version " + std::to_string(h.version));
+  }
+  // check the blocks are all in the file, before anything is read from them
+  uint64_t records_end = h.records_offset + (uint64_t)h.num_records * sizeof(profile_file_record);
+  if (h.file_size != _size || h.header_size < sizeof(profile_file_header) ||
+      h.records_offset < h.header_size || records_end > h.strings_offset ||
+      h.strings_offset + h.strings_size > _size ||
+      (h.strings_size > 0 && ((const char *)_data)[h.strings_offset + h.strings_size - 1] != '\0')) {
+    return fail("truncated or corrupt profile");
+  }
+  _records = (const profile_file_record *)((const char *)_data + h.records_offset);
+  for (uint32_t i = 0 ; i < h.num_records ; i++) {
+    if (_records[i].name >= h.strings_size) {
+      return fail("truncated or corrupt profile");
+    }
+  }
+  if (h.flags & APEX_PROFILE_FILE_HISTOGRAMS) {
+    uint64_t buckets_offset = h.histograms_offset + ((uint64_t)h.num_records + 1) * sizeof(uint64_t);
+    if (h.histograms_offset == 0 || buckets_offset > _size) {
+      return fail("truncated or corrupt profile");
+    }
+    _histogram_offsets = (const uint64_t *)((const char *)_data + h.histograms_offset);
+    uint64_t num_buckets = _histogram_offsets[h.num_records];
+    if (buckets_offset + num_buckets * sizeof(profile_file_bucket) > _size) {
+      return fail("truncated or corrupt profile");
+    }
+    for (uint32_t i = 0 ; i < h.num_records ; i++) {
+      if (_histogram_offsets[i] > _histogram_offsets[i+1]) {
+        return fail("truncated or corrupt profile");
+      }
+    }
+    _buckets = (const profile_file_bucket *)((const char *)_data + buckets_offset);
+  }
+  if (h.flags & APEX_PROFILE_FILE_CALLPATHS) {
+    if (h.callpaths_offset == 0 ||
+        h.callpaths_offset + (uint64_t)h.num_records * sizeof(profile_file_callpath) > _size) {
+      return fail("truncated or corrupt profile");
+    }
+    _callpaths = (const profile_file_callpath *)((const char *)_data + h.callpaths_offset);
+  }
+  return true;
+}
+
+void profile_file::close(void) {
+  if (_data != nullptr) {
+    munmap(_data, _size);
+  }
+  _data = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _records = nullptr;
+  _histogram_offsets = nullptr;
+  _buckets = nullptr;
+  _callpaths = nullptr;
+}
+
+const profile_file_bucket * profile_file::buckets(uint32_t i, size_t &count) const {
+  if (_buckets == nullptr) {
+    count = 0;
+    return nullptr;
+  }
+  count = _histogram_offsets[i+1] - _histogram_offsets[i];
+  return _buckets + _histogram_offsets[i];
+}
+
+void profile_file::add_histogram(uint32_t i, histogram &values) const {
+  size_t count;
+  const profile_file_bucket * b = buckets(i, count);
+  double scale = _records[i].type == APEX_TIMER ? _header->tick_seconds : 1.0;
+  if (scale == 1.0) {
+    for (size_t j = 0 ; j < count ; j++) {
+      values.add_bucket(b[j].index, b[j].count);
+    }
+  } else {
+    // the buckets don't line up, so move each count to the middle of its bucket
+    for (size_t j = 0 ; j < count ; j++) {
+      values.add(histogram::bucket_value(b[j].index) * scale, (double)b[j].count);
+    }
+  }
+}
+
+void sample_file_writer::add(const std::string &name, uint64_t seen,
+    const sample_file_sample * samples, size_t count) {
+  _timers.push_back(sample_file_timer{(uint32_t)_strings.size(), (uint32_t)count,
+                                      _samples.size(), seen});
+  _strings.append(name.c_str(), name.size() + 1);
+  _samples.insert(_samples.end(), samples, samples + count);
+}
+
+bool sample_file_writer::write(const std::string &filename) const {
+  sample_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, APEX_SAMPLE_FILE_MAGIC, sizeof(header.magic));
+  header.version = APEX_SAMPLE_FILE_VERSION;
+  header.header_size = sizeof(header);
+  header.node = _node;
+  header.pid = _pid;
+  header.num_timers = (uint32_t)_timers.size();
+  header.num_samples = _samples.size();
+  header.timers_offset = align8(sizeof(header));
+  header.samples_offset = header.timers_offset + _timers.size() * sizeof(sample_file_timer);
+  header.strings_offset = header.samples_offset + _samples.size() * sizeof(sample_file_sample);
+  header.strings_size = _strings.size();
+  header.file_size = header.strings_offset + header.strings_size;
+
+  std::vector<char> buffer(header.file_size, 0);
+  char * data = buffer.data();
+  memcpy(data, &header, sizeof(header));
+  if (!_timers.empty()) {
+    memcpy(data + header.timers_offset, _timers.data(),
+           _timers.size() * sizeof(sample_file_timer));
+  }
+  if (!_samples.empty()) {
+    memcpy(data + header.samples_offset, _samples.data(),
+           _samples.size() * sizeof(sample_file_sample));
+  }
+  memcpy(data + header.strings_offset, _strings.data(), _strings.size());
+  return write_file(filename, "task samples", data, buffer.size());
+}
+
+sample_file::sample_file(void) : _data(nullptr), _size(0), _header(nullptr),
+    _timers(nullptr), _samples(nullptr) { }
+
+sample_file::~sample_file(void) {
+  close();
+}
+
+bool sample_file::fail(const std::string &why) {
+  _error = _filename + ": " + why;
+  close();
+  return false;
+}
+
+bool sample_file::open(const std::string &filename) {
+  close();
+  _filename = filename;
+  _error.clear();
+  std::string error;
+  _data = map_file(filename, sizeof(sample_file_header), _size, error, "task sample file");
+  if (_data == nullptr) {
+    return fail(error);
+  }
+  _header = (const sample_file_header *)_data;
+  const sample_file_header &h = *_header;
+  if (memcmp(h.magic, APEX_SAMPLE_FILE_MAGIC, sizeof(h.magic)) != 0) {
+    return fail("not an APEX task sample file");
+  }
+  if (h.version != APEX_SAMPLE_FILE_VERSION) {
+    return fail("unsupported version " + std::to_string(h.version));
+  }
+  uint64_t timers_end = h.timers_offset + (uint64_t)h.num_timers * sizeof(sample_file_timer);
+  uint64_t samples_end = h.samples_offset + h.num_samples * sizeof(sample_file_sample);
+  if (h.file_size != _size || h.header_size < sizeof(sample_file_header) ||
+      h.timers_offset < h.header_size || timers_end > h.samples_offset ||
+      samples_end > h.strings_offset || h.strings_offset + h.strings_size > _size ||
+      (h.strings_size > 0 && ((const char *)_data)[h.strings_offset + h.strings_size - 1] != '\0')) {
+    return fail("truncated or corrupt task sample file");
+  }
+  _timers = (const sample_file_timer *)((const char *)_data + h.timers_offset);
+  _samples = (const sample_file_sample *)((const char *)_data + h.samples_offset);
+  for (uint32_t i = 0 ; i < h.num_timers ; i++) {
+    if (_timers[i].name >= h.strings_size ||
+        _timers[i].first + _timers[i].num_samples > h.num_samples) {
+      return fail("truncated or corrupt task sample file");
+    }
+  }
+  return true;
+}
+
+void sample_file::close(void) {
+  if (_data != nullptr) {
+    munmap(_data, _size);
+  }
+  _data = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _timers = nullptr;
+  _samples = nullptr;
+}
+
+}
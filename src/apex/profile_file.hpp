@@ -0,0 +1,243 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "histogram.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define APEX_PROFILE_FILE_MAGIC "APEXPROF"
+#define APEX_PROFILE_FILE_VERSION 1
+#define APEX_SAMPLE_FILE_MAGIC "APEXSMPL"
+#define APEX_SAMPLE_FILE_VERSION 1
+
+/* The blocks a file has, in profile_file_header::flags */
+#define APEX_PROFILE_FILE_HISTOGRAMS 0x1
+#define APEX_PROFILE_FILE_CALLPATHS 0x2
+/* profile_file_record::flags */
+#define APEX_PROFILE_RECORD_ESTIMATE 0x1
+#define APEX_PROFILE_RECORD_CALLPATH 0x2
+/* A record index that refers to no record */
+#define APEX_PROFILE_FILE_NONE 0xFFFFFFFF
+
+namespace apex {
+
+/* The binary profile format, written with APEX_BINARY_OUTPUT to
+ * apex.<node>.prof. Every block starts on an 8 byte boundary, and the
+ * values are in the byte order of the machine that wrote the file (the
+ * reader rejects a file whose version field doesn't match):
+ *
+ *   profile_file_header
+ *   num_records profile_file_records
+ *   the string table: the names, each ended by a NUL
+ *   if APEX_PROFILE_FILE_HISTOGRAMS, num_records + 1 uint64_t offsets into
+ *     the profile_file_buckets that follow them, which are the nonzero
+ *     buckets of each record's histogram in turn
+ *   if APEX_PROFILE_FILE_CALLPATHS, a profile_file_callpath per record
+ *
+ * Timer values are in seconds. Timer histograms are kept in the units the
+ * timers were measured in, tick_seconds seconds each, so the buckets can
+ * be copied as they are. */
+struct profile_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t flags;
+  uint32_t node;
+  uint32_t num_records;
+  uint32_t reserved;
+  double elapsed;           // how long the process ran, in seconds
+  double tick_seconds;      // the units of the timer histograms
+  uint64_t records_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t histograms_offset; // 0 if there are no histograms
+  uint64_t callpaths_offset;  // 0 if there are no call paths
+  uint64_t file_size;
+};
+
+struct profile_file_record {
+  uint32_t name;            // the offset of the name in the string table
+  uint32_t type;            // an apex_profile_type
+  uint32_t flags;
+  uint32_t reserved;
+  double calls;
+  double accumulated;
+  double exclusive;
+  double sum_squares;
+  double minimum;
+  double maximum;
+};
+
+struct profile_file_bucket {
+  uint32_t index;           // as numbered by histogram::for_each_bucket()
+  uint32_t reserved;
+  uint64_t count;
+};
+
+/* For a call path record: the path without its innermost timer (a plain
+ * timer, for a path of two) and the innermost timer. Either can be
+ * APEX_PROFILE_FILE_NONE, when the file has no profile for it. */
+struct profile_file_callpath {
+  uint32_t parent;
+  uint32_t leaf;
+};
+
+/* Builds a profile file in memory, then writes it with a single write() */
+class profile_file_writer {
+private:
+  uint32_t _node;
+  double _elapsed;
+  double _tick_seconds;
+  std::vector<profile_file_record> _records;
+  std::string _strings;
+  std::vector<uint64_t> _histogram_offsets;
+  std::vector<profile_file_bucket> _buckets;
+  std::vector<profile_file_callpath> _callpaths;
+  bool _have_callpaths;
+public:
+  profile_file_writer(uint32_t node, double elapsed, double tick_seconds);
+  /* Add a record (its name field is filled in) and its histogram, if
+   * there is one. Returns the index of the record. */
+  uint32_t add(const std::string &name, const profile_file_record &record,
+               const histogram * values);
+  void set_callpath(uint32_t record, uint32_t parent, uint32_t leaf);
+  size_t size(void) const { return _records.size(); }
+  /* Write the file. Returns false, with a warning, if it can't. */
+  bool write(const std::string &filename) const;
+};
+
+/* A profile file, read with mmap(), so the records and strings are used
+ * where they are */
+class profile_file {
+private:
+  std::string _filename;
+  void * _data;
+  size_t _size;
+  const profile_file_header * _header;
+  const profile_file_record * _records;
+  const uint64_t * _histogram_offsets;
+  const profile_file_bucket * _buckets;
+  const profile_file_callpath * _callpaths;
+  std::string _error;
+  bool fail(const std::string &why);
+public:
+  profile_file(void);
+  ~profile_file(void);
+  profile_file(const profile_file &) = delete;
+  profile_file &operator=(const profile_file &) = delete;
+  /* Map the file and check it. Returns false, with error() set, if the
+   * file can't be read or isn't a profile in this format. */
+  bool open(const std::string &filename);
+  void close(void);
+  const std::string &filename(void) const { return _filename; }
+  const std::string &error(void) const { return _error; }
+  const profile_file_header &header(void) const { return *_header; }
+  uint32_t num_records(void) const { return _header->num_records; }
+  const profile_file_record &record(uint32_t i) const { return _records[i]; }
+  const char * name(uint32_t i) const {
+    return (const char *)_data + _header->strings_offset + _records[i].name;
+  }
+  bool has_histograms(void) const { return _buckets != nullptr; }
+  /* The nonzero buckets of record i's histogram */
+  const profile_file_bucket * buckets(uint32_t i, size_t &count) const;
+  /* Add record i's histogram to values, in seconds for a timer */
+  void add_histogram(uint32_t i, histogram &values) const;
+  /* The parent and leaf of a call path record, or nullptr */
+  const profile_file_callpath * callpath(uint32_t i) const {
+    if (_callpaths == nullptr || !(_records[i].flags & APEX_PROFILE_RECORD_CALLPATH)) {
+      return nullptr;
+    }
+    return &(_callpaths[i]);
+  }
+};
+
+/* The task samples written with APEX_TASK_SCATTERPLOT, to
+ * apex_task_samples.<node>.<pid>.bin (see task_sampler.hpp). Laid out like
+ * a profile file:
+ *
+ *   sample_file_header
+ *   num_timers sample_file_timers
+ *   num_samples sample_file_samples, each timer's together
+ *   the string table: the timers' names, each ended by a NUL */
+struct sample_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t node;
+  uint32_t pid;
+  uint32_t num_timers;
+  uint32_t reserved;
+  uint64_t num_samples;
+  uint64_t timers_offset;
+  uint64_t samples_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint64_t file_size;
+};
+
+struct sample_file_timer {
+  uint32_t name;            // the offset of the name in the string table
+  uint32_t num_samples;
+  uint64_t first;           // the index of the timer's first sample
+  uint64_t seen;            // how many times the timer stopped
+};
+
+struct sample_file_sample {
+  double timestamp;         // seconds since APEX started
+  double value;             // microseconds
+};
+
+/* Builds a task sample file in memory, then writes it with a single write() */
+class sample_file_writer {
+private:
+  uint32_t _node;
+  uint32_t _pid;
+  std::vector<sample_file_timer> _timers;
+  std::vector<sample_file_sample> _samples;
+  std::string _strings;
+public:
+  sample_file_writer(uint32_t node, uint32_t pid) : _node(node), _pid(pid) { }
+  /* Add a timer, the number of times it stopped and its samples */
+  void add(const std::string &name, uint64_t seen,
+           const sample_file_sample * samples, size_t count);
+  /* Write the file. Returns false, with a warning, if it can't. */
+  bool write(const std::string &filename) const;
+};
+
+/* A task sample file, read with mmap() */
+class sample_file {
+private:
+  std::string _filename;
+  void * _data;
+  size_t _size;
+  const sample_file_header * _header;
+  const sample_file_timer * _timers;
+  const sample_file_sample * _samples;
+  std::string _error;
+  bool fail(const std::string &why);
+public:
+  sample_file(void);
+  ~sample_file(void);
+  sample_file(const sample_file &) = delete;
+  sample_file &operator=(const sample_file &) = delete;
+  /* Map the file and check it. Returns false, with error() set, if it
+   * can't be read or isn't a sample file in this format. */
+  bool open(const std::string &filename);
+  void close(void);
+  const std::string &error(void) const { return _error; }
+  const sample_file_header &header(void) const { return *_header; }
+  uint32_t num_timers(void) const { return _header->num_timers; }
+  const sample_file_timer &timer(uint32_t i) const { return _timers[i]; }
+  const char * name(uint32_t i) const {
+    return (const char *)_data + _header->strings_offset + _timers[i].name;
+  }
+  /* Timer i's timer(i).num_samples samples */
+  const sample_file_sample * samples(uint32_t i) const { return _samples + _timers[i].first; }
+};
+
+}
@@ -0,0 +1,147 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "profile.hpp"
+#include <new>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/* How many profiles each block of profile storage holds */
+#define APEX_PROFILE_CHUNK 256
+
+namespace apex {
+
+/* The profiles of a set of timers, keyed by the dense ID of the interned
+ * task_identifier. The index is a flat open-addressing table (linear
+ * probing, at most half full) of positions in a contiguous list of
+ * (ID, profile) entries, so a lookup touches one or two cache lines and
+ * iterating over all of the profiles walks an array. The profiles
+ * themselves are built in blocks of APEX_PROFILE_CHUNK, so they are close
+ * together in memory, and never move once created: the pointers returned
+ * by find() and emplace() stay valid until clear(), even when adopt()
+ * hands the profiles to another table.
+ *
+ * Not thread safe. The owner of the table has to lock around an emplace()
+ * that other threads could see. */
+class profile_table {
+public:
+  typedef std::pair<uint32_t, profile*> entry;
+  typedef std::vector<entry>::const_iterator const_iterator;
+private:
+  static constexpr uint32_t no_entry = UINT32_MAX;
+  std::vector<uint32_t> _slots;   // an index into _entries, or no_entry
+  std::vector<entry> _entries;    // in order of creation
+  std::vector<profile*> _chunks;  // the profile storage
+  size_t _chunk_used;             // the profiles built in the last block
+  std::vector<profile*> _merged;  // adopted profiles merged into others
+  uint32_t _shift;                // 32 - log2 of the number of slots
+  /* Fibonacci hashing, so that IDs that are a stride apart (as they are
+   * in a consumer's shard) still spread over the whole table */
+  inline size_t slot_of(uint32_t id) const {
+    return (size_t)((id * 2654435769u) >> _shift);
+  }
+  inline size_t probe(uint32_t id) const {
+    size_t mask = _slots.size() - 1;
+    size_t i = slot_of(id);
+    while (_slots[i] != no_entry && _entries[_slots[i]].first != id) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+  void rehash(size_t num_slots) {
+    _slots.assign(num_slots, uint32_t(no_entry));
+    _shift = 32;
+    for (size_t n = num_slots ; n > 1 ; n >>= 1) { _shift--; }
+    for (uint32_t e = 0 ; e < _entries.size() ; e++) {
+      _slots[probe(_entries[e].first)] = e;
+    }
+  }
+  /* Room for the next profile, from the last block */
+  void * allocate(void) {
+    if (_chunk_used == APEX_PROFILE_CHUNK) {
+      _chunks.push_back(static_cast<profile*>(
+        ::operator new(sizeof(profile) * APEX_PROFILE_CHUNK)));
+      _chunk_used = 0;
+    }
+    return _chunks.back() + _chunk_used++;
+  }
+  void insert(uint32_t id, profile * p) {
+    if ((_entries.size() + 1) * 2 > _slots.size()) {
+      rehash(_slots.size() * 2);
+    }
+    _slots[probe(id)] = (uint32_t)_entries.size();
+    _entries.push_back(entry(id, p));
+  }
+public:
+  profile_table(void) : _slots(), _entries(), _chunks(),
+    _chunk_used(APEX_PROFILE_CHUNK), _merged(), _shift(32) {
+    rehash(64);
+  }
+  ~profile_table(void) { clear(); }
+  profile_table(const profile_table &) = delete;
+  profile_table &operator=(const profile_table &) = delete;
+  /* The profile for this ID, or nullptr */
+  inline profile * find(uint32_t id) const {
+    uint32_t e = _slots[probe(id)];
+    return e == no_entry ? nullptr : _entries[e].second;
+  }
+  /* Create the profile for an ID that isn't in the table yet, passing
+   * the arguments to the profile constructor. */
+  template<typename ... Args>
+  profile * emplace(uint32_t id, Args && ... args) {
+    profile * p = new (allocate()) profile(std::forward<Args>(args)...);
+    insert(id, p);
+    return p;
+  }
+  /* Take over the profiles of another table, leaving it empty. Nothing
+   * is copied, so pointers to the other table's profiles stay valid. A
+   * profile for an ID this table already has is merged into this table's
+   * with merge(mine, theirs), and the other is kept until clear(). */
+  template<typename Merge>
+  void adopt(profile_table &other, Merge merge) {
+    for (auto &e : other._entries) {
+      profile * p = find(e.first);
+      if (p == nullptr) {
+        insert(e.first, e.second);
+      } else {
+        merge(*p, *(e.second));
+        _merged.push_back(e.second);
+      }
+    }
+    // the storage goes in front, so new profiles still fill our last block
+    _chunks.insert(_chunks.begin(), other._chunks.begin(), other._chunks.end());
+    _merged.insert(_merged.end(), other._merged.begin(), other._merged.end());
+    other._entries.clear();
+    other._chunks.clear();
+    other._chunk_used = APEX_PROFILE_CHUNK;
+    other._merged.clear();
+    other.rehash(64);
+  }
+  size_t size(void) const { return _entries.size(); }
+  const_iterator begin(void) const { return _entries.begin(); }
+  const_iterator end(void) const { return _entries.end(); }
+  /* Destroy all of the profiles */
+  void clear(void) {
+    for (auto &e : _entries) {
+      e.second->~profile();
+    }
+    for (profile * p : _merged) {
+      p->~profile();
+    }
+    for (profile * chunk : _chunks) {
+      ::operator delete(chunk);
+    }
+    _entries.clear();
+    _chunks.clear();
+    _chunk_used = APEX_PROFILE_CHUNK;
+    _merged.clear();
+    rehash(64);
+  }
+};
+
+}
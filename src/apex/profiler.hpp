@@ -11,13 +11,12 @@
 #include "apex_options.hpp"
 #include "apex_types.h"
 #include <chrono>
+#include <atomic>
+#include <cstddef>
+#include <utility>
 #include "task_identifier.hpp"
-
-#ifdef __INTEL_COMPILER
-#define CLOCK_TYPE high_resolution_clock
-#else
-#define CLOCK_TYPE steady_clock
-#endif
+#include "clock_source.hpp"
+#include "perf_events.hpp"
 
 namespace apex {
 
@@ -33,28 +32,21 @@ class disabled_profiler_exception : public std::exception {
     }
 };
 
-#ifndef APEX_USE_CLOCK_TIMESTAMP
-template<std::intmax_t clock_freq>
-struct rdtsc_clock {
+/* A clock that reads whichever source APEX_CLOCK_SOURCE chose. Its ticks
+ * are nominally one second long - multiply by profiler::get_cpu_mhz()
+ * to get real seconds. */
+struct apex_clock {
     typedef unsigned long long rep;
-    typedef std::ratio<1, clock_freq> period;
+    typedef std::ratio<1> period;
     typedef std::chrono::duration<rep, period> duration;
-    typedef std::chrono::time_point<rdtsc_clock> time_point;
+    typedef std::chrono::time_point<apex_clock> time_point;
     static const bool is_steady = true;
     static time_point now() noexcept {
-        unsigned lo, hi;
-        asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
-        return time_point(duration(static_cast<rep>(hi) << 32 | lo));
+        return time_point(duration(static_cast<rep>(clock_source::read())));
     }
 };
-#endif
 
-#ifdef APEX_USE_CLOCK_TIMESTAMP
-#define MYCLOCK std::chrono::CLOCK_TYPE
-#else
-typedef rdtsc_clock<1> OneHzClock;
-#define MYCLOCK OneHzClock
-#endif
+#define MYCLOCK apex_clock
 
 class profiler {
 public:
@@ -64,16 +56,24 @@ public:
     long long papi_start_values[8];
     long long papi_stop_values[8];
 #endif
+    // counter values from perf_events::start(), or nullptr
+    uint64_t * perf_start_values;
     double value;
+    // MYCLOCK ticks spent in timers started inside this one, on this thread
     double children_value;
     //apex_function_address action_address;
     //std::string * timer_name;
     //bool have_name;
+    // interned by task_identifier::get_task_id(), not owned by the profiler
 	task_identifier * task_id;
     bool is_counter;
     bool is_resume; // for yield or resume
     reset_type is_reset;
-    bool stopped;
+    // set by stop(), which can run on another thread than the one whose
+    // timer stack has this profiler, see thread_instance.cpp
+    std::atomic<bool> stopped;
+    // the number of calls this measurement stands for, if its timer is throttled
+    uint32_t weight;
     profiler(task_identifier * id, 
              bool resume = false, 
              reset_type reset = reset_type::NONE) : 
@@ -82,26 +82,29 @@ public:
         papi_start_values{0,0,0,0,0,0,0,0},
         papi_stop_values{0,0,0,0,0,0,0,0},
 #endif
+        perf_start_values(nullptr),
         value(0.0), 
         children_value(0.0),
 		task_id(id),
         is_counter(false),
         is_resume(resume),
-        is_reset(reset), stopped(false) {};
+        is_reset(reset), stopped(false), weight(1), _refcount(0) {};
     profiler(task_identifier * id, double value_) : 
         start(MYCLOCK::now()), 
 #if APEX_HAVE_PAPI
         papi_start_values{0,0,0,0,0,0,0,0},
         papi_stop_values{0,0,0,0,0,0,0,0},
 #endif
+        perf_start_values(nullptr),
         value(value_), 
         children_value(0.0),
 		task_id(id),
         is_counter(true),
         is_resume(false),
-        is_reset(reset_type::NONE), stopped(true) { }; 
+        is_reset(reset_type::NONE), stopped(true), weight(1), _refcount(0) { }; 
     //copy constructor
-    profiler(profiler* in) : start(in->start), end(in->end) {
+    profiler(profiler* in) : start(in->start), end(in->end),
+        perf_start_values(nullptr), _refcount(0) {
 #if APEX_HAVE_PAPI
         for (int i = 0 ; i < 8 ; i++) {
             papi_start_values[i] = in->papi_start_values[i];
@@ -110,22 +113,40 @@ public:
 #endif
     value = in->elapsed();
     children_value = in->children_value;
-	task_id = new task_identifier(*in->task_id);
+	task_id = in->task_id;
     is_counter = in->is_counter;
     is_resume = in->is_resume; // for yield or resume
     is_reset = in->is_reset;
-    stopped = in->stopped;
+    stopped.store(in->stopped.load(std::memory_order_acquire), std::memory_order_relaxed);
+    weight = in->weight;
+    }
+    ~profiler(void) {
+        if (perf_start_values != nullptr) {
+            perf_events::release(perf_start_values);
+        }
+    };
+    /* Profilers are allocated from a per-thread pool,
+     * see profiler_pool.hpp. Defined in profiler_pool.cpp. */
+    static void * operator new(std::size_t size);
+    static void operator delete(void * ptr);
+    /* intrusive reference counting, for profiler_ptr */
+    void add_ref(void) {
+        _refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release(void) {
+        if (_refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
     }
-    ~profiler(void) { if (task_id != nullptr) delete task_id; };
     // for "yield" support
     void stop(bool is_resume) {
         this->is_resume = is_resume;
         end = MYCLOCK::now();
-        stopped = true;
+        stopped.store(true, std::memory_order_release);
     };
     void stop() {
         end = MYCLOCK::now();
-        stopped = true;
+        stopped.store(true, std::memory_order_release);
     };
     double elapsed(void) {
         if(is_counter) {
@@ -143,37 +164,14 @@ public:
         return disabled_profiler;
     }
     // default constructor for the dummy profiler
-    profiler(void) {};
+    profiler(void) : _refcount(0) {};
     // dummy profiler to indicate that stop/yield should resume immediately
     static profiler* disabled_profiler; // initialized in profiler_listener.cpp
 
-    /* This function returns 1/X, where "X" is the MHz rating of the CPU. */
+    /* This function returns the length of a MYCLOCK tick, in seconds.
+     * For the TSC that is 1/X, where "X" is the Hz rating of the CPU. */
     static double get_cpu_mhz () {
-#ifdef APEX_USE_CLOCK_TIMESTAMP
-        return 1.0;
-#else
-        static double ticks_per_period = 0.0;
-        if (ticks_per_period == 0.0) {
-            typedef std::chrono::duration<double, typename MYCLOCK::period> CycleA;
-            typedef std::chrono::duration<double, typename std::chrono::CLOCK_TYPE::period> CycleB;
-            const int N = 100000000;
-            auto t0a = MYCLOCK::now();
-            auto t0b = std::chrono::CLOCK_TYPE::now();
-            for (int j = 0; j < N; ++j) {
-                asm volatile("");
-            }
-            auto t1a = MYCLOCK::now();
-            auto t1b = std::chrono::CLOCK_TYPE::now();
-            // Get the clock ticks per time period
-            //std::cout << CycleA(t1a-t0a).count() << " 1MHz ticks seen." << std::endl;
-            //std::cout << std::chrono::duration_cast<std::chrono::seconds>(CycleB(t1b-t0b)).count() << " Seconds? seen." << std::endl;
-            ticks_per_period = CycleB(t1b-t0b)/CycleA(t1a-t0a);
-            if (apex_options::use_screen_output()) {
-                std::cout << "CPU is " << (1.0/ticks_per_period) << " Hz." << std::endl;
-            }
-        }
-        return ticks_per_period;
-#endif
+        return clock_source::seconds_per_tick();
     }
 
     /* this is for OTF2 tracing. 
@@ -188,9 +186,7 @@ public:
         return MYCLOCK::now();
     }
     static uint64_t time_point_to_nanoseconds(MYCLOCK::time_point tp) {
-        auto value = tp.time_since_epoch();
-        uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(value).count();
-        return duration;
+        return clock_source::to_nanoseconds(tp.time_since_epoch().count());
     }
     double normalized_timestamp(void) {
         if(is_counter) {
@@ -200,6 +196,51 @@ public:
             return time_span.count()*get_cpu_mhz();
         }
     }
+private:
+    std::atomic<int> _refcount;
+};
+
+/* A reference-counted handle to a profiler object. The count lives in the
+ * profiler itself, so handing a stopped profiler to the listeners (and
+ * through the consumer queue) doesn't allocate a control block the way
+ * std::shared_ptr<profiler> did. The last handle to go away returns the
+ * profiler to its pool. */
+class profiler_ptr {
+private:
+    profiler * _p;
+public:
+    profiler_ptr(void) : _p(nullptr) {};
+    explicit profiler_ptr(profiler * p) : _p(p) {
+        if (_p != nullptr) { _p->add_ref(); }
+    };
+    profiler_ptr(const profiler_ptr &other) : _p(other._p) {
+        if (_p != nullptr) { _p->add_ref(); }
+    };
+    profiler_ptr(profiler_ptr &&other) : _p(other._p) {
+        other._p = nullptr;
+    };
+    ~profiler_ptr(void) {
+        if (_p != nullptr) { _p->release(); }
+    };
+    profiler_ptr& operator=(const profiler_ptr &other) {
+        profiler_ptr(other).swap(*this);
+        return *this;
+    }
+    profiler_ptr& operator=(profiler_ptr &&other) {
+        profiler_ptr(std::move(other)).swap(*this);
+        return *this;
+    }
+    void swap(profiler_ptr &other) {
+        profiler * tmp = _p;
+        _p = other._p;
+        other._p = tmp;
+    }
+    profiler * get(void) const { return _p; }
+    profiler * operator->(void) const { return _p; }
+    profiler & operator*(void) const { return *_p; }
+    explicit operator bool(void) const { return _p != nullptr; }
+    bool operator==(std::nullptr_t) const { return _p == nullptr; }
+    bool operator!=(std::nullptr_t) const { return _p != nullptr; }
 };
 
 }
@@ -15,6 +15,8 @@
 #include "apex_options.hpp"
 #include "profiler.hpp"
 #include "profile.hpp"
+#include "profile_file.hpp"
+#include "finalize_pipeline.hpp"
 #include "apex.hpp"
 
 #include <atomic>
@@ -25,13 +27,6 @@
 #include <cstdio>
 #include <vector>
 #include <string>
-#ifdef __MIC__
-#include <boost/regex.hpp>
-#define REGEX_NAMESPACE boost
-#else
-#include <regex>
-#define REGEX_NAMESPACE std
-#endif
 #include <unordered_set>
 #include <algorithm>
 
@@ -39,16 +34,10 @@
 #include <thread>
 #include <future>
 
-#if defined(APEX_THROTTLE)
+/* How often (in calls) the throttler reconsiders a timer */
 #define APEX_THROTTLE_CALLS 1000
-#ifdef APEX_USE_CLOCK_TIMESTAMP
-#define APEX_THROTTLE_PERCALL 0.00001 // 10 microseconds.
-#else
-#define APEX_THROTTLE_PERCALL 50000 // 50k cycles.
-#endif
-#include <mutex>
-std::mutex throttled_event_set_mutex;
-#endif
+/* The most calls a throttled timer can skip between measured calls */
+#define APEX_MAX_THROTTLE_PERIOD 1024
 
 #if APEX_HAVE_BFD
 #include "address_resolution.hpp"
@@ -102,23 +91,22 @@ namespace apex {
 
   double profiler_listener::get_non_idle_time() {
     double non_idle_time = 0.0;
-    /* Iterate over all timers and accumulate the time spent in them */
-    unordered_map<task_identifier, profile*>::const_iterator it2;
-    for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
-      profile * p = it2->second;
-#if defined(APEX_THROTTLE)
-      task_identifier id = it2->first;
-      throttled_event_set_mutex.lock();
-      unordered_set<task_identifier>::const_iterator it4 = throttled_tasks.find(id);
-      throttled_event_set_mutex.unlock();
-      if (it4!= throttled_tasks.end()) { 
-        continue; 
-      }
-#endif
-      if (p->get_type() == APEX_TIMER) {
-        non_idle_time += p->get_accumulated();
+    /* Iterate over all timers and accumulate the time spent in them.
+     * Exclusive time, so that nested timers aren't counted twice. */
+    auto accumulate = [&](const profile_table &profiles) {
+      profile_table::const_iterator it2;
+      for(it2 = profiles.begin(); it2 != profiles.end(); it2++) {
+        profile * p = it2->second;
+        if (p->get_type() == APEX_TIMER && !callpath::is_callpath(it2->first)) {
+          non_idle_time += p->get_exclusive();
+        }
       }
+    };
+    for (profile_shard * shard : _shards) {
+      std::unique_lock<std::mutex> task_map_lock(shard->task_map_mutex);
+      accumulate(shard->task_map);
     }
+    accumulate(task_map);
     return non_idle_time*profiler::get_cpu_mhz();
   }
 
@@ -160,25 +148,138 @@ namespace apex {
 
   /* Return the requested profile object to the user.
    * Return nullptr if doesn't exist. */
-  profile * profiler_listener::get_profile(task_identifier &id) {
-    if (id.name == string(APEX_IDLE_RATE)) {
+  profile * profiler_listener::get_profile(task_identifier * id) {
+    if (_thread_local_aggregation) {
+        merge_thread_profiles();
+    }
+    if (id->name == string(APEX_IDLE_RATE)) {
         return get_idle_rate();
-    } else if (id.name == string(APEX_IDLE_TIME)) {
+    } else if (id->name == string(APEX_IDLE_TIME)) {
         return get_idle_time();
-    } else if (id.name == string(APEX_NON_IDLE_TIME)) {
+    } else if (id->name == string(APEX_NON_IDLE_TIME)) {
         profile * theprofile = new profile(get_non_idle_time(), 0, NULL, false);
         return theprofile;
     }
-    unordered_map<task_identifier, profile*>::const_iterator it = task_map.find(id);
-    if (it != task_map.end()) {
-      return (*it).second;
+    return find_profile(id->id);
+  }
+
+  /* Copy the profile, consistently, into snapshot. Returns false if there
+   * is no profile for the ID yet. */
+  bool profiler_listener::get_profile_snapshot(task_identifier * id, apex_profile &snapshot) {
+    profile * p = get_profile(id);
+    if (p == nullptr) {
+        return false;
     }
-    return nullptr;
+    p->snapshot(snapshot);
+    // the derived profiles are made for each request
+    if (id->name == string(APEX_IDLE_RATE) || id->name == string(APEX_IDLE_TIME) ||
+        id->name == string(APEX_NON_IDLE_TIME)) {
+        delete p;
+    }
+    return true;
   }
 
-  void profiler_listener::reset_all(void) {
+  /* Copy all of the profiles. The shard locks only keep the tables from
+   * growing while we walk them; the consumers keep updating profiles. */
+  void profiler_listener::get_profile_snapshots(std::vector<std::pair<task_identifier*, apex_profile> > &snapshots) {
+    if (_thread_local_aggregation) {
+        merge_thread_profiles();
+    }
+    apex_profile snapshot;
+    for (profile_shard * shard : _shards) {
+        std::unique_lock<std::mutex> task_map_lock(shard->task_map_mutex);
+        snapshots.reserve(snapshots.size() + shard->task_map.size());
+        for(auto &it : shard->task_map) {
+            it.second->snapshot(snapshot);
+            snapshots.push_back(std::make_pair(task_identifier::from_id(it.first), snapshot));
+        }
+    }
     for(auto &it : task_map) {
+        it.second->snapshot(snapshot);
+        snapshots.push_back(std::make_pair(task_identifier::from_id(it.first), snapshot));
+    }
+  }
+
+  /* Look for the profile in its shard, then in the profiles gathered
+   * at shutdown. */
+  profile * profiler_listener::find_profile(uint32_t id) {
+    {
+      profile_shard &shard = shard_of(id);
+      std::unique_lock<std::mutex> task_map_lock(shard.task_map_mutex);
+      profile * p = shard.task_map.find(id);
+      if (p != nullptr) {
+        return p;
+      }
+    }
+    return task_map.find(id);
+  }
+
+  /* Reset every profile. While the consumers run, each resets the
+   * profiles of its own shard, when it reaches the "reset all" record
+   * sent to it, so that only the consumers update their profiles. */
+  void profiler_listener::reset_all(void) {
+    if (_thread_local_aggregation) {
+        merge_thread_profiles();
+    }
+    if (_done) {
+        for (profile_shard * shard : _shards) {
+            reset_shard(*shard);
+        }
+        for(auto &it : task_map) {
+            it.second->reset();
+        }
+        return;
+    }
+    for (unsigned int i = 0 ; i < _num_shards ; i++) {
+        profiler_record r;
+        // an ID that maps to shard i
+        r.id = i;
+        r.flags = APEX_RECORD_RESET_ALL;
+        r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+        r.value = 0.0;
+        r.children = 0.0;
+#if APEX_HAVE_PAPI
+        for (int j = 0 ; j < 8 ; j++) { r.papi_deltas[j] = 0; }
+#endif
+        push_profiler(my_tid, r);
+    }
+  }
+
+  void profiler_listener::reset_shard(profile_shard &shard) {
+    std::unique_lock<std::mutex> task_map_lock(shard.task_map_mutex);
+    for(auto &it : shard.task_map) {
         it.second->reset();
+        if (_throttle_timers) {
+            // measure the throttled timers again
+            task_identifier * task_id = task_identifier::from_id(it.first);
+            if (task_id != nullptr) {
+                task_id->throttle_period.store(1, std::memory_order_relaxed);
+            }
+        }
+    }
+  }
+
+  /* Move the profiles out of the shards into the task_map, for output.
+   * The profiles themselves don't move, so the pointers get_profile()
+   * returned before shutdown stay valid. Only called at shutdown, after
+   * the consumers have stopped. */
+  void profiler_listener::gather_profiles(void) {
+    int num_counters = 0;
+#if APEX_HAVE_PAPI
+    num_counters = num_papi_counters;
+#endif
+    if (_thread_local_aggregation) {
+        merge_thread_profiles();
+    }
+    for (profile_shard * shard : _shards) {
+        std::unique_lock<std::mutex> task_map_lock(shard->task_map_mutex);
+        task_map.adopt(shard->task_map, [num_counters](profile &mine, profile &theirs) {
+            mine.merge(theirs, num_counters);
+        });
+    }
+    // get_profile() has the quantiles from now on
+    for (auto &it : task_map) {
+        it.second->update_quantiles();
     }
   }
 
@@ -187,92 +288,72 @@ namespace apex {
   // TODO The name-based timer and address-based timer paths through
   // the code involve a lot of duplication -- this should be refactored
   // to remove the duplication so it's easier to maintain.
-  unsigned int profiler_listener::process_profile(std::shared_ptr<profiler> &p, unsigned int tid)
+  unsigned int profiler_listener::process_profile(const profiler_record *records, size_t count, unsigned int tid)
   {
-    if(p == nullptr) return 0;
+    APEX_UNUSED(tid);
+    // all of the records have the same ID
+    const profiler_record &r = records[0];
     profile * theprofile;
-    if(p->is_reset == reset_type::ALL) {
-        reset_all();
+    if(r.flags & APEX_RECORD_RESET_ALL) {
+        reset_shard(shard_of(r.id));
         return 0;
     }
     double values[8] = {0};
     double tmp_num_counters = 0;
 #if APEX_HAVE_PAPI
     tmp_num_counters = num_papi_counters;
-    for (int i = 0 ; i < num_papi_counters ; i++) {
-        if (p->papi_stop_values[i] > p->papi_start_values[i]) {
-            values[i] = p->papi_stop_values[i] - p->papi_start_values[i];
-        } else {
-            values[i] = 0.0;
-        }
-    }   
 #endif
-    std::unique_lock<std::mutex> task_map_lock(_task_map_mutex, std::defer_lock);
-    // There is only one consumer thread except during shutdown, so we only need
-    // to lock during shutdown.
+    auto get_papi_values = [&](const profiler_record &rec) {
+#if APEX_HAVE_PAPI
+        for (int i = 0 ; i < num_papi_counters ; i++) {
+            values[i] = rec.papi_deltas[i];
+        }   
+#else
+        APEX_UNUSED(rec);
+#endif
+    };
+    size_t next = 0;
+    profile_shard &shard = shard_of(r.id);
+    std::unique_lock<std::mutex> task_map_lock(shard.task_map_mutex, std::defer_lock);
+    // There is only one consumer thread per shard except during shutdown, so
+    // we only need to lock during shutdown, or when other threads merge their
+    // own profiles. Then the lock is held for the whole update, as only
+    // one thread may update a profile at a time (see profile.hpp). Adding
+    // a profile can grow the table under a reader, so that always takes
+    // the lock.
     bool did_lock = false;
-    if(_done) {
+    if(_done || _thread_local_aggregation) {
         task_map_lock.lock();
         did_lock = true;
     }
-    unordered_map<task_identifier, profile*>::const_iterator it = task_map.find(*(p->task_id));
-    if (it != task_map.end()) {
-      	// A profile for this ID already exists.
-        theprofile = (*it).second;
-        if(_done && did_lock) {
-            task_map_lock.unlock();
-        }
-        if(p->is_reset == reset_type::CURRENT) {
-            theprofile->reset();
-        } else {
-            theprofile->increment(p->elapsed(), tmp_num_counters, values, p->is_resume);
-        }
-#if defined(APEX_THROTTLE)
-        // Is this a lightweight task? If so, we shouldn't measure it any more,
-        // in order to reduce overhead.
-        if (theprofile->get_calls() > APEX_THROTTLE_CALLS &&
-            theprofile->get_mean() < APEX_THROTTLE_PERCALL) {
-            throttled_event_set_mutex.lock();
-            unordered_set<task_identifier>::const_iterator it2 = throttled_tasks.find(*(p->task_id));
-            throttled_event_set_mutex.unlock();
-            if (it2 == throttled_tasks.end()) {
-                // lock the set for insert
-                throttled_event_set_mutex.lock();
-                // was it inserted when we were waiting?
-                it2 = throttled_tasks.find(*(p->task_id));
-                // no? OK - insert it.
-                if (it2 == throttled_tasks.end()) {
-                    throttled_tasks.insert(*(p->task_id));
-                }
-                // unlock.
-                throttled_event_set_mutex.unlock();
-                if (apex_options::use_screen_output()) {
-                    cout << "APEX: disabling lightweight timer " 
-                         << p->task_id->get_name() 
-                          << endl; 
-                    fflush(stdout);
-                }
-            }
-        }
-#endif
-      } else {
+    theprofile = shard.task_map.find(r.id);
+    if (theprofile == nullptr) {
         // Create a new profile for this name.
-        theprofile = new profile(p->is_reset == reset_type::CURRENT ? 0.0 : p->elapsed(), tmp_num_counters, values, p->is_resume, p->is_counter ? APEX_COUNTER : APEX_TIMER);
-        task_map[*(p->task_id)] = theprofile;
-        if(_done && did_lock) {
+        get_papi_values(r);
+        if(!did_lock) {
+            task_map_lock.lock();
+        }
+        bool reset = (r.flags & APEX_RECORD_RESET) != 0;
+        theprofile = shard.task_map.emplace(r.id, reset ? 0.0 : r.elapsed(), tmp_num_counters, values, r.is_resume(), r.is_counter() ? APEX_COUNTER : APEX_TIMER, reset ? 0.0 : r.children);
+        if(!did_lock) {
             task_map_lock.unlock();
         }
+        if (r.is_sampled()) {
+            // the other calls this record stands for
+            theprofile->increment(r.elapsed(), r.children, tmp_num_counters, values, r.is_resume(), r.value - 1.0);
+        }
 #ifdef APEX_HAVE_HPX3
 #ifdef APEX_REGISTER_HPX3_COUNTERS
         if(!_done) {
-            if(get_hpx_runtime_ptr() != nullptr && p->task_id->has_name()) {
-                std::string timer_name(p->task_id->get_name());
+            task_identifier * task_id = task_identifier::from_id(r.id);
+            if(get_hpx_runtime_ptr() != nullptr && task_id->has_name) {
+                std::string timer_name(task_id->get_name());
                 //Don't register timers containing "/"
                 if(timer_name.find("/") == std::string::npos) {
                     hpx::performance_counters::install_counter_type(
                     std::string("/apex/") + timer_name,
-                    [p](bool r)->boost::int64_t{
-                        boost::int64_t value(p->elapsed());
+                    [theprofile](bool r)->boost::int64_t{
+                        boost::int64_t value(theprofile->get_accumulated());
                         return value;
                     },
                     std::string("APEX counter ") + timer_name,
@@ -285,61 +366,218 @@ namespace apex {
         }
 #endif
 #endif
+        next = 1;
       }
-      /* write the sample to the file */
+      // the rest of the records for this ID
+      for ( ; next < count ; next++) {
+        const profiler_record &rec = records[next];
+        if(rec.flags & APEX_RECORD_RESET) {
+            theprofile->reset();
+            // measure the timer again, and decide afresh whether to throttle it
+            task_identifier::from_id(r.id)->throttle_period.store(1, std::memory_order_relaxed);
+        } else if (rec.is_sampled()) {
+            get_papi_values(rec);
+            theprofile->increment(rec.elapsed(), rec.children, tmp_num_counters, values, rec.is_resume(), rec.value);
+        } else {
+            get_papi_values(rec);
+            theprofile->increment(rec.elapsed(), rec.children, tmp_num_counters, values, rec.is_resume());
+        }
+      }
+      if (_throttle_timers) {
+        check_throttle(r.id, theprofile);
+      }
+      /* sample the stops for the task scatterplot */
       if (apex_options::task_scatterplot()) {
-        if (!p->is_counter) {
-            static int thresh = RAND_MAX/100;
-            if (std::rand() < thresh) {
-                std::unique_lock<std::mutex> task_map_lock(_mtx);
-                task_scatterplot_samples << p->normalized_timestamp() << " " 
-                            << p->elapsed()*profiler::get_cpu_mhz()*1000000 << " " 
-                            << "'" << p->task_id->get_name() << "'" << endl;
-                int loc0 = task_scatterplot_samples.tellp();
-                if (loc0 > 32768) {
-                    // lock access to the file
-        			// write using low-level file locking!
-        			struct flock fl;
-        			fl.l_type   = F_WRLCK;  /* F_RDLCK, F_WRLCK, F_UNLCK    */
-        			fl.l_whence = SEEK_SET; /* SEEK_SET, SEEK_CUR, SEEK_END */
-        			fl.l_start  = 0;        /* Offset from l_whence         */
-        			fl.l_len    = 0;        /* length, 0 = to EOF           */
-        			fl.l_pid    = getpid();      /* our PID                      */
-        			fcntl(task_scatterplot_sample_file, F_SETLKW, &fl);  /* F_GETLK, F_SETLK, F_SETLKW */
-                    // flush the string stream to the file
-                    //lseek(task_scatterplot_sample_file, 0, SEEK_END);
-        			ssize_t bytes_written = write(task_scatterplot_sample_file, 
-						  task_scatterplot_samples.str().c_str(), loc0);
-                    if (bytes_written < 0) {
-                        int errsv = errno;
-                        perror("Error writing to scatterplot!");
-                        fprintf(stderr, "Error writing scatterplot:\n%s\n",
-                                strerror(errsv));
-                    }
-        			fl.l_type   = F_UNLCK;   /* tell it to unlock the region */
-        			fcntl(task_scatterplot_sample_file, F_SETLK, &fl); /* set the region to unlocked */
-                    // reset the stringstream
-                    task_scatterplot_samples.str("");
-                }
-            }
+        for (size_t j = 0 ; j < count ; j++) {
+          const profiler_record &sample = records[j];
+          if (!sample.is_counter()) {
+            // a throttled timer's record stands for weight stops
+            task_sampler::offer(sample.id, sample.normalized_timestamp(),
+                                sample.elapsed()*profiler::get_cpu_mhz()*1000000,
+                                sample.is_sampled() ? (uint64_t)sample.value : 1);
+          }
         }
       }
-    return 1;
+    return count;
+  }
+
+  /* Is this a lightweight task? If so, only measure 1 in N calls, with N
+   * chosen so that measuring it costs at most APEX_THROTTLE_OVERHEAD
+   * percent of the time spent in it. N is reconsidered every
+   * APEX_THROTTLE_CALLS calls, so a timer whose calls get longer is
+   * measured in full again. */
+  inline void profiler_listener::check_throttle(uint32_t id, profile * theprofile) {
+    double mean;
+    if (theprofile->get_type() != APEX_TIMER ||
+        !theprofile->window_mean(APEX_THROTTLE_CALLS, mean)) {
+        return;
+    }
+    double wanted = APEX_MAX_THROTTLE_PERIOD;
+    if (mean > 0.0) {
+        wanted = _throttle_event_cost / (_throttle_budget * mean);
+    }
+    uint32_t period = 1;
+    while (period < wanted && period < APEX_MAX_THROTTLE_PERIOD) {
+        period = period << 1;
+    }
+    task_identifier * task_id = task_identifier::from_id(id);
+    uint32_t old_period = task_id->throttle_period.load(std::memory_order_relaxed);
+    // don't flip back and forth for a timer right at the threshold
+    if (old_period > 1 && period == 1 && wanted > 0.5) {
+        period = 2;
+    }
+    if (period == old_period) {
+        return;
+    }
+    task_id->throttle_period.store(period, std::memory_order_relaxed);
+    if (apex_options::use_screen_output()) {
+        if (old_period == 1) {
+            cout << "APEX: throttling lightweight timer " 
+                 << task_id->get_name() << endl; 
+        } else if (period == 1) {
+            cout << "APEX: no longer throttling timer " 
+                 << task_id->get_name() << endl; 
+        }
+        fflush(stdout);
+    }
+  }
+
+  /* Estimate what it costs to measure one timer call, in the same units
+   * as the profiles, for the throttler. */
+  void profiler_listener::measure_event_cost(void) {
+    const int iterations = 1000;
+    task_identifier * id = task_identifier::get_task_id(string(APEX_MAIN));
+    MYCLOCK::time_point start = MYCLOCK::now();
+    for (int i = 0 ; i < iterations ; i++) {
+      profiler * p = new profiler(id);
+      p->stop(false);
+      delete p;
+    }
+    MYCLOCK::time_point end = MYCLOCK::now();
+    std::chrono::duration<double> time_span =
+      std::chrono::duration_cast<std::chrono::duration<double>>(end - start);
+    _throttle_event_cost = time_span.count() / iterations;
+  }
+
+  /* The per-thread profile tables for APEX_AGGREGATION=thread_local */
+  static std::atomic<thread_profile_table*> _all_tables(nullptr);
+  static std::mutex _orphan_table_mutex;
+  static thread_profile_table * _orphan_tables = nullptr;
+  static APEX_NATIVE_TLS thread_profile_table * _thread_table = nullptr;
+
+  static thread_profile_table * get_thread_table(void) {
+    thread_profile_table * table = _thread_table;
+    if (table == nullptr) {
+      // first time called by this thread - adopt an orphan, or make a new table.
+      {
+        std::unique_lock<std::mutex> l(_orphan_table_mutex);
+        if (_orphan_tables != nullptr) {
+          table = _orphan_tables;
+          _orphan_tables = table->next_orphan;
+          table->next_orphan = nullptr;
+        }
+      }
+      if (table == nullptr) {
+        table = new thread_profile_table();
+        thread_profile_table * head = _all_tables.load(std::memory_order_relaxed);
+        do {
+          table->next = head;
+        } while (!_all_tables.compare_exchange_weak(head, table,
+                 std::memory_order_release, std::memory_order_relaxed));
+      }
+      _thread_table = table;
+    }
+    return table;
+  }
+
+  void profiler_listener::release_thread_profiles(void) {
+    thread_profile_table * table = _thread_table;
+    if (table != nullptr) {
+      std::unique_lock<std::mutex> l(_orphan_table_mutex);
+      table->next_orphan = _orphan_tables;
+      _orphan_tables = table;
+      _thread_table = nullptr;
+    }
+  }
+
+  /* Update this thread's own profile for the stopped timer (or for the
+   * call path it was stopped in). */
+  inline void profiler_listener::aggregate_locally(profiler_ptr &p, uint32_t id) {
+    double values[8] = {0};
+    int num_counters = 0;
+#if APEX_HAVE_PAPI
+    num_counters = num_papi_counters;
+    for (int i = 0 ; i < num_papi_counters ; i++) {
+        if (p->papi_stop_values[i] > p->papi_start_values[i]) {
+            values[i] = p->papi_stop_values[i] - p->papi_start_values[i];
+        }
+    }
+#endif
+    thread_profile_table * table = get_thread_table();
+    table->lock();
+    if (id >= table->profiles.size()) {
+        table->profiles.resize(std::max<size_t>(id + 1, table->profiles.size() * 2), nullptr);
+    }
+    profile * theprofile = table->profiles[id];
+    if (theprofile == nullptr) {
+        theprofile = new profile(p->elapsed(), num_counters, values, p->is_resume, APEX_TIMER, p->children_value);
+        table->profiles[id] = theprofile;
+        if (p->weight > 1) {
+            // the other calls this measurement stands for
+            theprofile->increment(p->elapsed(), p->children_value, num_counters, values, p->is_resume, p->weight - 1.0);
+        }
+    } else if (p->weight > 1) {
+        theprofile->increment(p->elapsed(), p->children_value, num_counters, values, p->is_resume, p->weight);
+    } else {
+        theprofile->increment(p->elapsed(), p->children_value, num_counters, values, p->is_resume);
+    }
+    table->unlock();
+  }
+
+  /* Fold the per-thread profiles into the shards. */
+  void profiler_listener::merge_thread_profiles(void) {
+    int num_counters = 0;
+#if APEX_HAVE_PAPI
+    num_counters = num_papi_counters;
+#endif
+    for (thread_profile_table * table = _all_tables.load(std::memory_order_acquire) ;
+         table != nullptr ; table = table->next) {
+      table->lock();
+      for (uint32_t id = 0 ; id < table->profiles.size() ; id++) {
+        profile * local = table->profiles[id];
+        if (local == nullptr) { continue; }
+        table->profiles[id] = nullptr;
+        profile * theprofile;
+        profile_shard &shard = shard_of(id);
+        std::unique_lock<std::mutex> task_map_lock(shard.task_map_mutex);
+        theprofile = shard.task_map.find(id);
+        if (theprofile == nullptr) {
+          theprofile = shard.task_map.emplace(id, *local);
+        } else {
+          theprofile->merge(*local, num_counters);
+        }
+        delete local;
+        if (_throttle_timers) {
+          check_throttle(id, theprofile);
+        }
+      }
+      table->unlock();
+    }
   }
 
   inline unsigned int profiler_listener::process_dependency(task_dependency* td)
   {
-      unordered_map<task_identifier, unordered_map<task_identifier, int>* >::const_iterator it = task_dependencies.find(td->parent);
-      unordered_map<task_identifier, int> * depend;
+      unordered_map<uint32_t, unordered_map<uint32_t, int>* >::const_iterator it = task_dependencies.find(td->parent);
+      unordered_map<uint32_t, int> * depend;
       // if this is a new dependency for this parent?
       if (it == task_dependencies.end()) {
-          depend = new unordered_map<task_identifier, int>();
+          depend = new unordered_map<uint32_t, int>();
           (*depend)[td->child] = 1;
           task_dependencies[td->parent] = depend;
       // otherwise, see if this parent has seen this child
       } else {
           depend = it->second;
-          unordered_map<task_identifier, int>::const_iterator it2 = depend->find(td->child);
+          unordered_map<uint32_t, int>::const_iterator it2 = depend->find(td->child);
           // first time for this child
           if (it2 == depend->end()) {
               (*depend)[td->child] = 1;
@@ -356,74 +594,41 @@ namespace apex {
   /* Cleaning up memory. Not really necessary, because it only gets
    * called at shutdown. But a good idea to do regardless. */
   void profiler_listener::delete_profiles(void) {
-    // iterate over the map and free the objects in the map
-    unordered_map<task_identifier, profile*>::const_iterator it;
-    for(it = task_map.begin(); it != task_map.end(); it++) {
-      delete it->second;
-    }
-    // clear the map.
+    // the tables own their profiles
     task_map.clear();
+    for (profile_shard * shard : _shards) {
+      shard->task_map.clear();
+    }
 
   }
 
-#define PAD_WITH_SPACES "%8s"
+#define PAD_WITH_SPACES "%8d"
 #define FORMAT_PERCENT "%8.3f"
 #define FORMAT_SCIENTIFIC "%1.2e"
 
-  template<typename ... Args>
-  string string_format( const std::string& format, Args ... args )
-  {
-      size_t size = snprintf( nullptr, 0, format.c_str(), args ... ) + 1; // Extra space for '\0'
-      unique_ptr<char[]> buf( new char[ size ] ); 
-      snprintf( buf.get(), size, format.c_str(), args ... );
-      return string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
-  }
-
-  void profiler_listener::write_one_timer(task_identifier &task_id, 
-          profile * p, stringstream &screen_output, 
-          stringstream &csv_output, double &total_accumulated, 
-          double &total_main) {
-      string action_name = task_id.get_name();
-#if APEX_HAVE_BFD
-      REGEX_NAMESPACE::regex rx (".*UNRESOLVED ADDR (.*)");
-      if (REGEX_NAMESPACE::regex_match (action_name,rx)) {
-        const REGEX_NAMESPACE::regex separator(" ADDR ");
-        REGEX_NAMESPACE::sregex_token_iterator token(action_name.begin(), action_name.end(), separator, -1);
-        *token++; // ignore
-        string addr_str = *token++;
-        void* addr_addr;
-        sscanf(addr_str.c_str(), "%p", &addr_addr);
-        string * tmp = lookup_address((uintptr_t)addr_addr, true);
-        REGEX_NAMESPACE::regex old_address("UNRESOLVED ADDR " + addr_str);
-        action_name = REGEX_NAMESPACE::regex_replace(action_name, old_address, *tmp);
-      }
-#endif
-      string shorter(action_name);
-      // to keep formatting pretty, trim any long timer names
+  /* to keep formatting pretty, trim any long timer names */
+  static string trim_name(const string &name) {
+      string shorter(name);
       if (shorter.size() > 30) {
         shorter.resize(27);
         shorter.resize(30, '.');
       }
+      return shorter;
+  }
+
+  void profiler_listener::write_one_timer(task_identifier &task_id, 
+          profile * p, output_buffer &screen_output, 
+          output_buffer &csv_output, double &total_accumulated, 
+          double &total_main) {
+      string action_name = finalize_pipeline::name(task_id.id);
+      string shorter(trim_name(action_name));
       //screen_output << "\"" << shorter << "\", " ;
-      screen_output << string_format("%30s", shorter.c_str()) << " : ";
-#if defined(APEX_THROTTLE)
-      // if this profile was throttled, don't output the measurements.
-      // they are limited and bogus, anyway.
-      throttled_event_set_mutex.lock();
-      unordered_set<task_identifier>::const_iterator it4 = throttled_tasks.find(task_id);
-      throttled_event_set_mutex.unlock();
-      if (it4!= throttled_tasks.end()) { 
-        screen_output << "DISABLED (high frequency, short duration)" << endl;
-        return; 
-      }
-#endif
-      if(p->get_calls() < 1) {
-        p->get_profile()->calls = 1;
-      }
+      // mark the profiles extrapolated from throttled timers
+      screen_output.printf("%30s", shorter.c_str()) << (p->is_estimate() ? " * " : " : ");
       if (p->get_calls() < 999999) {
-          screen_output << string_format(PAD_WITH_SPACES, to_string((int)p->get_calls()).c_str()) << "   " ;
+          screen_output.printf(PAD_WITH_SPACES, (int)p->get_calls()) << "   " ;
       } else {
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_calls()) << "   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_calls()) << "   " ;
       }
       if (p->get_type() == APEX_TIMER) {
         csv_output << "\"" << action_name << "\",";
@@ -433,108 +638,202 @@ namespace apex {
         // convert MHz to microseconds
         csv_output << std::llround(p->get_accumulated()*profiler::get_cpu_mhz()*1000000);
         screen_output << " --n/a--   " ;
-        screen_output << string_format(FORMAT_SCIENTIFIC, (p->get_mean()*profiler::get_cpu_mhz())) << "   " ;
+        screen_output.printf(FORMAT_SCIENTIFIC, (p->get_mean()*profiler::get_cpu_mhz())) << "   " ;
         screen_output << " --n/a--   " ;
-        screen_output << string_format(FORMAT_SCIENTIFIC, (p->get_accumulated()*profiler::get_cpu_mhz())) << "   " ;
+        screen_output.printf(FORMAT_SCIENTIFIC, (p->get_accumulated()*profiler::get_cpu_mhz())) << "   " ;
+        screen_output.printf(FORMAT_SCIENTIFIC, (p->get_exclusive()*profiler::get_cpu_mhz())) << "   " ;
         screen_output << " --n/a--   " ;
-        screen_output << string_format(FORMAT_PERCENT, (((p->get_accumulated()*profiler::get_cpu_mhz())/total_main)*100));
+        screen_output.printf(FORMAT_PERCENT, (((p->get_accumulated()*profiler::get_cpu_mhz())/total_main)*100));
 #if APEX_HAVE_PAPI
         for (int i = 0 ; i < num_papi_counters ; i++) {
-            screen_output  << "   " << string_format(FORMAT_SCIENTIFIC, (p->get_papi_metrics()[i]));
+            screen_output << "   ";
+            screen_output.printf(FORMAT_SCIENTIFIC, (p->get_papi_metrics()[i]));
             csv_output << "," << std::llround(p->get_papi_metrics()[i]);
         }
 #endif
-        screen_output << endl;
-        total_accumulated += p->get_accumulated();
-        csv_output << endl;
+        for (size_t m = 0 ; m < _num_perf_metrics ; m++) {
+            size_t i = task_id.id * _num_perf_metrics + m;
+            csv_output << "," << std::llround(i < _perf_totals.size() ? _perf_totals[i] : 0.0);
+        }
+        if (_throttle_timers) {
+            csv_output << "," << (p->is_estimate() ? 1 : 0);
+        }
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            csv_output << "," << p->get_quantile(q)*profiler::get_cpu_mhz()*1000000;
+        }
+        csv_output << "," << std::llround(p->get_exclusive()*profiler::get_cpu_mhz()*1000000);
+        screen_output << '\n';
+        // exclusive, so that nested timers aren't counted twice
+        total_accumulated += p->get_exclusive();
+        csv_output << '\n';
       } else {
         if (action_name.find('%') == string::npos) {
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_minimum()) << "   " ;
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_mean()) << "   " ;
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_maximum()) << "   " ;
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_accumulated()) << "   " ;
-          screen_output << string_format(FORMAT_SCIENTIFIC, p->get_stddev()) << "   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_minimum()) << "   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_mean()) << "   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_maximum()) << "   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_accumulated()) << "   " ;
+          screen_output << " --n/a--   " ;
+          screen_output.printf(FORMAT_SCIENTIFIC, p->get_stddev()) << "   " ;
         } else {
-          screen_output << string_format(FORMAT_PERCENT, p->get_minimum()) << "   " ;
-          screen_output << string_format(FORMAT_PERCENT, p->get_mean()) << "   " ;
-          screen_output << string_format(FORMAT_PERCENT, p->get_maximum()) << "   " ;
-          screen_output << string_format(FORMAT_PERCENT, p->get_accumulated()) << "   " ;
-          screen_output << string_format(FORMAT_PERCENT, p->get_stddev()) << "   " ;
+          screen_output.printf(FORMAT_PERCENT, p->get_minimum()) << "   " ;
+          screen_output.printf(FORMAT_PERCENT, p->get_mean()) << "   " ;
+          screen_output.printf(FORMAT_PERCENT, p->get_maximum()) << "   " ;
+          screen_output.printf(FORMAT_PERCENT, p->get_accumulated()) << "   " ;
+          screen_output << " --n/a--   " ;
+          screen_output.printf(FORMAT_PERCENT, p->get_stddev()) << "   " ;
         }
-        screen_output << " --n/a-- "  << endl;
+        screen_output << " --n/a-- "  << '\n';
       }
   }
 
+  /* Write the call path profiles as a tree, the children of each timer
+   * ordered by their inclusive time. */
+  void profiler_listener::write_callpath_tree(output_buffer &screen_output) {
+    // link each call path to its parent; roots are the plain timers
+    std::unordered_map<uint32_t, std::vector<uint32_t> > children;
+    std::unordered_map<uint32_t, uint32_t> leaves;
+    std::vector<uint32_t> roots;
+    for(auto &it : task_map) {
+        uint32_t id = it.first;
+        uint32_t parent, leaf;
+        // a truncated path's ancestors may have no profile of their own
+        while (leaves.find(id) == leaves.end() && callpath::is_callpath(id, parent, leaf)) {
+            leaves[id] = leaf;
+            std::vector<uint32_t> &siblings = children[parent];
+            siblings.push_back(id);
+            if (siblings.size() == 1 && !callpath::is_callpath(parent)) {
+                roots.push_back(parent);
+            }
+            id = parent;
+        }
+    }
+    if (roots.empty()) {
+        return;
+    }
+    auto inclusive = [&](uint32_t id) {
+        profile * p = task_map.find(id);
+        return p == nullptr ? 0.0 : p->get_accumulated();
+    };
+    auto by_time = [&](uint32_t a, uint32_t b) { return inclusive(a) > inclusive(b); };
+    std::sort(roots.begin(), roots.end(), [](uint32_t a, uint32_t b) {
+        return *task_identifier::from_id(a) < *task_identifier::from_id(b);
+    });
+    screen_output << '\n' << "Call paths                     :  #calls  |   total  | exclusive" << '\n';
+    screen_output << "-------------------------------------------------------------------------------" << '\n';
+    std::function<void(uint32_t, uint32_t, size_t)> write_node =
+        [&](uint32_t id, uint32_t leaf, size_t depth) {
+        string name(string(depth * 2, ' ') + finalize_pipeline::name(leaf));
+        screen_output.printf("%-30s", trim_name(name).c_str()) << " : ";
+        profile * p = task_map.find(id);
+        if (p == nullptr) {
+            screen_output << " --n/a--    --n/a--    --n/a--   " << '\n';
+        } else {
+            if (p->get_calls() < 999999) {
+                screen_output.printf(PAD_WITH_SPACES, (int)p->get_calls()) << "   " ;
+            } else {
+                screen_output.printf(FORMAT_SCIENTIFIC, p->get_calls()) << "   " ;
+            }
+            screen_output.printf(FORMAT_SCIENTIFIC, (p->get_accumulated()*profiler::get_cpu_mhz())) << "   " ;
+            screen_output.printf(FORMAT_SCIENTIFIC, (p->get_exclusive()*profiler::get_cpu_mhz())) << '\n';
+        }
+        auto it = children.find(id);
+        if (it != children.end()) {
+            std::sort(it->second.begin(), it->second.end(), by_time);
+            for (uint32_t child : it->second) {
+                write_node(child, leaves[child], depth + 1);
+            }
+        }
+    };
+    for (uint32_t root : roots) {
+        write_node(root, root, 0);
+    }
+    screen_output << "-------------------------------------------------------------------------------" << '\n';
+  }
+
   /* At program termination, write the measurements to the screen, or to CSV file, or both. */
   void profiler_listener::finalize_profiles(void) {
     // our TOTAL available time is the elapsed * the number of threads, or cores
-	int num_worker_threads = thread_instance::get_num_threads();
+    int num_worker_threads = _num_worker_threads;
     double wall_clock_main = main_timer->elapsed() * profiler::get_cpu_mhz();
 #ifdef APEX_HAVE_HPX3
     num_worker_threads = num_worker_threads - 8;
 #endif
     double total_main = wall_clock_main * 
         fmin(hardware_concurrency(), num_worker_threads);
-    // create a stringstream to hold all the screen output - we may not
-    // want to write it out
-    stringstream screen_output;
-    // create a stringstream to hold all the CSV output - we may not
-    // want to write it out
-    stringstream csv_output;
+    // buffers for the screen and CSV output, with room for about a line
+    // for each profile
+    output_buffer screen_output(4096 + task_map.size() * 320);
+    output_buffer csv_output(1024 + task_map.size() * (160 + 24 * _num_perf_metrics));
     // iterate over the profiles in the address map
-    screen_output << "Elapsed time: " << wall_clock_main << endl;
-    screen_output << "Cores detected: " << hardware_concurrency() << endl;
-    screen_output << "Worker Threads observed: " << num_worker_threads << endl;
-    screen_output << "Available CPU time: " << total_main << endl;
-    map<apex_function_address, profile*>::const_iterator it;
-    screen_output << "Action                         :  #calls  |  minimum |    mean  |  maximum |   total  |  stddev  |  % total  " << apex_options::papi_metrics() << endl;
-    screen_output << "------------------------------------------------------------------------------------------------------------" << endl;
+    screen_output << "Elapsed time: " << wall_clock_main << '\n';
+    screen_output << "Cores detected: " << hardware_concurrency() << '\n';
+    screen_output << "Worker Threads observed: " << num_worker_threads << '\n';
+    screen_output << "Available CPU time: " << total_main << '\n';
+    screen_output << "Action                         :  #calls  |  minimum |    mean  |  maximum |   total  | exclusive|  stddev  |  % total  " << apex_options::papi_metrics() << '\n';
+    screen_output << "-----------------------------------------------------------------------------------------------------------------------" << '\n';
     csv_output << "\"task\",\"num calls\",\"total cycles\",\"total microseconds\"";
 #if APEX_HAVE_PAPI
     for (int i = 0 ; i < num_papi_counters ; i++) {
        csv_output << ",\"" << metric_names[i] << "\"";
     }
 #endif
-    csv_output << endl;
+    // the perf_event_open counters, added up over all of the threads
+    _perf_totals.clear();
+    perf_events::totals(_perf_totals);
+    for (size_t m = 0 ; m < _num_perf_metrics ; m++) {
+       csv_output << ",\"" << perf_events::metric_name(m) << "\"";
+    }
+    if (_throttle_timers) {
+        csv_output << ",\"estimated\"";
+    }
+    csv_output << ",\"p50 microseconds\",\"p90 microseconds\",\"p99 microseconds\",\"p99.9 microseconds\"";
+    csv_output << ",\"exclusive microseconds\"";
+    csv_output << '\n';
     double total_accumulated = 0.0;
-    unordered_map<task_identifier, profile*>::const_iterator it2;
-    std::vector<task_identifier> id_vector;
+    profile_table::const_iterator it2;
+    std::vector<task_identifier*> id_vector;
+    auto by_name = [](task_identifier * a, task_identifier * b) { return *a < *b; };
     // iterate over the counters, and sort their names
     for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
-        task_identifier task_id = it2->first;
+        task_identifier * task_id = task_identifier::from_id(it2->first);
         profile * p = it2->second;
         if (p->get_type() != APEX_TIMER) {
             id_vector.push_back(task_id);
         }
     }
-    std::sort(id_vector.begin(), id_vector.end());
+    std::sort(id_vector.begin(), id_vector.end(), by_name);
     // iterate over the counters
-    for(task_identifier task_id : id_vector) {
-        profile * p = task_map[task_id];
+    for(task_identifier * task_id : id_vector) {
+        profile * p = task_map.find(task_id->id);
         if (p) {
-            write_one_timer(task_id, p, screen_output, csv_output, total_accumulated, total_main);
+            write_one_timer(*task_id, p, screen_output, csv_output, total_accumulated, total_main);
         }
     }
     id_vector.clear();
     // iterate over the timers, and sort their names
     for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
         profile * p = it2->second;
-        task_identifier task_id = it2->first;
-        if (p->get_type() == APEX_TIMER) {
+        task_identifier * task_id = task_identifier::from_id(it2->first);
+        // the call paths are written as a tree, below
+        if (p->get_type() == APEX_TIMER && !callpath::is_callpath(it2->first)) {
             id_vector.push_back(task_id);
         }
     }
     // iterate over the timers
-    std::sort(id_vector.begin(), id_vector.end());
+    std::sort(id_vector.begin(), id_vector.end(), by_name);
     // iterate over the counters
-    for(task_identifier task_id : id_vector) {
-        profile * p = task_map[task_id];
+    for(task_identifier * task_id : id_vector) {
+        profile * p = task_map.find(task_id->id);
         if (p) {
-            write_one_timer(task_id, p, screen_output, csv_output, total_accumulated, total_main);
+            write_one_timer(*task_id, p, screen_output, csv_output, total_accumulated, total_main);
         }
     }
+    bool estimated = false;
+    for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
+        estimated = estimated || it2->second->is_estimate();
+    }
     double idle_rate = total_main - (total_accumulated*profiler::get_cpu_mhz());
-    screen_output << string_format("%30s", APEX_IDLE_TIME) << " : ";
+    screen_output.printf("%30s", APEX_IDLE_TIME) << " : ";
     screen_output << " --n/a--   " ;
     screen_output << " --n/a--   " ;
     screen_output << " --n/a--   " ;
@@ -542,45 +841,62 @@ namespace apex {
     if (idle_rate < 0.0) {
       screen_output << " --n/a--   " ;
     } else {
-      screen_output << string_format(FORMAT_SCIENTIFIC, idle_rate) << "   " ;
+      screen_output.printf(FORMAT_SCIENTIFIC, idle_rate) << "   " ;
     }
     screen_output << " --n/a--   " ;
+    screen_output << " --n/a--   " ;
     if (idle_rate < 0.0) {
-      screen_output << " --n/a--   " << endl;
+      screen_output << " --n/a--   " << '\n';
     } else {
-      screen_output << string_format(FORMAT_PERCENT, ((idle_rate/total_main)*100)) << endl;
+      screen_output.printf(FORMAT_PERCENT, ((idle_rate/total_main)*100)) << '\n';
+    }
+    screen_output << "-----------------------------------------------------------------------------------------------------------------------" << '\n';
+    if (estimated) {
+      screen_output << "* Estimated - extrapolated from the calls measured while the timer was throttled." << '\n';
+    }
+    if (_callpath_depth > 0) {
+      write_callpath_tree(screen_output);
+    }
+    // the timers' quantiles, estimated from their histograms
+    screen_output << '\n' << "Timer quantiles (seconds)      :    p50   |    p90   |    p99   |   p99.9  " << '\n';
+    screen_output << "-------------------------------------------------------------------------------" << '\n';
+    for(task_identifier * task_id : id_vector) {
+        profile * p = task_map.find(task_id->id);
+        if (p == nullptr) { continue; }
+        screen_output.printf("%30s", trim_name(finalize_pipeline::name(task_id->id)).c_str()) << " : ";
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            screen_output.printf(FORMAT_SCIENTIFIC, p->get_quantile(q)*profiler::get_cpu_mhz()) << "   " ;
+        }
+        screen_output << '\n';
+    }
+    screen_output << "-------------------------------------------------------------------------------" << '\n';
+    if (_num_perf_metrics > 0) {
+        screen_output << '\n' << "Timer counters                 : ";
+        for (size_t m = 0 ; m < _num_perf_metrics ; m++) {
+            screen_output << (m > 0 ? " | " : "") << perf_events::metric_name(m);
+        }
+        screen_output << '\n';
+        screen_output << "-------------------------------------------------------------------------------" << '\n';
+        for(task_identifier * task_id : id_vector) {
+            screen_output.printf("%30s", trim_name(finalize_pipeline::name(task_id->id)).c_str()) << " : ";
+            for (size_t m = 0 ; m < _num_perf_metrics ; m++) {
+                size_t i = task_id->id * _num_perf_metrics + m;
+                screen_output.printf(FORMAT_SCIENTIFIC, i < _perf_totals.size() ? _perf_totals[i] : 0.0) << "   " ;
+            }
+            screen_output << '\n';
+        }
+        screen_output << "-------------------------------------------------------------------------------" << '\n';
     }
-    screen_output << "------------------------------------------------------------------------------------------------------------" << endl;
     if (apex_options::use_screen_output()) {
-        cout << screen_output.str();
+        screen_output.write(cout);
     }
     if (apex_options::use_csv_output()) {
-        ofstream csvfile;
         stringstream csvname;
         csvname << "apex." << node_id << ".csv";
-        csvfile.open(csvname.str(), ios::out);
-        csvfile << csv_output.str();
-        csvfile.close();
+        csv_output.write(csvname.str());
     }
   }
 
-  void fix_name(string& in_name) {
-#if defined(HAVE_BFD)                                                            
-        REGEX_NAMESPACE::regex rx (".*UNRESOLVED ADDR (.*)");
-        if (REGEX_NAMESPACE::regex_match (in_name,rx)) {
-          const REGEX_NAMESPACE::regex separator(" ADDR ");
-          REGEX_NAMESPACE::sregex_token_iterator token(in_name.begin(), in_name.end(), separator, -1);
-          *token++; // ignore
-          string addr_str = *token++;
-          void* addr_addr;
-          sscanf(addr_str.c_str(), "%p", &addr_addr);
-          string tmp = lookup_address((uintptr_t)addr_addr, false);
-          REGEX_NAMESPACE::regex old_address("UNRESOLVED ADDR " + addr_str);
-          in_name = REGEX_NAMESPACE::regex_replace(in_name, old_address, tmp);
-        }
-#endif
-  }
-
 /* The following code is from:
    http://stackoverflow.com/questions/7706339/grayscale-to-red-green-blue-matlab-jet-color-scale */
 class node_color {
@@ -621,28 +937,25 @@ node_color * get_node_color(double v,double vmin,double vmax)
 }
 
   void profiler_listener::write_taskgraph(void) {
-    ofstream myfile;
+    output_buffer myfile(1024 + (task_dependencies.size() + task_map.size()) * 160);
     stringstream dotname;
     dotname << "taskgraph." << node_id << ".dot";
-    myfile.open(dotname.str().c_str());
 
     myfile << "digraph prof {\n rankdir=\"LR\";\n node [shape=box];\n";
     for(auto dep = task_dependencies.begin(); dep != task_dependencies.end(); dep++) {
-        task_identifier parent = dep->first;
+        string parent_name = finalize_pipeline::name(dep->first);
         auto children = dep->second;
-        string parent_name = parent.get_name();
         for(auto offspring = children->begin(); offspring != children->end(); offspring++) {
-            task_identifier child = offspring->first;
             int count = offspring->second;
-            string child_name = child.get_name();
+            string child_name = finalize_pipeline::name(offspring->first);
             myfile << "  \"" << parent_name << "\" -> \"" << child_name << "\"";
-            myfile << " [ label=\"  count: " << count << "\" ]; " << std::endl;
+            myfile << " [ label=\"  count: " << count << "\" ]; " << '\n';
             
         }
     }
 
     // our TOTAL available time is the elapsed * the number of threads, or cores
-	int num_worker_threads = thread_instance::get_num_threads();
+    int num_worker_threads = _num_worker_threads;
 #ifdef APEX_HAVE_HPX3
     num_worker_threads = num_worker_threads - 8;
 #endif
@@ -650,70 +963,69 @@ node_color * get_node_color(double v,double vmin,double vmax)
         fmin(hardware_concurrency(), num_worker_threads);
 
     // output nodes with  "main" [shape=box; style=filled; fillcolor="#ff0000" ];
-    unordered_map<task_identifier, profile*>::const_iterator it;
+    profile_table::const_iterator it;
     for(it = task_map.begin(); it != task_map.end(); it++) {
       profile * p = it->second;
       if (p->get_type() == APEX_TIMER) {
         node_color * c = get_node_color((p->get_accumulated()*profiler::get_cpu_mhz()), 0.0, total_main);
-        task_identifier task_id = it->first;
-        myfile << "  \"" << task_id.get_name() << "\" [shape=box; style=filled; fillcolor=\"#" << 
-            setfill('0') << setw(2) << hex << c->convert(c->red) << 
-            setfill('0') << setw(2) << hex << c->convert(c->green) << 
-            setfill('0') << setw(2) << hex << c->convert(c->blue) << "\"" <<
-            "; label=\"" << task_id.get_name() << ":\\n" << (p->get_accumulated()*profiler::get_cpu_mhz()) << "s\" ];" << std::endl;
+        string name = finalize_pipeline::name(it->first);
+        myfile << "  \"" << name << "\" [shape=box; style=filled; fillcolor=\"#";
+        myfile.printf("%02x%02x%02x", c->convert(c->red), c->convert(c->green), c->convert(c->blue));
+        myfile << "\"" << "; label=\"" << name << ":\\n" << (p->get_accumulated()*profiler::get_cpu_mhz()) << "s\" ];" << '\n';
+        delete c;
       }
     }
     myfile << "}\n";
-    myfile.close();
+    myfile.write(dotname.str());
   }
 
   /* When writing a TAU profile, write out a timer line */
-  void format_line(ofstream &myfile, profile * p) {
+  void format_line(output_buffer &myfile, profile * p, const string &group) {
     myfile << p->get_calls() << " ";
     myfile << 0 << " ";
-    myfile << ((p->get_accumulated()*profiler::get_cpu_mhz())) << " ";
+    myfile << ((p->get_exclusive()*profiler::get_cpu_mhz())) << " ";
     myfile << ((p->get_accumulated()*profiler::get_cpu_mhz())) << " ";
     myfile << 0 << " ";
-    myfile << "GROUP=\"TAU_USER\" ";
-    myfile << endl;
+    // mark the profiles extrapolated from throttled timers
+    myfile << "GROUP=\"" << group << (p->is_estimate() ? "|APEX_ESTIMATE\" " : "\" ");
+    myfile << '\n';
   }
 
   /* When writing a TAU profile, write out the main timer line */
-  void format_line(ofstream &myfile, profile * p, double not_main) {
+  void format_line(output_buffer &myfile, profile * p, double not_main) {
     myfile << p->get_calls() << " ";
     myfile << 0 << " ";
     myfile << (max(((p->get_accumulated()*profiler::get_cpu_mhz()) - not_main),0.0)) << " ";
     myfile << ((p->get_accumulated()*profiler::get_cpu_mhz())) << " ";
     myfile << 0 << " ";
-    myfile << "GROUP=\"TAU_USER\" ";
-    myfile << endl;
+    // mark the profiles extrapolated from throttled timers
+    myfile << (p->is_estimate() ? "GROUP=\"TAU_USER|APEX_ESTIMATE\" " : "GROUP=\"TAU_USER\" ");
+    myfile << '\n';
   }
 
   /* When writing a TAU profile, write out a counter line */
-  void format_counter_line(ofstream &myfile, profile * p) {
+  void format_counter_line(output_buffer &myfile, profile * p) {
     myfile << p->get_calls() << " ";       // numevents
     myfile << p->get_maximum() << " ";     // max
     myfile << p->get_minimum() << " ";     // min
     myfile << p->get_mean() << " ";        // mean
     myfile << p->get_sum_squares() << " ";
-    myfile << endl;
+    myfile << '\n';
   }
 
   /* Write TAU profiles from the collected data. */
   void profiler_listener::write_profile() {
-    ofstream myfile;
+    output_buffer myfile(1024 + task_map.size() * 160);
     stringstream datname;
     // name format: profile.nodeid.contextid.threadid
     // We only write one profile per process
     datname << "profile." << node_id << ".0.0";
 
-    // name format: profile.nodeid.contextid.threadid
-    myfile.open(datname.str().c_str());
     int counter_events = 0;
 
     // Determine number of counter events, as these need to be
     // excluded from the number of normal timers
-    unordered_map<task_identifier, profile*>::const_iterator it2;
+    profile_table::const_iterator it2;
     for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
       profile * p = it2->second;
       if(p->get_type() == APEX_COUNTER) {
@@ -724,10 +1036,9 @@ node_color * get_node_color(double v,double vmin,double vmax)
 
     // Print the normal timers to the profile file
     // 1504 templated_functions_MULTI_TIME
-    myfile << function_count << " templated_functions_MULTI_TIME" << endl;
+    myfile << function_count << " templated_functions_MULTI_TIME" << '\n';
     // # Name Calls Subrs Excl Incl ProfileCalls #
-    myfile << "# Name Calls Subrs Excl Incl ProfileCalls #" << endl;
-    thread_instance ti = thread_instance::instance();
+    myfile << "# Name Calls Subrs Excl Incl ProfileCalls #" << '\n';
 
     // Iterate over the profiles which are associated to a function
     // by name. Only output the regular timers now. Counters are
@@ -736,29 +1047,19 @@ node_color * get_node_color(double v,double vmin,double vmax)
     double not_main = 0.0;
     for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
       profile * p = it2->second;
-	  task_identifier task_id = it2->first;
       if(p->get_type() == APEX_TIMER) {
-        string action_name = task_id.get_name();
+        string action_name = finalize_pipeline::name(it2->first);
         if(strcmp(action_name.c_str(), APEX_MAIN) == 0) {
           mainp = p;
         } else {
-#if APEX_HAVE_BFD
-          REGEX_NAMESPACE::regex rx (".*UNRESOLVED ADDR (.*)");
-          if (REGEX_NAMESPACE::regex_match (action_name,rx)) {
-            const REGEX_NAMESPACE::regex separator(" ADDR ");
-            REGEX_NAMESPACE::sregex_token_iterator token(action_name.begin(), action_name.end(), separator, -1);
-            *token++; // ignore
-            string addr_str = *token++;
-            void* addr_addr;
-            sscanf(addr_str.c_str(), "%p", &addr_addr);
-            string * tmp = lookup_address((uintptr_t)addr_addr, true);
-            REGEX_NAMESPACE::regex old_address("UNRESOLVED ADDR " + addr_str);
-            action_name = REGEX_NAMESPACE::regex_replace(action_name, old_address, *tmp);
-          }
-#endif
           myfile << "\"" << action_name << "\" ";
-          format_line (myfile, p);
-          not_main += (p->get_accumulated()*profiler::get_cpu_mhz());
+          // TAU shows the "outer => inner" timers as a call tree
+          if (callpath::is_callpath(it2->first)) {
+            format_line (myfile, p, "TAU_CALLPATH");
+          } else {
+            format_line (myfile, p, "TAU_USER");
+            not_main += (p->get_exclusive()*profiler::get_cpu_mhz());
+          }
         }
       }
     }
@@ -768,22 +1069,132 @@ node_color * get_node_color(double v,double vmin,double vmax)
     }
 
     // 0 aggregates
-    myfile << "0 aggregates" << endl;
+    myfile << "0 aggregates" << '\n';
 
     // Now process the counters, if there are any.
     if(counter_events > 0) {
-      myfile << counter_events << " userevents" << endl;
-      myfile << "# eventname numevents max min mean sumsqr" << endl;
+      myfile << counter_events << " userevents" << '\n';
+      myfile << "# eventname numevents max min mean sumsqr" << '\n';
       for(it2 = task_map.begin(); it2 != task_map.end(); it2++) {
         profile * p = it2->second;
         if(p->get_type() == APEX_COUNTER) {
-          task_identifier task_id = it2->first;
-          myfile << "\"" << task_id.get_name() << "\" ";
+          myfile << "\"" << finalize_pipeline::name(it2->first) << "\" ";
           format_counter_line (myfile, p);
         }
       }
     }
-    myfile.close();
+    myfile.write(datname.str());
+  }
+
+  /* Write the profiles to apex.<node>.prof, in the binary format (see
+   * profile_file.hpp), for apex_profile_tool to merge and convert. */
+  void profiler_listener::write_binary_profile(void) {
+    double seconds = profiler::get_cpu_mhz();
+    profile_file_writer writer(node_id, main_timer->elapsed() * seconds, seconds);
+    std::unordered_map<uint32_t, uint32_t> records;
+    records.reserve(task_map.size());
+    for (auto &it : task_map) {
+      profile * p = it.second;
+      double scale = p->get_type() == APEX_TIMER ? seconds : 1.0;
+      profile_file_record record;
+      memset(&record, 0, sizeof(record));
+      record.type = p->get_type();
+      record.flags = p->is_estimate() ? APEX_PROFILE_RECORD_ESTIMATE : 0;
+      record.calls = p->get_calls();
+      record.accumulated = p->get_accumulated() * scale;
+      record.exclusive = p->get_exclusive() * scale;
+      record.sum_squares = p->get_sum_squares() * scale * scale;
+      record.minimum = p->get_minimum() * scale;
+      record.maximum = p->get_maximum() * scale;
+      records[it.first] = writer.add(finalize_pipeline::name(it.first), record, &(p->get_histogram()));
+    }
+    for (auto &it : records) {
+      uint32_t parent, leaf;
+      if (callpath::is_callpath(it.first, parent, leaf)) {
+        auto p = records.find(parent);
+        auto l = records.find(leaf);
+        writer.set_callpath(it.second,
+            p == records.end() ? APEX_PROFILE_FILE_NONE : p->second,
+            l == records.end() ? APEX_PROFILE_FILE_NONE : l->second);
+      }
+    }
+    stringstream filename;
+    filename << "apex." << node_id << ".prof";
+    writer.write(filename.str());
+  }
+
+  /* Write what has been measured since the last snapshot, to
+   * apex.<node>.snapshot.<sequence>.csv. The calls, accumulated and
+   * exclusive values and sums of squares are the differences from the
+   * last snapshot, so the snapshots add up to the whole profile; the
+   * minimum and maximum are for the whole run so far. Timers are in
+   * seconds. Profiles that haven't changed are left out. The file is
+   * written under a temporary name and then renamed, so a job killed
+   * while writing leaves no partial snapshot. */
+  void profiler_listener::write_profile_snapshot(void) {
+    std::vector<std::pair<task_identifier*, apex_profile> > snapshots;
+    get_profile_snapshots(snapshots);
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> interval = now - _last_snapshot_time;
+    std::chrono::duration<double> timestamp = std::chrono::system_clock::now().time_since_epoch();
+    _last_snapshot_time = now;
+    uint64_t sequence = _snapshot_sequence++;
+    int node = apex::instance() != nullptr ? apex::instance()->get_node_id() : node_id;
+    // the values are differences, so print them in full
+    output_buffer snapshot_output(1024 + snapshots.size() * 200);
+    snapshot_output << "# APEX profile snapshot\n";
+    snapshot_output << "# node " << node << '\n';
+    snapshot_output << "# sequence " << sequence << '\n';
+    snapshot_output.printf("# timestamp %.17g\n", timestamp.count());
+    snapshot_output.printf("# interval %.17g\n", interval.count());
+    snapshot_output << "\"task\",\"type\",\"calls\",\"accumulated\",\"exclusive\",\"sum squares\",\"minimum\",\"maximum\"\n";
+    double seconds = profiler::get_cpu_mhz();
+    for (auto &it : snapshots) {
+        apex_profile &current = it.second;
+        apex_profile &last = _last_snapshots[it.first->id];
+        // the first snapshot of a profile, or the first since it was reset
+        if (current.calls < last.calls || current.accumulated < last.accumulated) {
+            memset(&last, 0, sizeof(apex_profile));
+        }
+        if (current.calls == last.calls && current.accumulated == last.accumulated) {
+            continue;
+        }
+        double scale = current.type == APEX_TIMER ? seconds : 1.0;
+        snapshot_output << '"' << it.first->get_name() << "\",";
+        snapshot_output << (current.type == APEX_TIMER ? "timer," : "counter,");
+        snapshot_output.printf("%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+            current.calls - last.calls,
+            (current.accumulated - last.accumulated) * scale,
+            (current.exclusive - last.exclusive) * scale,
+            (current.sum_squares - last.sum_squares) * scale * scale,
+            current.minimum * scale, current.maximum * scale);
+        last = current;
+    }
+    stringstream snapshot_name;
+    snapshot_name << "apex." << node << ".snapshot." << sequence << ".csv";
+    string temporary_name(snapshot_name.str() + ".tmp");
+    if (!snapshot_output.write(temporary_name) ||
+        rename(temporary_name.c_str(), snapshot_name.str().c_str()) != 0) {
+        std::cerr << "APEX Warning : can't write the profile snapshot "
+                  << snapshot_name.str() << std::endl;
+    }
+  }
+
+  /* Write a profile snapshot every APEX_PROFILE_SNAPSHOT_PERIOD seconds,
+   * until shutdown. The consumers carry on while the profiles are copied. */
+  void profiler_listener::snapshot_thread_main(void) {
+      apex * inst = apex::instance();
+      if (inst == nullptr || inst->the_profiler_listener == nullptr) {
+          return;
+      }
+      profiler_listener * pl = inst->the_profiler_listener;
+      std::chrono::seconds period(apex_options::profile_snapshot_period());
+      std::unique_lock<std::mutex> l(pl->_snapshot_mutex);
+      while (!pl->_done) {
+          if (!pl->_snapshot_cv.wait_for(l, period, [pl]{ return pl->_done.load(); })) {
+              pl->write_profile_snapshot();
+          }
+      }
   }
 
   /*
@@ -796,42 +1207,168 @@ node_color * get_node_color(double v,double vmin,double vmax)
       if (inst != nullptr) { 
           profiler_listener * pl = inst->the_profiler_listener;
           if (pl != nullptr) {
-              pl->process_profiles();
+              // one task drains all of the shards
+              for (unsigned int i = 0 ; i < pl->_num_shards ; i++) {
+                  pl->process_profiles(i);
+              }
           }
       }
+#ifdef APEX_HAVE_HPX3
+      consumer_task_running.clear(memory_order_release);
+#endif
   }
 
-  bool profiler_listener::concurrent_cleanup(void){
-      std::shared_ptr<profiler> p;
-      while(thequeue.try_dequeue(p)) {
-        process_profile(p,0);
+#ifndef APEX_HAVE_HPX3
+  void profiler_listener::consumer_thread_main(unsigned int shard) {
+      apex * inst = apex::instance();
+      if (inst != nullptr) { 
+          profiler_listener * pl = inst->the_profiler_listener;
+          if (pl != nullptr) {
+              pl->process_profiles(shard);
+          }
       }
+  }
+#endif
+
+  bool profiler_listener::concurrent_cleanup(void){
+      std::vector<profiler_record> batch;
+      size_t n;
+      do {
+          n = 0;
+          for (unsigned int i = 0 ; i < _num_shards ; i++) {
+              n += drain_rings(i, batch);
+          }
+      } while (n > 0);
       return true;
   }
 
-  /* This is the main function for the consumer thread.
-   * It will wait at a semaphore for pending work. When there is
-   * work on one or more queues, it will iterate over the queues
-   * and process the pending profiler objects, updating the profiles
+  void profiler_listener::pause_consumers(bool paused) {
+      _consumers_paused.store(paused);
+      while (paused && _consumers_draining.load() > 0) {
+          std::this_thread::yield();
+      }
+#ifndef APEX_HAVE_HPX3
+      if (!paused) {
+          for (profile_shard * shard : _shards) {
+              shard->queue_signal.post();
+          }
+      }
+#else
+      if (!paused) {
+          apex_schedule_process_profiles();
+      }
+#endif
+  }
+
+  /* Visit each thread's ring for the shard once, taking up to
+   * APEX_RING_SLICE records from each, and process them in batches. A ring
+   * that another consumer is draining is skipped. Returns the number of
+   * records processed. */
+  size_t profiler_listener::drain_rings(unsigned int shard, std::vector<profiler_record> &batch) {
+      if (batch.size() < APEX_CONSUMER_BATCH) {
+          batch.resize(APEX_CONSUMER_BATCH);
+      }
+      size_t count = 0;
+      size_t used = 0;
+      size_t depth = 0;
+      uint64_t oldest = UINT64_MAX;
+      for (profiler_ring * ring = profiler_ring::first(shard) ;
+           ring != nullptr ; ring = ring->next()) {
+          if (ring->try_lock()) {
+              if (batch.size() - used < APEX_RING_SLICE) {
+                  process_batch(batch.data(), used);
+                  count += used;
+                  used = 0;
+              }
+              depth += ring->size_approx();
+              size_t popped = ring->pop_bulk(&batch[used], APEX_RING_SLICE);
+              // the first record popped is the oldest in the ring
+              if (popped > 0 && batch[used].end < oldest) {
+                  oldest = batch[used].end;
+              }
+              used += popped;
+              ring->unlock();
+          }
+      }
+      process_batch(batch.data(), used);
+      // only this shard's consumer raises these, so no CAS is needed
+      profile_shard &my_shard = *(_shards[shard]);
+      if (depth > my_shard.max_depth.load(std::memory_order_relaxed)) {
+          my_shard.max_depth.store(depth, std::memory_order_relaxed);
+      }
+      if (oldest != UINT64_MAX) {
+          uint64_t now = MYCLOCK::now().time_since_epoch().count();
+          uint64_t latency = now > oldest ? now - oldest : 0;
+          if (latency > my_shard.max_latency.load(std::memory_order_relaxed)) {
+              my_shard.max_latency.store(latency, std::memory_order_relaxed);
+          }
+      }
+      return count + used;
+  }
+
+  /* Group the records by timer ID, so each profile is looked up and
+   * updated once per batch. Sorting by stop time within an ID keeps
+   * resets in the right place. The sort has to be stable: with a coarse
+   * clock, a reset and the timers around it can have the same stop time,
+   * and then only their order in the ring tells them apart. */
+  void profiler_listener::process_batch(profiler_record *records, size_t count) {
+      size_t begin = 0;
+      while (begin < count) {
+          // a "reset all" splits the batch
+          size_t end = begin;
+          while (end < count && !(records[end].flags & APEX_RECORD_RESET_ALL)) {
+              end++;
+          }
+          std::stable_sort(records + begin, records + end,
+              [](const profiler_record &a, const profiler_record &b) {
+                  return a.id < b.id || (a.id == b.id && a.end < b.end);
+              });
+          size_t i = begin;
+          while (i < end) {
+              size_t j = i + 1;
+              while (j < end && records[j].id == records[i].id) {
+                  j++;
+              }
+              process_profile(&records[i], j - i, 0);
+              i = j;
+          }
+          if (end < count) {
+              reset_shard(shard_of(records[end].id));
+              end++;
+          }
+          begin = end;
+      }
+  }
+
+  /* This is the main function for the consumer threads.
+   * Each will wait at its shard's semaphore for pending work. When there
+   * is work on one or more rings, it will iterate over the rings
+   * and process the pending profiler records, updating the profiles
    * as it goes. */
-  void profiler_listener::process_profiles(void)
+  void profiler_listener::process_profiles(unsigned int shard)
   {
-    if (!_initialized) {
+    profile_shard &my_shard = *(_shards[shard]);
+    if (!my_shard.initialized) {
       initialize_worker_thread_for_TAU();
-      _initialized = true;
+      my_shard.initialized = true;
     }
+    // the drain rate counter, and the task dependencies, are
+    // handled by a single consumer
+    profile_shard &rate_shard = shard_of(_drain_rate_id);
+    bool owns_rate = (&rate_shard == &my_shard);
+    auto last_nudge = std::chrono::steady_clock::now();
 #ifdef APEX_HAVE_TAU
     if (apex_options::use_tau()) {
       TAU_START("profiler_listener::process_profiles");
     }
 #endif
 
-    std::shared_ptr<profiler> p;
     task_dependency* td;
+    std::vector<profiler_record> batch;
     // Main loop. Stay in this loop unless "done".
 #ifndef APEX_HAVE_HPX3
     while (!_done) {
-      queue_signal.wait();
+      my_shard.queue_signal.wait();
 #endif
 #ifdef APEX_HAVE_TAU
       /*
@@ -840,29 +1377,50 @@ node_color * get_node_color(double v,double vmin,double vmax)
     }
     */
 #endif
-      while(!_done && thequeue.try_dequeue(p)) {
-        process_profile(p, 0);
+      size_t n;
+      auto busy_start = std::chrono::steady_clock::now();
+      // pause_consumers() waits for the drain to finish
+      _consumers_draining.fetch_add(1);
+      while(!_done && !_consumers_paused.load() &&
+            (n = drain_rings(shard, batch)) > 0) {
+        _drained += n;
       }
-      if (apex_options::use_taskgraph_output()) {
-        while(!_done && dependency_queue.try_dequeue(td)) {
-          process_dependency(td);
+      _consumers_draining.fetch_sub(1);
+      my_shard.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - busy_start).count();
+      /* Every second or so, record how fast we are draining events.
+       * If this doesn't keep up with the rate timers are stopped,
+       * the rings will fill. */
+      auto now = std::chrono::steady_clock::now();
+      if (!owns_rate) {
+        // make sure the owner wakes up to sample the rate
+        std::chrono::duration<double> since = now - last_nudge;
+        if (!_done && since.count() >= 1.0) {
+          rate_shard.queue_signal.post();
+          last_nudge = now;
         }
       }
-      /* 
-       * I want to process the tasks concurrently, but this loop
-       * is too much overhead. Maybe dequeue them in batches?
-       */
-      /*
-      std::vector<std::future<void>> pending_futures;
-      while(!_done && thequeue.try_dequeue(p)) {
-          auto f = std::async(my_stupid_wrapper,p);
-          // transfer the future's shared state to a longer-lived future
-          pending_futures.push_back(std::move(f));
+      std::chrono::duration<double> since = now - _last_rate_time;
+      if (owns_rate && !_done && since.count() >= 1.0) {
+        profiler_record r;
+        r.id = _drain_rate_id;
+        r.flags = APEX_RECORD_COUNTER;
+        r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+        r.value = (double)_drained.exchange(0) / since.count();
+        r.children = 0.0;
+#if APEX_HAVE_PAPI
+        for (int i = 0 ; i < 8 ; i++) { r.papi_deltas[i] = 0; }
+#endif
+        process_profile(&r, 1, 0);
+        sample_queue_health(since.count());
+        sample_lost_events();
+        _last_rate_time = now;
       }
-      for (auto iter = pending_futures.begin() ; iter < pending_futures.end() ; iter++ ) {
-          iter->get();
+      if (owns_rate && apex_options::use_taskgraph_output()) {
+        while(!_done && dependency_queue.try_dequeue(td)) {
+          process_dependency(td);
+        }
       }
-      */
 
 #ifdef APEX_HAVE_TAU
       /*
@@ -874,7 +1432,7 @@ node_color * get_node_color(double v,double vmin,double vmax)
 #ifndef APEX_HAVE_HPX3
     }
 
-    if (apex_options::use_taskgraph_output()) {
+    if (owns_rate && apex_options::use_taskgraph_output()) {
       // process the task dependencies
       while(dependency_queue.try_dequeue(td)) {
         process_dependency(td);
@@ -883,10 +1441,6 @@ node_color * get_node_color(double v,double vmin,double vmax)
  
 #endif // NOT DEFINED APEX_HAVE_HPX3
 
-#ifdef APEX_HAVE_HPX3
-    consumer_task_running.clear(memory_order_release);
-#endif
-
 #ifdef APEX_HAVE_TAU
     if (apex_options::use_tau()) {
       TAU_STOP("profiler_listener::process_profiles");
@@ -961,9 +1515,22 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
   void profiler_listener::on_startup(startup_event_data &data) {
     if (!_done) {
       my_tid = (unsigned int)thread_instance::get_id();
+      _drain_rate_id = task_identifier::get_task_id(string(APEX_CONSUMER_DRAIN_RATE))->id;
+      _queue_depth_id = task_identifier::get_task_id(string(APEX_QUEUE_DEPTH))->id;
+      _consumer_busy_id = task_identifier::get_task_id(string(APEX_CONSUMER_BUSY))->id;
+      _event_latency_id = task_identifier::get_task_id(string(APEX_EVENT_LATENCY))->id;
+      // calibrate the clock now, rather than when the first profile is read
+      profiler::get_cpu_mhz();
+      // before measuring the event cost, which includes reading the counters
+      _num_perf_metrics = perf_events::configure(apex_options::perf_metrics());
+      if (_throttle_timers) {
+        measure_event_cost();
+      }
 #ifndef APEX_HAVE_HPX3
-      // Start the consumer thread, to process profiler objects.
-      consumer_thread = new std::thread(process_profiles_wrapper);
+      // Start the consumer threads, to process profiler records.
+      for (unsigned int i = 0 ; i < _num_shards ; i++) {
+        _shards[i]->consumer_thread = new std::thread(consumer_thread_main, i);
+      }
 #endif
 
 #if APEX_HAVE_PAPI
@@ -978,7 +1545,7 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
       int retcode;
       int policy;
 
-      pthread_t threadID = (pthread_t) consumer_thread->native_handle();
+      pthread_t threadID = (pthread_t) _shards[0]->consumer_thread->native_handle();
 
       struct sched_param param;
 
@@ -1003,8 +1570,12 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
       }
 #endif
 
+      if (apex_options::profile_snapshot_period() > 0) {
+        _snapshot_thread = new std::thread(snapshot_thread_main);
+      }
+
       // time the whole application.
-      main_timer = std::make_shared<profiler>(new task_identifier(string(APEX_MAIN)));
+      main_timer = profiler_ptr(new profiler(task_identifier::get_task_id(string(APEX_MAIN))));
 #if APEX_HAVE_PAPI
       if (num_papi_counters > 0 && !apex_options::papi_suspend() && thread_papi_state == papi_running) {
         int rc = PAPI_read( EventSet, main_timer->papi_start_values );
@@ -1020,13 +1591,25 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
   void profiler_listener::on_shutdown(shutdown_event_data &data) {
     if (_done) { return; }
     if (!_done) {
-      _done = true;
+      {
+        // wake the snapshot thread, to stop
+        std::unique_lock<std::mutex> l(_snapshot_mutex);
+        _done = true;
+      }
+      _snapshot_cv.notify_all();
+      if (_snapshot_thread != nullptr) {
+        _snapshot_thread->join();
+      }
       node_id = data.node_id;
       //sleep(1);
 #ifndef APEX_HAVE_HPX3
-      queue_signal.post();
-      if (consumer_thread != nullptr) {
-          consumer_thread->join();
+      for (profile_shard * shard : _shards) {
+        shard->queue_signal.post();
+      }
+      for (profile_shard * shard : _shards) {
+        if (shard->consumer_thread != nullptr) {
+          shard->consumer_thread->join();
+        }
       }
 #endif
 
@@ -1038,19 +1621,35 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
         PAPI_ERROR_CHECK(PAPI_read);
       }
 #endif
+      record_lost_events();
       // if this profile is processed, it will get deleted. so don't process it!
       // It also clutters up the final profile, if generated.
       //process_profile(main_timer.get(), my_tid);
 
-      // output to screen?
-      if ((apex_options::use_screen_output() ||
-           apex_options::use_csv_output()) && node_id == 0)
-      {
-        size_t ignored = thequeue.size_approx();
+      /* Process whatever the consumers left on the rings, whatever the
+       * outputs: the profiles apex::get_profile() returns after finalize,
+       * and the last profile snapshot, need every event too. */
+      size_t ignored = 0;
+      for (unsigned int i = 0 ; i < _num_shards ; i++) {
+        for (profiler_ring * ring = profiler_ring::first(i) ;
+             ring != nullptr ; ring = ring->next()) {
+          ignored += ring->size_approx();
+        }
+      }
+      bool warn = (apex_options::use_screen_output() ||
+                   apex_options::use_csv_output()) && node_id == 0;
+      if (warn) {
+        if (_dropped_events > 0) {
+          std::cerr << "Warning: " << _dropped_events << " timer events were dropped because the event rings were full." << std::endl;
+        }
+        if (_sampled_events > 0) {
+          std::cerr << "Warning: " << _sampled_events << " timer events were skipped by the \"sample\" overflow policy." << std::endl;
+        }
         if (ignored > 0) {
           std::cerr << "Info: " << ignored << " items remaining on on the profiler_listener queue...";
         }
-        // We might be done, but check to make sure the queue is empty
+      }
+      {
         std::vector<std::future<bool>> pending_futures;
         for (unsigned int i=0; i<hardware_concurrency(); ++i) {
 #ifdef APEX_STATIC
@@ -1065,47 +1664,68 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
         for (auto iter = pending_futures.begin() ; iter < pending_futures.end() ; iter++ ) {
             iter->get();
         }
-        if (ignored > 0) {
+        if (warn && ignored > 0) {
           std::cerr << "done." << std::endl;
         }
-        if (apex_options::use_screen_output() || apex_options::use_csv_output()) {
-            finalize_profiles();
+      }
+      // fold in the profiles the threads aggregated themselves, and
+      // the profiles from each shard
+      gather_profiles();
+      bool screen_output = (apex_options::use_screen_output() ||
+                            apex_options::use_csv_output()) && node_id == 0;
+      bool taskgraph_output = apex_options::use_taskgraph_output() && node_id == 0;
+      // output to 1 TAU profile per process?
+      bool profile_output = apex_options::use_profile_output() && !apex_options::use_tau();
+      // count the threads before the pipeline starts threads of its own
+      _num_worker_threads = thread_instance::get_num_threads();
+      if (screen_output) {
+        // the screen output shows at least one call for each profile
+        for (auto &it : task_map) {
+          if (it.second->get_calls() < 1) {
+            it.second->get_profile()->calls = 1;
+          }
         }
       }
-      if (apex_options::use_taskgraph_output() && node_id == 0)
-      {
-        write_taskgraph();
+      if (screen_output || taskgraph_output || profile_output ||
+          apex_options::use_binary_output() || apex_options::task_scatterplot()) {
+        std::vector<uint32_t> ids;
+        ids.reserve(task_map.size());
+        for (auto &it : task_map) {
+          ids.push_back(it.first);
+        }
+        if (taskgraph_output) {
+          for (auto &dep : task_dependencies) {
+            if (task_map.find(dep.first) == nullptr) {
+              ids.push_back(dep.first);
+            }
+          }
+        }
+        finalize_pipeline::resolve_names(ids);
       }
-
-      // output to 1 TAU profile per process?
-      if (apex_options::use_profile_output() && !apex_options::use_tau()) {
-        write_profile();
+      // The files are written together, by apex::finalize(), once every
+      // listener has been told; see finalize_pipeline.hpp.
+      if (screen_output) {
+        finalize_pipeline::add_output("screen and CSV output", [this]() { finalize_profiles(); });
+      }
+      // the rest of the run, so that the snapshots add up to the profile
+      if (_snapshot_thread != nullptr) {
+        finalize_pipeline::add_output("last profile snapshot", [this]() { write_profile_snapshot(); });
+      }
+      if (taskgraph_output) {
+        finalize_pipeline::add_output("task graph", [this]() { write_taskgraph(); });
+      }
+      if (profile_output) {
+        finalize_pipeline::add_output("TAU profile", [this]() { write_profile(); });
+      }
+      if (apex_options::use_binary_output()) {
+        finalize_pipeline::add_output("binary profile", [this]() { write_binary_profile(); });
       }
       if (apex_options::task_scatterplot()) {
-          // get the length of the stream
-          int loc0 = task_scatterplot_samples.tellp();
-          // lock access to the file
-          // write using low-level file locking!
-          struct flock fl;
-          fl.l_type   = F_WRLCK;  /* F_RDLCK, F_WRLCK, F_UNLCK    */
-          fl.l_whence = SEEK_SET; /* SEEK_SET, SEEK_CUR, SEEK_END */
-          fl.l_start  = 0;        /* Offset from l_whence         */
-          fl.l_len    = 0;        /* length, 0 = to EOF           */
-          fl.l_pid    = getpid();      /* our PID                      */
-          fcntl(task_scatterplot_sample_file, F_SETLKW, &fl);  /* F_GETLK, F_SETLK, F_SETLKW */
-          // flush the string stream to the file
-          //lseek(task_scatterplot_sample_file, 0, SEEK_END);
-          ssize_t bytes_written = write(task_scatterplot_sample_file, 
-                task_scatterplot_samples.str().c_str(), loc0);
-          if (bytes_written < 0) {
-              int errsv = errno;
-              perror("Error writing to scatterplot!");
-              fprintf(stderr, "Error writing scatterplot:\n%s\n",
-                      strerror(errsv));
-          }
-          fl.l_type   = F_UNLCK;   /* tell it to unlock the region */
-          fcntl(task_scatterplot_sample_file, F_SETLK, &fl); /* set the region to unlocked */
-          close(task_scatterplot_sample_file);
+        finalize_pipeline::add_output("task samples", [this]() {
+          std::stringstream filename;
+          filename << "apex_task_samples." << node_id << "." << getpid() << ".bin";
+          task_sampler::write(filename.str(), node_id);
+        });
       }
 
     }
@@ -1145,28 +1765,48 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
 
   extern "C" int main (int, char**);
 
+  /* A cheap per-thread random number, to choose which calls of a throttled
+   * timer to measure */
+  static APEX_NATIVE_TLS uint32_t _throttle_seed = 0;
+  static inline uint32_t throttle_random(void) {
+    uint32_t x = _throttle_seed;
+    if (x == 0) {
+      x = (uint32_t)(uintptr_t)(&_throttle_seed) | 1;
+    }
+    // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    _throttle_seed = x;
+    return x;
+  }
+
   /* When a start event happens, create a profiler object. Unless this
    * named event is throttled, in which case do nothing, as quickly as possible */
   inline bool profiler_listener::_common_start(task_identifier * id, bool is_resume) {
     if (!_done) {
-#if defined(APEX_THROTTLE)
-      // if this timer is throttled, return without doing anything
-      throttled_event_set_mutex.lock();
-      unordered_set<task_identifier>::const_iterator it = throttled_tasks.find(*id);
-      throttled_event_set_mutex.unlock();
-      if (it != throttled_tasks.end()) {
+      uint32_t period = 1;
+      if (_throttle_timers) {
+        // if this timer is throttled, only measure 1 in period calls,
+        // and return without doing anything for the others
+        period = id->throttle_period.load(std::memory_order_relaxed);
+        if (period > 1 && (throttle_random() & (period - 1)) != 0) {
           /*
            * The throw is removed, because it is a performance penalty on some systems
            * on_start now returns a boolean
            */
-        //throw disabled_profiler_exception(); // to be caught by apex::start/resume
-        return false;
+          //throw disabled_profiler_exception(); // to be caught by apex::start/resume
+          return false;
+        }
       }
-#endif
       // start the profiler object, which starts our timers
       //std::shared_ptr<profiler> p = std::make_shared<profiler>(id, is_resume);
       profiler * p = new profiler(id, is_resume);
+      p->weight = period;
       thread_instance::instance().set_current_profiler(p);
+      if (_num_perf_metrics > 0) {
+          p->perf_start_values = perf_events::start();
+      }
 #if APEX_HAVE_PAPI
       if (num_papi_counters > 0 && !apex_options::papi_suspend()) {
           // if papi was previously suspended, we need to start the counters
@@ -1193,27 +1833,169 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
     return true;
   }
 
-  inline void profiler_listener::push_profiler(int my_tid, std::shared_ptr<profiler> &p) {
-      // we have to make a local copy, because lockfree queues DO NOT SUPPORT shared_ptrs!
-      bool worked = thequeue.enqueue(p);
-      if (!worked) {
-          static std::atomic<bool> issued(false);
-          if (!issued) {
-              issued = true;
-              cout << "APEX Warning : failed to push " << p->task_id->get_name() << endl;
-              cout << "One or more frequently-called, lightweight functions is being timed." << endl;
+  /* Account for an event lost to a full ring, by timer and in total */
+  void profiler_listener::count_lost_event(uint32_t id, bool sampled) {
+      task_identifier * task_id = task_identifier::from_id(id);
+      if (sampled) {
+          if (task_id != nullptr) {
+              task_id->sampled_events.fetch_add(1, std::memory_order_relaxed);
           }
+          _sampled_events.fetch_add(1, std::memory_order_relaxed);
+          return;
+      }
+      if (task_id != nullptr) {
+          task_id->dropped_events.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (_dropped_events.fetch_add(1, std::memory_order_relaxed) == 0 && !_done) {
+          cout << "APEX Warning : failed to push " << (task_id != nullptr ? task_id->get_name() : string("")) << endl;
+          cout << "One or more frequently-called, lightweight functions is being timed." << endl;
+      }
+  }
+
+  /* Record a counter sample from a consumer thread. The counter may belong
+   * to another consumer's shard, so the sample goes through this thread's
+   * ring for that shard. A consumer must not wait for room in its own
+   * ring, so the sample is skipped if the ring is full. */
+  void profiler_listener::push_counter(uint32_t id, double value) {
+      profiler_record r;
+      r.id = id;
+      r.flags = APEX_RECORD_COUNTER;
+      r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+      r.value = value;
+      r.children = 0.0;
+#if APEX_HAVE_PAPI
+      for (int i = 0 ; i < 8 ; i++) { r.papi_deltas[i] = 0; }
+#endif
+      profiler_ring::get_thread_ring(id % _num_shards, _ring_capacity)->push(r);
+  }
+
+  /* Once any events have been lost, sample how many were lost since the
+   * last call. */
+  void profiler_listener::sample_lost_events(void) {
+      uint64_t dropped = _dropped_events.load(std::memory_order_relaxed);
+      uint64_t sampled = _sampled_events.load(std::memory_order_relaxed);
+      if (dropped == 0 && sampled == 0) { return; }
+      push_counter(task_identifier::get_task_id(string(APEX_DROPPED_EVENTS))->id,
+                   (double)(dropped - _last_dropped_events));
+      push_counter(task_identifier::get_task_id(string(APEX_SAMPLED_EVENTS))->id,
+                   (double)(sampled - _last_sampled_events));
+      _last_dropped_events = dropped;
+      _last_sampled_events = sampled;
+  }
+
+  /* Sample the queue depth high-water mark, the consumers' busy fraction
+   * and the longest event latency over the last "since" seconds, so that
+   * policies can watch them with get_profile(). Called by the consumer
+   * that owns the drain rate counter. */
+  void profiler_listener::sample_queue_health(double since) {
+      size_t depth = 0;
+      uint64_t busy_ns = 0;
+      uint64_t latency = 0;
+      for (auto shard : _shards) {
+          depth += shard->max_depth.exchange(0, std::memory_order_relaxed);
+          busy_ns += shard->busy_ns.load(std::memory_order_relaxed);
+          latency = std::max(latency, shard->max_latency.exchange(0, std::memory_order_relaxed));
       }
+      double busy = (double)(busy_ns - _last_busy_ns) / (since * 1.0e9 * _num_shards);
+      _last_busy_ns = busy_ns;
+      push_counter(_queue_depth_id, (double)depth);
+      push_counter(_consumer_busy_id, std::min(busy, 1.0));
+      push_counter(_event_latency_id, (double)latency * profiler::get_cpu_mhz());
+  }
+
+  /* At shutdown, add a counter with the number of lost events for each
+   * timer that lost any, so they show up in the final profile. */
+  void profiler_listener::record_lost_events(void) {
+      if (_dropped_events == 0 && _sampled_events == 0) { return; }
+      profiler_record r;
+      r.flags = APEX_RECORD_COUNTER;
+      r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+      r.children = 0.0;
+#if APEX_HAVE_PAPI
+      for (int i = 0 ; i < 8 ; i++) { r.papi_deltas[i] = 0; }
+#endif
+      uint32_t num_ids = task_identifier::get_num_task_ids();
+      for (uint32_t id = 0 ; id < num_ids ; id++) {
+          task_identifier * task_id = task_identifier::from_id(id);
+          if (task_id == nullptr) { continue; }
+          uint64_t dropped = task_id->dropped_events.load(std::memory_order_relaxed);
+          uint64_t sampled = task_id->sampled_events.load(std::memory_order_relaxed);
+          if (dropped > 0) {
+              r.id = task_identifier::get_task_id(string(APEX_DROPPED_EVENTS) +
+                     " : " + task_id->get_name())->id;
+              r.value = (double)dropped;
+              process_profile(&r, 1, 0);
+          }
+          if (sampled > 0) {
+              r.id = task_identifier::get_task_id(string(APEX_SAMPLED_EVENTS) +
+                     " : " + task_id->get_name())->id;
+              r.value = (double)sampled;
+              process_profile(&r, 1, 0);
+          }
+      }
+  }
+
+  inline void profiler_listener::push_profiler(int my_tid, profiler_record &r) {
+      APEX_UNUSED(my_tid);
+      // each timer ID is processed by exactly one consumer
+      unsigned int shard = r.id % _num_shards;
+      profiler_ring * ring = profiler_ring::get_thread_ring(shard, _ring_capacity);
+      // resets are never dropped, whatever the overflow policy
+      bool reset = (r.flags & (APEX_RECORD_RESET | APEX_RECORD_RESET_ALL)) != 0;
+      if (_overflow_policy == overflow_sample && !reset && !ring->sample_keep()) {
+          count_lost_event(r.id, true);
+          return;
+      }
+      bool waited = false;
+      std::chrono::steady_clock::time_point give_up;
+      while (!ring->push(r)) {
+          if (_overflow_policy == overflow_drop_oldest && !reset) {
+              profiler_record oldest;
+              if (ring->pop_oldest(oldest)) {
+                  count_lost_event(oldest.id, false);
+              } else {
+                  // the consumer is draining this ring, so there will be room
+                  std::this_thread::yield();
+              }
+              continue;
+          }
+          if (_overflow_policy == overflow_sample) {
+              // keep fewer events until the consumer catches up
+              ring->sample_less();
+          }
+          bool wait = (_overflow_policy == overflow_block || reset) && !_done;
+          if (wait && !reset && _overflow_timeout.count() > 0) {
+              auto now = std::chrono::steady_clock::now();
+              if (!waited) {
+                  waited = true;
+                  give_up = now + _overflow_timeout;
+              } else if (now >= give_up) {
+                  wait = false;
+              }
+          }
+          if (!wait) {
+              count_lost_event(r.id, false);
+#ifdef APEX_HAVE_HPX3
+              apex_schedule_process_profiles();
+#endif
+              return;
+          }
 #ifndef APEX_HAVE_HPX3
-      queue_signal.post();
+          // The ring is full, wake the consumer and wait for room.
+          _shards[shard]->queue_signal.post();
+          std::this_thread::yield();
+#endif
+      }
+#ifndef APEX_HAVE_HPX3
+      _shards[shard]->queue_signal.post();
 #endif
 #ifdef APEX_HAVE_HPX3
       apex_schedule_process_profiles();
 #endif
   }
 
-  /* Stop the timer, if applicable, and queue the profiler object */
-  inline void profiler_listener::_common_stop(std::shared_ptr<profiler> &p, bool is_yield) {
+  /* Stop the timer, if applicable, and queue a record of it */
+  inline void profiler_listener::_common_stop(profiler_ptr &p, bool is_yield) {
     if (!_done) {
       if (p) {
         p->stop(is_yield);
@@ -1223,6 +2005,31 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
             PAPI_ERROR_CHECK(PAPI_read);
         }
 #endif
+        if (p->perf_start_values != nullptr) {
+            perf_events::stop(p->task_id->id, p->perf_start_values, p->weight);
+            p->perf_start_values = nullptr;
+        }
+        // the path to this timer, if call paths are measured
+        task_identifier * path_id = nullptr;
+        if (_callpath_depth > 0) {
+            uint32_t path[APEX_MAX_CALLPATH_DEPTH];
+            size_t depth = thread_instance::get_callpath(p.get(), path, _callpath_depth);
+            if (depth > 1) {
+                path_id = callpath::get_callpath_id(path, depth);
+            }
+        }
+        // charge this timer's time to the one it was started inside
+        profiler * parent = thread_instance::pop_current_profiler(p.get());
+        if (parent != nullptr) {
+            parent->children_value += p->elapsed();
+        }
+        if (_thread_local_aggregation) {
+            aggregate_locally(p, p->task_id->id);
+            if (path_id != nullptr) {
+                aggregate_locally(p, path_id->id);
+            }
+            return;
+        }
         // Why is this happening now?  Why not at start? Why not at create?
         /*
         if (apex_options::use_taskgraph_output()) {
@@ -1240,7 +2047,31 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
           }
         }
         */
-        push_profiler(my_tid, p);
+        profiler_record r;
+        r.id = p->task_id->id;
+        r.flags = p->is_resume ? APEX_RECORD_RESUME : 0;
+        r.start = p->start.time_since_epoch().count();
+        r.end = p->end.time_since_epoch().count();
+        r.value = 0.0;
+        r.children = p->children_value;
+        if (p->weight > 1) {
+            r.flags |= APEX_RECORD_SAMPLED;
+            r.value = (double)p->weight;
+        }
+#if APEX_HAVE_PAPI
+        for (int i = 0 ; i < 8 ; i++) {
+            if (p->papi_stop_values[i] > p->papi_start_values[i]) {
+                r.papi_deltas[i] = p->papi_stop_values[i] - p->papi_start_values[i];
+            } else {
+                r.papi_deltas[i] = 0;
+            }
+        }
+#endif
+        push_profiler(my_tid, r);
+        if (path_id != nullptr) {
+            r.id = path_id->id;
+            push_profiler(my_tid, r);
+        }
       }
     }
   }
@@ -1257,12 +2088,12 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
   }
 
    /* Stop the timer */
-  void profiler_listener::on_stop(std::shared_ptr<profiler> &p) {
+  void profiler_listener::on_stop(profiler_ptr &p) {
     _common_stop(p, p->is_resume); // don't change the yield/resume value!
   }
 
   /* Stop the timer, but don't increment the number of calls */
-  void profiler_listener::on_yield(std::shared_ptr<profiler> &p) {
+  void profiler_listener::on_yield(profiler_ptr &p) {
     _common_stop(p, true);
   }
 
@@ -1271,12 +2102,23 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
     APEX_UNUSED(data);
   }
 
-  /* When a sample value is processed, save it as a profiler object, and queue it. */
+  /* When a sample value is processed, save it as a record, and queue it. */
   void profiler_listener::on_sample_value(sample_value_event_data &data) {
     if (!_done) {
-      std::shared_ptr<profiler> p = std::make_shared<profiler>(new task_identifier(*data.counter_name), data.counter_value);
-      p->is_counter = data.is_counter;
-      push_profiler(my_tid, p);
+      profiler_record r;
+      task_identifier * id = data.counter_id;
+      if (id == nullptr) {
+        id = task_identifier::get_task_id(*data.counter_name);
+      }
+      r.id = id->id;
+      r.flags = data.is_counter ? APEX_RECORD_COUNTER : 0;
+      r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+      r.value = data.counter_value;
+      r.children = 0.0;
+#if APEX_HAVE_PAPI
+      for (int i = 0 ; i < 8 ; i++) { r.papi_deltas[i] = 0; }
+#endif
+      push_profiler(my_tid, r);
     }
   }
 
@@ -1288,7 +2130,7 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
     if (p != NULL) {
         dependency_queue.enqueue(new task_dependency(p->task_id, id));
     } else {
-        task_identifier * parent = new task_identifier(string("__start"));
+        task_identifier * parent = task_identifier::get_task_id(string("__start"));
         dependency_queue.enqueue(new task_dependency(parent, id));
     }
   }
@@ -1296,6 +2138,9 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
   /* For periodic stuff. Do something? */
   void profiler_listener::on_periodic(periodic_event_data &data) {
     if (!_done) {
+      if (_thread_local_aggregation) {
+        merge_thread_profiles();
+      }
     }
     APEX_UNUSED(data);
   }
@@ -1308,18 +2153,43 @@ if (rc != 0) cout << "name: " << rc << ": " << PAPI_strerror(rc) << endl;
   }
 
   void profiler_listener::reset(task_identifier * id) {
-    std::shared_ptr<profiler> p;
-    p = std::make_shared<profiler>(id, false, reset_type::CURRENT);
-    push_profiler(my_tid, p);
+    if (_thread_local_aggregation) {
+      // reset now, after folding in what the threads have measured so far,
+      // holding the lock the merges and the consumer update it under
+      merge_thread_profiles();
+      profile_shard &shard = shard_of(id->id);
+      std::unique_lock<std::mutex> task_map_lock(shard.task_map_mutex);
+      profile * p = shard.task_map.find(id->id);
+      if (p != nullptr) {
+        p->reset();
+      }
+      id->throttle_period.store(1, std::memory_order_relaxed);
+      return;
+    }
+    profiler_record r;
+    r.id = id->id;
+    r.flags = APEX_RECORD_RESET;
+    // the consumer orders records for the same ID by their end time
+    r.start = r.end = MYCLOCK::now().time_since_epoch().count();
+    r.value = 0.0;
+    r.children = 0.0;
+#if APEX_HAVE_PAPI
+    for (int i = 0 ; i < 8 ; i++) { r.papi_deltas[i] = 0; }
+#endif
+    push_profiler(my_tid, r);
   }
 
   profiler_listener::~profiler_listener (void) { 
       _done = true; // yikes!
       finalize();
       delete_profiles();
+      for (profile_shard * shard : _shards) {
 #ifndef APEX_HAVE_HPX3
-      delete consumer_thread;
+        delete shard->consumer_thread;
 #endif
+        delete shard;
+      }
+      _shards.clear();
   };
 
 }
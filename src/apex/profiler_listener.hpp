@@ -17,12 +17,21 @@
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #ifdef APEX_HAVE_HPX3
 #include <boost/thread.hpp>
 #endif
 
 #include "profile.hpp"
+#include "profile_table.hpp"
+#include "profiler_pool.hpp"
+#include "profiler_ring.hpp"
 #include "thread_instance.hpp"
+#include "output_buffer.hpp"
 #include <fstream>
 
 // These two are needed by concurrent queue - not defined by Intel Mic support.
@@ -37,77 +46,197 @@
 #include "semaphore.hpp"
 #include "task_identifier.hpp"
 #include "task_dependency.hpp"
+#include "callpath.hpp"
+#include "task_sampler.hpp"
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
 
 #define INITIAL_NUM_THREADS 2
+// the most records the consumer takes from one ring before moving on
+#define APEX_RING_SLICE 256
+// the most records the consumer processes at once
+#define APEX_CONSUMER_BATCH 4096
 
 namespace apex {
 
-class profiler_queue_t : public moodycamel::ConcurrentQueue<std::shared_ptr<profiler> > { 
+/* With APEX_AGGREGATION=thread_local, each thread updates its own profiles
+ * when timers stop, instead of queueing the events for the consumer. The
+ * tables are merged into the task_map on demand. The lock is only
+ * contended while a merge is in progress. */
+class thread_profile_table {
+private:
+  std::atomic<bool> _lock;
 public:
-  profiler_queue_t() {}
-  virtual ~profiler_queue_t() {
-      finalize();
+  // indexed by the dense ID of the interned task_identifier
+  std::vector<profile*> profiles;
+  thread_profile_table * next;        // the list of all tables
+  thread_profile_table * next_orphan; // the list of tables released by exited threads
+  thread_profile_table(void) : _lock(false), profiles(), next(nullptr),
+    next_orphan(nullptr) {};
+  void lock(void) {
+    while (_lock.exchange(true, std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
   }
+  void unlock(void) { _lock.store(false, std::memory_order_release); }
+};
+
+/* What push_profiler does when a thread's event ring is full
+ * (APEX_OVERFLOW_POLICY) */
+enum overflow_policy {
+  overflow_block,       // wait for the consumer (up to APEX_OVERFLOW_TIMEOUT)
+  overflow_drop_newest, // drop the new event
+  overflow_drop_oldest, // drop the oldest event in the ring
+  overflow_sample       // keep 1 in N events while the ring is under pressure
 };
 
-static const char * task_scatterplot_sample_filename = "apex_task_samples.csv";
+/* One consumer's share of the profiles. Each timer ID belongs to one
+ * shard (see profiler_listener::shard_of), and only that shard's consumer
+ * updates its profiles, so the consumers never contend for them. */
+class profile_shard {
+public:
+  // profiles, keyed by the dense ID of the interned task_identifier
+  profile_table task_map;
+  std::mutex task_map_mutex;
+  semaphore queue_signal;
+#ifndef APEX_HAVE_HPX3
+  std::thread * consumer_thread;
+#endif
+  bool initialized;
+  // queue health, for the counters sampled by the drain rate owner
+  std::atomic<uint64_t> busy_ns;     // time spent processing events
+  std::atomic<size_t> max_depth;     // most events seen waiting, since the last sample
+  std::atomic<uint64_t> max_latency; // longest wait of an event, in clock ticks
+  profile_shard(void) : task_map(),
+#ifndef APEX_HAVE_HPX3
+    consumer_thread(nullptr),
+#endif
+    initialized(false), busy_ns(0), max_depth(0), max_latency(0) {};
+};
 
 class profiler_listener : public event_listener {
 private:
   void _init(void);
-  bool _initialized;
   std::atomic<bool> _done;
   std::atomic<int> active_tasks;
-  std::shared_ptr<profiler> main_timer; // not a shared pointer, yet...
+  profiler_ptr main_timer; // not a shared pointer, yet...
   void write_one_timer(task_identifier &task_id, profile * p,
-                       std::stringstream &screen_output, std::stringstream &csv_output,
+                       output_buffer &screen_output, output_buffer &csv_output,
                        double &total_accumulated, double &total_main);
   void finalize_profiles(void);
   void write_taskgraph(void);
   void write_profile(void);
+  void write_binary_profile(void);
   void delete_profiles(void);
 #ifdef APEX_HAVE_HPX3
   void schedule_process_profiles(void);
 #endif
-  unsigned int process_profile(std::shared_ptr<profiler> &p, unsigned int tid);
+  unsigned int process_profile(const profiler_record *records, size_t count, unsigned int tid);
+  void process_batch(profiler_record *records, size_t count);
+  size_t drain_rings(unsigned int shard, std::vector<profiler_record> &batch);
   unsigned int process_profile(profiler* p, unsigned int tid);
   unsigned int process_dependency(task_dependency* td);
   int node_id;
   std::mutex _mtx;
   bool _common_start(task_identifier * id, bool is_resume); // internal, inline function
-  void _common_stop(std::shared_ptr<profiler> &p, bool is_yield); // internal, inline function
-  void push_profiler(int my_tid, std::shared_ptr<profiler> &p);
-  std::unordered_map<task_identifier, profile*> task_map;
-  std::mutex _task_map_mutex;
-  std::unordered_map<task_identifier, std::unordered_map<task_identifier, int>* > task_dependencies;
-  /* The profiler queue */
-  profiler_queue_t thequeue;
+  void _common_stop(profiler_ptr &p, bool is_yield); // internal, inline function
+  void push_profiler(int my_tid, profiler_record &r);
+  /* overflow handling */
+  overflow_policy _overflow_policy;
+  std::chrono::microseconds _overflow_timeout;
+  std::atomic<uint64_t> _dropped_events;
+  std::atomic<uint64_t> _sampled_events;
+  std::atomic<bool> _consumers_paused;
+  std::atomic<int> _consumers_draining;
+  uint64_t _last_dropped_events;
+  uint64_t _last_sampled_events;
+  void count_lost_event(uint32_t id, bool sampled);
+  void sample_lost_events(void);
+  void sample_queue_health(double since);
+  void push_counter(uint32_t id, double value);
+  void record_lost_events(void);
+  bool _thread_local_aggregation;
+  void aggregate_locally(profiler_ptr &p, uint32_t id);
+  void merge_thread_profiles(void);
+  /* timer throttling */
+  bool _throttle_timers;
+  double _throttle_budget;
+  double _throttle_event_cost;
+  void measure_event_cost(void);
+  void check_throttle(uint32_t id, profile * theprofile);
+  /* The consumer shards */
+  unsigned int _num_shards;
+  std::vector<profile_shard*> _shards;
+  profile_shard& shard_of(uint32_t id) { return *(_shards[id % _num_shards]); }
+  void reset_shard(profile_shard &shard);
+  size_t _ring_capacity;
+  profile * find_profile(uint32_t id);
+  void gather_profiles(void);
+  /* All the profiles, gathered from the shards at shutdown for output,
+   * keyed by the dense ID of the interned task_identifier */
+  profile_table task_map;
+  std::unordered_map<uint32_t, std::unordered_map<uint32_t, int>* > task_dependencies;
   /* The task dependency queue */
   moodycamel::ConcurrentQueue<task_dependency*> dependency_queue;
-#if defined(APEX_THROTTLE)
-  std::unordered_set<task_identifier> throttled_tasks;
-#endif
 #if APEX_HAVE_PAPI
   int num_papi_counters;
   std::vector<int> event_sets;
   std::vector<std::string> metric_names;
   void initialize_PAPI(bool first_time);
 #endif
-#ifdef APEX_HAVE_HPX3
-  boost::thread * consumer_thread;
-#else
-  std::thread * consumer_thread;
-#endif
-  semaphore queue_signal;
-  //std::ofstream task_scatterplot_sample_file;
-  int task_scatterplot_sample_file;
-  std::stringstream task_scatterplot_samples;
+  // for the consumer drain rate counter
+  uint32_t _drain_rate_id;
+  std::atomic<size_t> _drained;
+  std::chrono::steady_clock::time_point _last_rate_time;
+  // and the other queue health counters
+  uint32_t _queue_depth_id;
+  uint32_t _consumer_busy_id;
+  uint32_t _event_latency_id;
+  uint64_t _last_busy_ns;
+  // the perf_event_open counters, see perf_events.hpp
+  size_t _num_perf_metrics;
+  std::vector<double> _perf_totals;
+  // how many timers deep to measure call paths, see callpath.hpp
+  size_t _callpath_depth;
+  void write_callpath_tree(output_buffer &screen_output);
+  /* the threads seen before the output threads were started */
+  int _num_worker_threads;
+  /* periodic profile snapshots (APEX_PROFILE_SNAPSHOT_PERIOD), written by
+   * a thread of their own */
+  std::thread * _snapshot_thread;
+  std::mutex _snapshot_mutex;
+  std::condition_variable _snapshot_cv;
+  uint64_t _snapshot_sequence;
+  std::chrono::steady_clock::time_point _last_snapshot_time;
+  // the profiles as of the last snapshot, to take the differences from
+  std::unordered_map<uint32_t, apex_profile> _last_snapshots;
+  static void snapshot_thread_main(void);
+  void write_profile_snapshot(void);
 public:
-  profiler_listener (void) : _initialized(false), _done(false), node_id(0), task_map()
+  profiler_listener (void) : _done(false), node_id(0),
+                             _overflow_policy(overflow_block),
+                             _overflow_timeout(apex_options::overflow_timeout()),
+                             _dropped_events(0), _sampled_events(0),
+                             _consumers_paused(false), _consumers_draining(0),
+                             _last_dropped_events(0), _last_sampled_events(0),
+                             _thread_local_aggregation(false),
+                             _throttle_timers(apex_options::throttle_timers()),
+                             _throttle_budget(apex_options::throttle_overhead() / 100.0),
+                             _throttle_event_cost(0.0), _num_shards(1),
+                             _shards(), _ring_capacity(1), task_map(),
+                             _drain_rate_id(0), _drained(0),
+                             _last_rate_time(std::chrono::steady_clock::now()),
+                             _queue_depth_id(0), _consumer_busy_id(0),
+                             _event_latency_id(0), _last_busy_ns(0),
+                             _num_perf_metrics(0), _perf_totals(),
+                             _callpath_depth(std::min<size_t>(
+                                 std::max(apex_options::callpath_depth(), 0),
+                                 APEX_MAX_CALLPATH_DEPTH)),
+                             _num_worker_threads(0),
+                             _snapshot_thread(nullptr), _snapshot_sequence(0),
+                             _last_snapshot_time(std::chrono::steady_clock::now())
 #if APEX_HAVE_PAPI
                              , num_papi_counters(0), event_sets(8), metric_names(0)
 #endif
@@ -115,44 +244,56 @@ public:
 #if APEX_HAVE_PAPI
       num_papi_counters = 0;
 #endif
+      std::string aggregation(apex_options::aggregation());
+      if (aggregation == "thread_local") {
+        _thread_local_aggregation = true;
+      } else if (aggregation != "consumer") {
+        std::cerr << "APEX Warning : unknown APEX_AGGREGATION value \""
+                  << aggregation << "\", using \"consumer\"." << std::endl;
+      }
+      std::string policy(apex_options::overflow_policy());
+      if (policy == "drop_newest") {
+        _overflow_policy = overflow_drop_newest;
+      } else if (policy == "drop_oldest") {
+        _overflow_policy = overflow_drop_oldest;
+      } else if (policy == "sample") {
+        _overflow_policy = overflow_sample;
+      } else if (policy != "block") {
+        std::cerr << "APEX Warning : unknown APEX_OVERFLOW_POLICY value \""
+                  << policy << "\", using \"block\"." << std::endl;
+      }
+      // throttling can lead to overlapping timer errors in TAU
+      if (apex_options::use_tau()) {
+        _throttle_timers = false;
+      }
+      if (_throttle_budget <= 0.0) {
+        _throttle_budget = 0.01;
+      }
+#ifdef APEX_HAVE_HPX3
+      // HPX worker threads can't wait for the consumer task
+      if (_overflow_policy == overflow_block) {
+        _overflow_policy = overflow_drop_newest;
+      }
+#endif
+      // 0 means one consumer for every 32 hardware threads
+      int num_consumers = apex_options::num_consumers();
+      if (num_consumers <= 0) {
+        num_consumers = std::thread::hardware_concurrency() / 32;
+      }
+      _num_shards = std::max(1, std::min(num_consumers, APEX_MAX_CONSUMERS));
+      for (unsigned int i = 0 ; i < _num_shards ; i++) {
+        _shards.push_back(new profile_shard());
+      }
+      // each thread's ring memory is split between the shards
+      _ring_capacity = std::max(apex_options::event_ring_size() / (int)_num_shards, 1);
       if (apex_options::task_scatterplot()) {
-        // check if the samples file exists
-        struct stat buffer;
-        if (stat (task_scatterplot_sample_filename, &buffer) == 0) {
-            struct tm *timeinfo = localtime(&buffer.st_mtime);
-            time_t filetime = mktime(timeinfo);
-            time_t nowish;
-            time(&nowish);
-            double seconds = difftime(nowish, filetime);
-            /* if the file exists, was it recently created? */
-            if (seconds > 10) {
-                /* create the file */
-                std::ofstream tmp;
-				tmp.open(task_scatterplot_sample_filename);
-        		tmp << "#timestamp value   name" << std::endl << std::flush;
-				/* yes, close the file because we will use some
-				   low-level calls to have concurrent access
-                   across processes/threads. */
-				tmp.close();
-            }
-		} else {
-            /* create the file */
-            std::ofstream tmp;
-			tmp.open(task_scatterplot_sample_filename);
-        	tmp << "#timestamp value   name" << std::endl << std::flush;
-			/* yes, close the file because we will use some
-			low-level calls to have concurrent access
-            across processes/threads. */
-			tmp.close();
-        }
-		// open the file
-		task_scatterplot_sample_file = open(task_scatterplot_sample_filename, O_APPEND | O_WRONLY );
-        if (task_scatterplot_sample_file < 0) { perror("opening scatterplot sample file"); }
-		assert(task_scatterplot_sample_file >= 0);
+        task_sampler::configure(std::max(apex_options::task_scatterplot_samples(), 0));
         profiler::get_global_start();
       }
   };
   ~profiler_listener (void);
+  uint32_t interest(void) { return APEX_INTEREST_TIMERS |
+      APEX_INTEREST_NEW_TASK | APEX_INTEREST_SAMPLE_VALUE; }
   // events
   void on_startup(startup_event_data &data);
   void on_shutdown(shutdown_event_data &data);
@@ -160,8 +301,8 @@ public:
   void on_new_thread(new_thread_event_data &data);
   void on_exit_thread(event_data &data);
   bool on_start(task_identifier *id);
-  void on_stop(std::shared_ptr<profiler> &p);
-  void on_yield(std::shared_ptr<profiler> &p);
+  void on_stop(profiler_ptr &p);
+  void on_yield(profiler_ptr &p);
   bool on_resume(task_identifier * id);
   void on_new_task(task_identifier * id, uint64_t task_id);
   void on_sample_value(sample_value_event_data &data);
@@ -172,15 +313,26 @@ public:
   // other methods
   void reset(task_identifier * id);
   void reset_all(void);
-  profile * get_profile(task_identifier &id);
+  profile * get_profile(task_identifier * id);
+  bool get_profile_snapshot(task_identifier * id, apex_profile &snapshot);
+  void get_profile_snapshots(std::vector<std::pair<task_identifier*, apex_profile> > &snapshots);
   double get_non_idle_time(void);
   profile * get_idle_time(void);
   profile * get_idle_rate(void);
   //std::vector<std::string> get_available_profiles();
-  void process_profiles(void);
+  void process_profiles(unsigned int shard);
   static void process_profiles_wrapper(void);
-  void public_process_profile(std::shared_ptr<profiler> &p) { process_profile(p,0); };
+#ifndef APEX_HAVE_HPX3
+  static void consumer_thread_main(unsigned int shard);
+#endif
+  void public_process_profile(const profiler_record &r) { process_profile(&r,1,0); };
   bool concurrent_cleanup(void);
+  /* Keep the consumers from draining the rings until they are resumed,
+   * so that the overflow policies can be tested. Pausing waits for any
+   * drain in progress to finish. Shutdown drains the rings anyway. */
+  void pause_consumers(bool paused);
+  /* Release this thread's profile table so another thread can adopt it. */
+  static void release_thread_profiles(void);
 };
 
 }
@@ -0,0 +1,149 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "profiler_pool.hpp"
+#include "profiler.hpp"
+#include "apex_types.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+namespace apex {
+
+/* Every object handed out by the pool is preceded by this header. */
+struct profiler_pool_slot {
+  profiler_pool * owner; // nullptr for objects that didn't come from a pool
+  profiler_pool_slot * next;
+};
+
+#define APEX_POOL_ALIGN(x) \
+  (((x) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1))
+
+static const std::size_t slot_header_size = APEX_POOL_ALIGN(sizeof(profiler_pool_slot));
+static const std::size_t slot_size = slot_header_size + APEX_POOL_ALIGN(sizeof(profiler));
+
+/* Pools released by exited threads, waiting to be adopted. */
+static std::mutex _orphan_mutex;
+static profiler_pool * _orphans = nullptr;
+
+/* This thread's pool */
+static APEX_NATIVE_TLS profiler_pool * _thread_pool = nullptr;
+
+static inline void * slot_to_object(profiler_pool_slot * slot) {
+  return reinterpret_cast<char*>(slot) + slot_header_size;
+}
+
+static inline profiler_pool_slot * object_to_slot(void * ptr) {
+  return reinterpret_cast<profiler_pool_slot*>(static_cast<char*>(ptr) - slot_header_size);
+}
+
+profiler_pool * profiler_pool::get_thread_pool(void) {
+  profiler_pool * pool = _thread_pool;
+  if (pool == nullptr) {
+    // first time called by this thread - adopt an orphan, or make a new pool.
+    {
+      std::unique_lock<std::mutex> l(_orphan_mutex);
+      if (_orphans != nullptr) {
+        pool = _orphans;
+        _orphans = pool->_next_orphan;
+        pool->_next_orphan = nullptr;
+      }
+    }
+    if (pool == nullptr) {
+      pool = new profiler_pool();
+    }
+    _thread_pool = pool;
+  }
+  return pool;
+}
+
+void profiler_pool::add_slab(void) {
+  char * slab = static_cast<char*>(malloc(slot_size * APEX_PROFILER_POOL_SLAB_SIZE));
+  if (slab == nullptr) {
+    throw std::bad_alloc();
+  }
+  for (int i = APEX_PROFILER_POOL_SLAB_SIZE - 1 ; i >= 0 ; i--) {
+    profiler_pool_slot * slot = reinterpret_cast<profiler_pool_slot*>(slab + (i * slot_size));
+    slot->owner = this;
+    slot->next = _free_list;
+    _free_list = slot;
+  }
+}
+
+void * profiler_pool::pop_slot(void) {
+  if (_free_list == nullptr) {
+    // take everything other threads have handed back
+    _free_list = _returned.exchange(nullptr, std::memory_order_acquire);
+    if (_free_list == nullptr) {
+      add_slab();
+    }
+  }
+  profiler_pool_slot * slot = _free_list;
+  _free_list = slot->next;
+  return slot_to_object(slot);
+}
+
+/* Push a list of slots onto the returned list. Only the owner ever
+ * removes from that list, and it takes all of it, so there is no ABA. */
+void profiler_pool::give_back(profiler_pool_slot * head, profiler_pool_slot * tail) {
+  profiler_pool_slot * old = _returned.load(std::memory_order_relaxed);
+  do {
+    tail->next = old;
+  } while (!_returned.compare_exchange_weak(old, head,
+           std::memory_order_release, std::memory_order_relaxed));
+}
+
+void * profiler_pool::allocate(std::size_t size) {
+  if (slot_header_size + size > slot_size) {
+    // not a profiler - don't pool it.
+    profiler_pool_slot * slot = static_cast<profiler_pool_slot*>(malloc(slot_header_size + size));
+    if (slot == nullptr) {
+      throw std::bad_alloc();
+    }
+    slot->owner = nullptr;
+    return slot_to_object(slot);
+  }
+  return get_thread_pool()->pop_slot();
+}
+
+void profiler_pool::deallocate(void * ptr) {
+  if (ptr == nullptr) return;
+  profiler_pool_slot * slot = object_to_slot(ptr);
+  profiler_pool * owner = slot->owner;
+  if (owner == nullptr) {
+    free(slot);
+    return;
+  }
+  // our own object? put it right back on the free list.
+  if (owner == _thread_pool) {
+    slot->next = owner->_free_list;
+    owner->_free_list = slot;
+    return;
+  }
+  // otherwise, the timer stopped on another thread - hand it back.
+  owner->give_back(slot, slot);
+}
+
+void profiler_pool::release_thread_pool(void) {
+  profiler_pool * pool = _thread_pool;
+  if (pool != nullptr) {
+    std::unique_lock<std::mutex> l(_orphan_mutex);
+    pool->_next_orphan = _orphans;
+    _orphans = pool;
+    _thread_pool = nullptr;
+  }
+}
+
+/* The profiler allocation functions, declared in profiler.hpp */
+void * profiler::operator new(std::size_t size) {
+  return profiler_pool::allocate(size);
+}
+
+void profiler::operator delete(void * ptr) {
+  profiler_pool::deallocate(ptr);
+}
+
+}
+
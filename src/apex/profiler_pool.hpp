@@ -0,0 +1,53 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace apex {
+
+/* The number of profiler objects carved out of each slab. */
+#define APEX_PROFILER_POOL_SLAB_SIZE 256
+
+struct profiler_pool_slot;
+
+/* A per-thread free list of profiler objects.
+ *
+ * Profilers are started (allocated) and stopped (freed) on the same
+ * application thread, so in the steady state start/stop takes an object
+ * off the thread's free list and puts it back, without calling malloc.
+ * A timer stopped on a different thread than it started on is pushed
+ * onto its owner's "returned" list, which the owner takes all of when
+ * its free list is empty.
+ *
+ * Pools (and their slabs) are never freed. When a thread exits,
+ * apex::exit_thread() releases its pool, and the next new thread adopts
+ * it. */
+class profiler_pool {
+private:
+  // objects only the owning thread may touch - no locking required
+  profiler_pool_slot * _free_list;
+  // batches of objects handed back by other threads
+  std::atomic<profiler_pool_slot*> _returned;
+  // link for the list of pools released by exited threads
+  profiler_pool * _next_orphan;
+  profiler_pool(void) : _free_list(nullptr), _returned(nullptr),
+    _next_orphan(nullptr) {};
+  void * pop_slot(void);
+  void give_back(profiler_pool_slot * head, profiler_pool_slot * tail);
+  void add_slab(void);
+  static profiler_pool * get_thread_pool(void);
+public:
+  /* Called from profiler::operator new/delete */
+  static void * allocate(std::size_t size);
+  static void deallocate(void * ptr);
+  /* Release this thread's pool so another thread can adopt it. */
+  static void release_thread_pool(void);
+};
+
+}
+
@@ -0,0 +1,77 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "profiler_ring.hpp"
+#include <mutex>
+
+namespace apex {
+
+/* All rings ever created, for each shard */
+static std::atomic<profiler_ring*> _all_rings[APEX_MAX_CONSUMERS];
+
+/* Rings released by exited threads, waiting to be adopted. */
+static std::mutex _orphan_mutex;
+static profiler_ring * _orphans[APEX_MAX_CONSUMERS];
+
+/* This thread's rings */
+static APEX_NATIVE_TLS profiler_ring * _thread_rings[APEX_MAX_CONSUMERS];
+
+profiler_ring::profiler_ring(size_t capacity) : _head(0), _cached_tail(0),
+    _tail(0), _cached_head(0), _consumer_lock(false), _records(nullptr),
+    _mask(0), _sample_period(1), _sample_skipped(0), _next(nullptr),
+    _next_orphan(nullptr) {
+  // round up to a power of two
+  size_t size = 2;
+  while (size < capacity) {
+    size = size << 1;
+  }
+  _records = new profiler_record[size];
+  _mask = size - 1;
+}
+
+profiler_ring * profiler_ring::get_thread_ring(unsigned int shard, size_t capacity) {
+  profiler_ring * ring = _thread_rings[shard];
+  if (ring == nullptr) {
+    // first time called by this thread - adopt an orphan, or make a new ring.
+    {
+      std::unique_lock<std::mutex> l(_orphan_mutex);
+      if (_orphans[shard] != nullptr) {
+        ring = _orphans[shard];
+        _orphans[shard] = ring->_next_orphan;
+        ring->_next_orphan = nullptr;
+      }
+    }
+    if (ring == nullptr) {
+      ring = new profiler_ring(capacity);
+      // publish the new ring
+      profiler_ring * head = _all_rings[shard].load(std::memory_order_relaxed);
+      do {
+        ring->_next = head;
+      } while (!_all_rings[shard].compare_exchange_weak(head, ring,
+               std::memory_order_release, std::memory_order_relaxed));
+    }
+    _thread_rings[shard] = ring;
+  }
+  return ring;
+}
+
+profiler_ring * profiler_ring::first(unsigned int shard) {
+  return _all_rings[shard].load(std::memory_order_acquire);
+}
+
+void profiler_ring::release_thread_ring(void) {
+  std::unique_lock<std::mutex> l(_orphan_mutex);
+  for (unsigned int shard = 0 ; shard < APEX_MAX_CONSUMERS ; shard++) {
+    profiler_ring * ring = _thread_rings[shard];
+    if (ring != nullptr) {
+      ring->_next_orphan = _orphans[shard];
+      _orphans[shard] = ring;
+      _thread_rings[shard] = nullptr;
+    }
+  }
+}
+
+}
+
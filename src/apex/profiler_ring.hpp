@@ -0,0 +1,196 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "apex_types.h"
+#include "profiler.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace apex {
+
+/* flags for profiler_record */
+#define APEX_RECORD_RESUME    0x1 // yield or resume - don't increment calls
+#define APEX_RECORD_COUNTER   0x2 // a sampled counter value, not a timer
+#define APEX_RECORD_RESET     0x4 // reset the profile for this ID
+#define APEX_RECORD_RESET_ALL 0x8 // reset all the profiles of the shard the ID maps to
+#define APEX_RECORD_SAMPLED   0x10 // a throttled timer - value holds the weight
+
+#define APEX_CACHE_LINE_SIZE 64
+
+/* The most events the "sample" overflow policy will skip between kept
+ * events */
+#define APEX_MAX_SAMPLE_PERIOD 1024
+
+/* The most consumer threads (and so rings per producer thread) */
+#define APEX_MAX_CONSUMERS 64
+
+/* What the consumer needs to know about a stopped timer (or a sampled
+ * counter). Fixed size and trivially copyable, so it can be written
+ * straight into a ring buffer. */
+struct profiler_record {
+  uint32_t id;      // the dense ID of the interned task_identifier
+  uint32_t flags;
+  uint64_t start;   // MYCLOCK ticks
+  uint64_t end;     // MYCLOCK ticks
+  double value;     // the counter value, or the weight for APEX_RECORD_SAMPLED
+  double children;  // MYCLOCK ticks spent in timers started inside this one
+#if APEX_HAVE_PAPI
+  long long papi_deltas[8];
+#endif
+  bool is_resume(void) const { return (flags & APEX_RECORD_RESUME) != 0; }
+  bool is_counter(void) const { return (flags & APEX_RECORD_COUNTER) != 0; }
+  bool is_sampled(void) const { return (flags & APEX_RECORD_SAMPLED) != 0; }
+  double elapsed(void) const {
+    if (is_counter()) {
+      return value;
+    }
+    std::chrono::duration<double> time_span =
+      std::chrono::duration_cast<std::chrono::duration<double>>(
+        MYCLOCK::duration(end - start));
+    return time_span.count();
+  }
+  double normalized_timestamp(void) const {
+    if (is_counter()) {
+      return value;
+    }
+    std::chrono::duration<double> time_span =
+      std::chrono::duration_cast<std::chrono::duration<double>>(
+        MYCLOCK::duration(start) -
+        profiler::get_global_start().time_since_epoch());
+    return time_span.count()*profiler::get_cpu_mhz();
+  }
+};
+
+/* A bounded, single-producer/single-consumer ring of profiler_records.
+ *
+ * Each thread that stops timers gets its own ring for each consumer
+ * shard, so producers never share cache lines or contend with each other.
+ * A shard's consumer visits that shard's rings in turn. To allow more than
+ * one thread to drain during shutdown, a consumer has to take the ring
+ * with try_lock() first.
+ *
+ * The rings are never freed. They are linked into a per-shard list when
+ * created, and apex::exit_thread() releases a thread's rings so the next
+ * new thread can adopt them. */
+class profiler_ring {
+private:
+  // written by the producer
+  std::atomic<uint64_t> _head;
+  uint64_t _cached_tail;
+  char _pad0[APEX_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>) - sizeof(uint64_t)];
+  // written by the consumer
+  std::atomic<uint64_t> _tail;
+  uint64_t _cached_head;
+  char _pad1[APEX_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>) - sizeof(uint64_t)];
+  std::atomic<bool> _consumer_lock;
+  profiler_record * _records;
+  uint64_t _mask;
+  // for the "sample" overflow policy - only touched by the producer
+  uint32_t _sample_period;
+  uint32_t _sample_skipped;
+  profiler_ring * _next;        // the list of all rings for the shard
+  profiler_ring * _next_orphan; // the list of rings released by exited threads
+  profiler_ring(size_t capacity);
+public:
+  /* producer side */
+  bool push(const profiler_record &record) {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    if (head - _cached_tail > _mask) {
+      _cached_tail = _tail.load(std::memory_order_acquire);
+      if (head - _cached_tail > _mask) {
+        return false;
+      }
+    }
+    _records[head & _mask] = record;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  /* For the "drop oldest" overflow policy: discard the oldest record to
+   * make room. The producer has to take the consumer lock to do this, so
+   * it fails if the consumer is draining the ring right now. */
+  bool pop_oldest(profiler_record &out) {
+    if (!try_lock()) {
+      return false;
+    }
+    size_t count = pop_bulk(&out, 1);
+    unlock();
+    return count == 1;
+  }
+  /* For the "sample" overflow policy: whether to keep this event. While
+   * the ring is under pressure only 1 in _sample_period events is kept.
+   * The period doubles each time the ring fills, and halves whenever the
+   * consumer has caught up to less than a quarter full. */
+  bool sample_keep(void) {
+    if (_sample_period == 1) {
+      return true;
+    }
+    if (size_approx() <= (_mask >> 2)) {
+      _sample_period = _sample_period >> 1;
+      _sample_skipped = 0;
+      if (_sample_period == 1) {
+        return true;
+      }
+    }
+    if (++_sample_skipped < _sample_period) {
+      return false;
+    }
+    _sample_skipped = 0;
+    return true;
+  }
+  void sample_less(void) {
+    if (_sample_period < APEX_MAX_SAMPLE_PERIOD) {
+      _sample_period = _sample_period << 1;
+    }
+  }
+  /* consumer side - hold the consumer lock */
+  bool try_lock(void) {
+    return !_consumer_lock.load(std::memory_order_relaxed) &&
+           !_consumer_lock.exchange(true, std::memory_order_acquire);
+  }
+  void unlock(void) { _consumer_lock.store(false, std::memory_order_release); }
+  /* Copy up to max_records records, in order, to out. Returns the
+   * number of records consumed. */
+  size_t pop_bulk(profiler_record * out, size_t max_records) {
+    uint64_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _cached_head) {
+      _cached_head = _head.load(std::memory_order_acquire);
+      if (tail == _cached_head) {
+        return 0;
+      }
+    }
+    size_t count = (size_t)(_cached_head - tail);
+    if (count > max_records) {
+      count = max_records;
+    }
+    // the records may wrap around the end of the buffer
+    size_t first = (size_t)(tail & _mask);
+    size_t to_end = (size_t)(_mask + 1) - first;
+    size_t part = count < to_end ? count : to_end;
+    memcpy(out, &_records[first], part * sizeof(profiler_record));
+    memcpy(out + part, _records, (count - part) * sizeof(profiler_record));
+    _tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+  size_t size_approx(void) const {
+    return (size_t)(_head.load(std::memory_order_relaxed) -
+                    _tail.load(std::memory_order_relaxed));
+  }
+  profiler_ring * next(void) const { return _next; }
+  /* This thread's ring for the shard, created (or adopted) on first use.
+   * Each ring holds capacity records, rounded up to a power of two. */
+  static profiler_ring * get_thread_ring(unsigned int shard, size_t capacity);
+  /* The head of the list of all rings for the shard. Rings are only ever
+   * added at the head, so a consumer can walk the list without locking. */
+  static profiler_ring * first(unsigned int shard);
+  /* Release this thread's rings so another thread can adopt them. */
+  static void release_thread_ring(void);
+};
+
+}
+
@@ -11,10 +11,11 @@ namespace apex {
 
 class task_dependency {
 public:
-  task_identifier parent;
-  task_identifier child;
+  // dense IDs of the interned parent and child identifiers
+  uint32_t parent;
+  uint32_t child;
   task_dependency(task_identifier * p, task_identifier * c) :
-    parent(*p), child(*c) {};
+    parent(p->id), child(c->id) {};
   ~task_dependency() {
     //delete parent;
     //delete child;
@@ -6,19 +6,207 @@
 #include "task_identifier.hpp"
 #include "thread_instance.hpp"
 #include "utils.hpp"
+#include <mutex>
+#include <math.h>
+#include <unordered_map>
 
 namespace apex {
 
+/* The dense ID -> identifier table is stored in fixed-size chunks, so that
+ * it can grow without moving the entries that readers might be looking at. */
+#define TASK_ID_CHUNK_BITS 12
+#define TASK_ID_CHUNK_SIZE (1 << TASK_ID_CHUNK_BITS)
+#define TASK_ID_MAX_CHUNKS 4096
+
+static std::mutex _task_id_mutex;
+static std::atomic<task_identifier**> _task_id_chunks[TASK_ID_MAX_CHUNKS];
+static std::atomic<uint32_t> _num_task_ids(0);
+
+/* The global maps, protected by _task_id_mutex. */
+static std::unordered_map<std::string, task_identifier*>& global_name_map(void) {
+    static std::unordered_map<std::string, task_identifier*> the_map;
+    return the_map;
+}
+
+static std::unordered_map<apex_function_address, task_identifier*>& global_address_map(void) {
+    static std::unordered_map<apex_function_address, task_identifier*> the_map;
+    return the_map;
+}
+
+/* The per-thread caches, so that most lookups don't lock. */
+static APEX_NATIVE_TLS std::unordered_map<std::string, task_identifier*> * _name_cache = nullptr;
+static APEX_NATIVE_TLS std::unordered_map<apex_function_address, task_identifier*> * _address_cache = nullptr;
+
+/* The identifier every name and address shares once the table is full,
+ * with the last ID */
+#define TASK_ID_OVERFLOW ((TASK_ID_CHUNK_SIZE * TASK_ID_MAX_CHUNKS) - 1)
+static task_identifier * _overflow = nullptr;
+
+/* assign the next dense ID, and return the identifier to intern: tid, or
+ * (deleting tid) the overflow identifier if the table is full.
+ * _task_id_mutex must be held. */
+static task_identifier * assign_task_id(task_identifier * tid) {
+    uint32_t id = _num_task_ids.load(std::memory_order_relaxed);
+    if (id >= TASK_ID_OVERFLOW) {
+        delete tid;
+        if (_overflow != nullptr) {
+            return _overflow;
+        }
+        // should never happen - that is 16 million distinct timers.
+        std::cerr << "APEX Error: too many distinct timers! The rest are "
+                  << "not measured." << std::endl;
+        _overflow = new task_identifier(std::string("APEX too many timers"));
+        id = TASK_ID_OVERFLOW;
+        tid = _overflow;
+    }
+    uint32_t chunk = id >> TASK_ID_CHUNK_BITS;
+    task_identifier ** entries = _task_id_chunks[chunk].load(std::memory_order_relaxed);
+    if (entries == nullptr) {
+        entries = new task_identifier*[TASK_ID_CHUNK_SIZE]();
+        _task_id_chunks[chunk].store(entries, std::memory_order_release);
+    }
+    tid->id = id;
+    entries[id & (TASK_ID_CHUNK_SIZE - 1)] = tid;
+    // publish the entry after it is written
+    _num_task_ids.store(id + 1, std::memory_order_release);
+    return tid;
+}
+
 std::string task_identifier::get_name() {
-    if (!has_name) {
-      if (_resolved_name == "" && address != APEX_NULL_FUNCTION_ADDRESS) {
-        //_resolved_name = lookup_address((uintptr_t)address, false);         
-        _resolved_name = thread_instance::instance().map_addr_to_name(address);
+    if (!_resolved.load(std::memory_order_acquire)) {
+      std::string tmp;
+      if (!has_name) {
+        if (address != APEX_NULL_FUNCTION_ADDRESS) {
+          //tmp = lookup_address((uintptr_t)address, false);
+          tmp = thread_instance::instance().map_addr_to_name(address);
+        }
+        tmp = demangle(tmp);
+      } else {
+        tmp = demangle(name);
+      }
+      // Only interned identifiers are shared between threads.
+      if (id != APEX_NULL_TASK_ID) {
+        std::unique_lock<std::mutex> l(_task_id_mutex);
+        if (!_resolved.load(std::memory_order_relaxed)) {
+          _resolved_name = tmp;
+          _resolved.store(true, std::memory_order_release);
+        }
+      } else {
+        _resolved_name = tmp;
+        _resolved.store(true, std::memory_order_release);
       }
-      return demangle(_resolved_name);
     }
-    return demangle(name);
+    return _resolved_name;
   }
 
+task_identifier * task_identifier::get_task_id(const std::string &n) {
+    if (_name_cache == nullptr) {
+        _name_cache = new std::unordered_map<std::string, task_identifier*>();
+    }
+    auto it = _name_cache->find(n);
+    if (it != _name_cache->end()) {
+        return it->second;
+    }
+    task_identifier * tid = nullptr;
+    {
+        std::unique_lock<std::mutex> l(_task_id_mutex);
+        auto& the_map = global_name_map();
+        auto it2 = the_map.find(n);
+        if (it2 == the_map.end()) {
+            tid = assign_task_id(new task_identifier(n));
+            the_map[n] = tid;
+        } else {
+            tid = it2->second;
+        }
+    }
+    (*_name_cache)[n] = tid;
+    return tid;
+}
+
+task_identifier * task_identifier::get_task_id(apex_function_address a) {
+    if (_address_cache == nullptr) {
+        _address_cache = new std::unordered_map<apex_function_address, task_identifier*>();
+    }
+    auto it = _address_cache->find(a);
+    if (it != _address_cache->end()) {
+        return it->second;
+    }
+    task_identifier * tid = nullptr;
+    {
+        std::unique_lock<std::mutex> l(_task_id_mutex);
+        auto& the_map = global_address_map();
+        auto it2 = the_map.find(a);
+        if (it2 == the_map.end()) {
+            tid = assign_task_id(new task_identifier(a));
+            the_map[a] = tid;
+        } else {
+            tid = it2->second;
+        }
+    }
+    (*_address_cache)[a] = tid;
+    return tid;
+}
+
+void task_identifier::release_thread_caches(void) {
+    delete _name_cache;
+    _name_cache = nullptr;
+    delete _address_cache;
+    _address_cache = nullptr;
+}
+
+task_identifier * task_identifier::from_id(uint32_t id) {
+    if (id >= _num_task_ids.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    task_identifier ** entries =
+        _task_id_chunks[id >> TASK_ID_CHUNK_BITS].load(std::memory_order_acquire);
+    return entries[id & (TASK_ID_CHUNK_SIZE - 1)];
+}
+
+task_identifier * task_identifier::find_task_id(const std::string &n) {
+    std::unique_lock<std::mutex> l(_task_id_mutex);
+    auto& the_map = global_name_map();
+    auto it = the_map.find(n);
+    if (it == the_map.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+task_identifier * task_identifier::find_task_id(apex_function_address a) {
+    std::unique_lock<std::mutex> l(_task_id_mutex);
+    auto& the_map = global_address_map();
+    auto it = the_map.find(a);
+    if (it == the_map.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+bool task_identifier::is_overflow(void) const {
+    return id == TASK_ID_OVERFLOW;
+}
+
+uint32_t task_identifier::get_num_task_ids(void) {
+    return _num_task_ids.load(std::memory_order_acquire);
+}
+
+counter_identifier::counter_identifier(task_identifier * i, apex_counter_kind k) :
+    id(i), kind(k), last_value(NAN) {}
+
+counter_identifier * counter_identifier::get_counter_id(const std::string &n,
+    apex_counter_kind k) {
+    static std::unordered_map<std::string, counter_identifier*> the_map;
+    task_identifier * tid = task_identifier::get_task_id(n);
+    std::unique_lock<std::mutex> l(_task_id_mutex);
+    auto it = the_map.find(n);
+    if (it != the_map.end()) {
+        return it->second;
+    }
+    counter_identifier * cid = new counter_identifier(tid, k);
+    the_map[n] = cid;
+    return cid;
+}
+
 }
 
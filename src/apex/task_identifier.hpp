@@ -8,38 +8,111 @@
 #include "apex_types.h"
 #include <functional>
 #include <string>
+#include <atomic>
+#include <stdint.h>
 
 namespace apex {
 
+/* The dense ID given to task_identifier objects that were constructed
+ * directly, rather than interned through task_identifier::get_task_id(). */
+#define APEX_NULL_TASK_ID 0xFFFFFFFF
+
 class task_identifier {
 public:
   apex_function_address address;
   std::string name;
   std::string _resolved_name;
   bool has_name;
-  task_identifier(void) : 
-      address(0L), name(""), _resolved_name(""), has_name(false) {};
-  task_identifier(apex_function_address a) : 
-      address(a), name(""), _resolved_name(""), has_name(false) {};
-  task_identifier(std::string n) : 
-      address(0L), name(n), _resolved_name(""), has_name(true) {};
+  /* Dense, process-unique ID assigned when this identifier is interned.
+   * The profiler_listener keys its profiles by this value. */
+  uint32_t id;
+  /* Events for this identifier lost when an event ring overflowed,
+   * either dropped or skipped by the "sample" overflow policy. */
+  std::atomic<uint64_t> dropped_events;
+  std::atomic<uint64_t> sampled_events;
+  /* Set by the consumer when this timer is throttled (APEX_THROTTLE_TIMERS):
+   * only 1 in throttle_period starts is measured, and 1 means every start.
+   * Checking it on start only costs a relaxed load. */
+  std::atomic<uint32_t> throttle_period;
+  task_identifier(void) :
+      address(0L), name(""), _resolved_name(""), has_name(false),
+      id(APEX_NULL_TASK_ID), dropped_events(0), sampled_events(0),
+      throttle_period(1), _resolved(false) {};
+  task_identifier(apex_function_address a) :
+      address(a), name(""), _resolved_name(""), has_name(false),
+      id(APEX_NULL_TASK_ID), dropped_events(0), sampled_events(0),
+      throttle_period(1), _resolved(false) {};
+  task_identifier(std::string n) :
+      address(0L), name(n), _resolved_name(""), has_name(true),
+      id(APEX_NULL_TASK_ID), dropped_events(0), sampled_events(0),
+      throttle_period(1), _resolved(false) {};
+  task_identifier(const task_identifier &other) :
+      address(other.address), name(other.name), _resolved_name(""),
+      has_name(other.has_name), id(other.id),
+      dropped_events(other.dropped_events.load()),
+      sampled_events(other.sampled_events.load()),
+      throttle_period(other.throttle_period.load()), _resolved(false) {
+      // only copy the cached name once it has been published
+      if (other._resolved.load(std::memory_order_acquire)) {
+          _resolved_name = other._resolved_name;
+          _resolved = true;
+      }
+  };
+  task_identifier& operator=(const task_identifier &other) {
+      address = other.address;
+      name = other.name;
+      has_name = other.has_name;
+      id = other.id;
+      dropped_events = other.dropped_events.load();
+      sampled_events = other.sampled_events.load();
+      throttle_period = other.throttle_period.load();
+      if (other._resolved.load(std::memory_order_acquire)) {
+          _resolved_name = other._resolved_name;
+          _resolved = true;
+      } else {
+          _resolved_name = "";
+          _resolved = false;
+      }
+      return *this;
+  }
 	  /*
-  task_identifier(profiler * p) : 
+  task_identifier(profiler * p) :
       address(0L), name(""), _resolved_name("") {
-      if (p->have_name) {                                         
+      if (p->have_name) {
           name = *p->timer_name;
           has_name = true;
-      } else {                                                         
+      } else {
           address = p->action_address;
           has_name = false;
-      }            
+      }
   }
   */
   std::string get_name();
   ~task_identifier() { }
+  /* Interning support. These return the one shared, never-deleted
+   * task_identifier for the name or address, creating it if necessary.
+   * Lookups are served from a per-thread cache, so the global table
+   * lock is only taken the first time a thread sees an identifier. */
+  static task_identifier * get_task_id(const std::string &n);
+  static task_identifier * get_task_id(apex_function_address a);
+  /* Free this thread's lookup caches. They are made again if the thread
+   * looks up another identifier. */
+  static void release_thread_caches(void);
+  /* Map a dense ID back to its interned identifier.
+   * Returns nullptr if the ID was never assigned. Does not lock. */
+  static task_identifier * from_id(uint32_t id);
+  /* Find an interned identifier without creating it. */
+  static task_identifier * find_task_id(const std::string &n);
+  static task_identifier * find_task_id(apex_function_address a);
+  /* Whether this is the identifier all the names and addresses interned
+   * after the table filled up share. It has a valid ID, but isn't one
+   * timer. */
+  bool is_overflow(void) const;
+  /* The number of interned identifiers (one more than the highest ID). */
+  static uint32_t get_num_task_ids(void);
   // requried for using this class as a key in an unordered map.
   // the hash function is defined below.
-  bool operator==(const task_identifier &other) const { 
+  bool operator==(const task_identifier &other) const {
     return (address == other.address && name.compare(other.name) == 0);
   }
   // required for using this class as a key in a set
@@ -62,10 +135,38 @@ public:
     // (also the default)
     return false;
   }
+private:
+  /* set once _resolved_name holds the final (resolved, demangled) name.
+   * Interned identifiers are shared between threads, so get_name() has
+   * to publish the cached name safely. */
+  std::atomic<bool> _resolved;
 };
 
 }
 
+namespace apex {
+
+/* A counter registered with apex::register_counter(). Like interned
+ * task_identifiers, these are never deleted, so the handle can be used
+ * for the life of the process. */
+class counter_identifier {
+public:
+  task_identifier * id;
+  apex_counter_kind kind;
+  /* the previous sample of an APEX_COUNTER_MONOTONIC counter, NaN if
+   * there hasn't been one yet */
+  std::atomic<double> last_value;
+  counter_identifier(task_identifier * i, apex_counter_kind k);
+  /* Look up (or create) the counter for the name. The kind given when
+   * the counter is first registered is kept. */
+  static counter_identifier * get_counter_id(const std::string &n,
+                                             apex_counter_kind k);
+};
+
+typedef counter_identifier * counter_handle;
+
+}
+
 /* This is the hash function for the task_identifier class */
 namespace std {
 
@@ -74,12 +175,12 @@ namespace std {
   {
     std::size_t operator()(const apex::task_identifier& k) const
     {
-      std::size_t h1 = std::hash<int>()(k.address);
+      std::size_t h1 = std::hash<uint64_t>()(k.address);
       std::size_t h2 = std::hash<std::string>()(k.name);
-      return h1 ^ (h2 << 1);; // instead of boost::hash_combine
+      // as boost::hash_combine does
+      return h2 ^ (h1 + 0x9e3779b9 + (h2 << 6) + (h2 >> 2));
     }
   };
 
 }
 
-
@@ -0,0 +1,137 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifdef APEX_HAVE_HPX3
+#include <hpx/config.hpp>
+#endif
+
+#include "task_sampler.hpp"
+#include "apex_types.h"
+#include "finalize_pipeline.hpp"
+#include "profile_file.hpp"
+#include <algorithm>
+#include <atomic>
+#include <unistd.h>
+#include <vector>
+
+namespace apex {
+
+struct keyed_sample {
+  uint64_t key;
+  sample_file_sample sample;
+  bool operator<(const keyed_sample &other) const { return key < other.key; }
+};
+
+/* One timer's samples on one thread: a max-heap on the key, so the sample
+ * to replace is on top */
+struct reservoir {
+  uint64_t seen;
+  std::vector<keyed_sample> heap;
+  reservoir(void) : seen(0) { }
+};
+
+/* One thread's samples, indexed by timer id. Each thread adds itself to
+ * the list the first time it takes a sample. They are not freed, as a
+ * thread can exit before the samples are written. */
+struct thread_samples {
+  std::vector<reservoir> timers;
+  uint64_t seed;
+  thread_samples * next;
+};
+
+static uint32_t _samples_per_timer = 1000;
+static std::atomic<thread_samples *> _all_threads(nullptr);
+static APEX_NATIVE_TLS thread_samples * _my_samples = nullptr;
+
+static thread_samples * register_thread(void) {
+  thread_samples * mine = new thread_samples();
+  mine->seed = (uint64_t)(uintptr_t)mine | 1;
+  mine->next = _all_threads.load(std::memory_order_relaxed);
+  while (!_all_threads.compare_exchange_weak(mine->next, mine,
+         std::memory_order_release, std::memory_order_relaxed)) { }
+  _my_samples = mine;
+  return mine;
+}
+
+/* xorshift64 */
+static inline uint64_t next_key(thread_samples * mine) {
+  uint64_t x = mine->seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  mine->seed = x;
+  return x;
+}
+
+void task_sampler::configure(uint32_t samples_per_timer) {
+  _samples_per_timer = samples_per_timer;
+}
+
+void task_sampler::offer(uint32_t id, double timestamp, double value, uint64_t weight) {
+  if (_samples_per_timer == 0) {
+    return;
+  }
+  thread_samples * mine = _my_samples;
+  if (mine == nullptr) {
+    mine = register_thread();
+  }
+  if (id >= mine->timers.size()) {
+    mine->timers.resize(id + 1);
+  }
+  reservoir &r = mine->timers[id];
+  r.seen += weight;
+  uint64_t key = next_key(mine);
+  if (r.heap.size() < _samples_per_timer) {
+    r.heap.push_back(keyed_sample{key, sample_file_sample{timestamp, value}});
+    std::push_heap(r.heap.begin(), r.heap.end());
+  } else if (key < r.heap.front().key) {
+    std::pop_heap(r.heap.begin(), r.heap.end());
+    r.heap.back() = keyed_sample{key, sample_file_sample{timestamp, value}};
+    std::push_heap(r.heap.begin(), r.heap.end());
+  }
+}
+
+bool task_sampler::write(const std::string &filename, uint32_t node) {
+  std::vector<thread_samples *> threads;
+  size_t num_timers = 0;
+  for (thread_samples * t = _all_threads.load(std::memory_order_acquire) ;
+       t != nullptr ; t = t->next) {
+    threads.push_back(t);
+    num_timers = std::max(num_timers, t->timers.size());
+  }
+  sample_file_writer writer(node, (uint32_t)getpid());
+  std::vector<keyed_sample> merged;
+  std::vector<sample_file_sample> samples;
+  for (uint32_t id = 0 ; id < num_timers ; id++) {
+    uint64_t seen = 0;
+    merged.clear();
+    for (thread_samples * t : threads) {
+      if (id < t->timers.size()) {
+        seen += t->timers[id].seen;
+        merged.insert(merged.end(), t->timers[id].heap.begin(), t->timers[id].heap.end());
+      }
+    }
+    if (seen == 0) {
+      continue;
+    }
+    // keep the smallest keys, and write them in time order
+    if (merged.size() > _samples_per_timer) {
+      std::nth_element(merged.begin(), merged.begin() + _samples_per_timer, merged.end());
+      merged.resize(_samples_per_timer);
+    }
+    samples.clear();
+    for (const keyed_sample &k : merged) {
+      samples.push_back(k.sample);
+    }
+    std::sort(samples.begin(), samples.end(),
+              [](const sample_file_sample &a, const sample_file_sample &b) {
+                return a.timestamp < b.timestamp;
+              });
+    writer.add(finalize_pipeline::name(id), seen, samples.data(), samples.size());
+  }
+  return writer.write(filename);
+}
+
+}
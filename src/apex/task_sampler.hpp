@@ -0,0 +1,41 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace apex {
+
+/* The samples for the task scatterplot (APEX_TASK_SCATTERPLOT). Every
+ * thread that processes timer events keeps its own samples, so taking a
+ * sample takes no lock. Each timer keeps at most
+ * APEX_TASK_SCATTERPLOT_SAMPLES of them: every time it stops is given a
+ * random key, and the samples with the smallest keys are kept. A timer
+ * that stops only a few times keeps every one, however busy the others
+ * are, and the threads' samples merge exactly, by keeping the smallest
+ * keys across them all.
+ *
+ * At exit the process writes its samples to
+ * apex_task_samples.<node>.<pid>.bin (see profile_file.hpp), and
+ * apex_task_samples merges the files into the apex_task_samples.csv that
+ * task_scatterplot.py reads. */
+class task_sampler {
+public:
+  /* The number of samples to keep for each timer. Call before any are
+   * offered. */
+  static void configure(uint32_t samples_per_timer);
+  /* Offer a stop of timer id, at timestamp seconds, taking value
+   * microseconds, that stands for weight stops (more than one, for a
+   * throttled timer) */
+  static void offer(uint32_t id, double timestamp, double value, uint64_t weight);
+  /* Merge the threads' samples and write them. Call once the threads have
+   * stopped offering samples. Returns false, with a warning, if the file
+   * can't be written. */
+  static bool write(const std::string &filename, uint32_t node);
+};
+
+}
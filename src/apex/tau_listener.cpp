@@ -97,7 +97,7 @@ bool tau_listener::on_resume(task_identifier * id) {
   return on_start(id);
 }
 
-void tau_listener::on_stop(std::shared_ptr<profiler> &p) {
+void tau_listener::on_stop(profiler_ptr &p) {
   static string empty("");
   if (!_terminate) {
       if (p->task_id->get_name().compare(empty) == 0) {
@@ -109,7 +109,7 @@ void tau_listener::on_stop(std::shared_ptr<profiler> &p) {
   return;
 }
 
-void tau_listener::on_yield(std::shared_ptr<profiler> &p) {
+void tau_listener::on_yield(profiler_ptr &p) {
     on_stop(p);
 }
 
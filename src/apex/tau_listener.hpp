@@ -18,14 +18,16 @@ public:
   tau_listener (void);
   ~tau_listener (void) { };
   static void initialize_tau(int argc, char** avgv);
+  uint32_t interest(void) { return APEX_INTEREST_TIMERS |
+      APEX_INTEREST_SAMPLE_VALUE | APEX_INTEREST_CUSTOM_EVENT; }
   void on_startup(startup_event_data &data);
   void on_shutdown(shutdown_event_data &data);
   void on_new_node(node_event_data &data);
   void on_new_thread(new_thread_event_data &data);
   void on_exit_thread(event_data &data);
   bool on_start(task_identifier *id);
-  void on_stop(std::shared_ptr<profiler> &p);
-  void on_yield(std::shared_ptr<profiler> &p);
+  void on_stop(profiler_ptr &p);
+  void on_yield(profiler_ptr &p);
   bool on_resume(task_identifier * id);
   void on_new_task(task_identifier * id, uint64_t task_id)
        { APEX_UNUSED(id); APEX_UNUSED(task_id); };
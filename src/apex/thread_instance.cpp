@@ -6,6 +6,7 @@
 #include "apex_api.hpp" // make this the first include.
 #include "thread_instance.hpp"
 #include <iostream>
+#include <algorithm>
 
 // TAU related
 #ifdef APEX_HAVE_TAU
@@ -213,77 +214,63 @@ string thread_instance::map_addr_to_name(apex_function_address function_address)
 }
 
 void thread_instance::set_current_profiler(profiler * the_profiler) {
-    instance().current_profiler = the_profiler;
-    /*
-    instance().current_profilers.push_back(the_profiler);
-    */
+    thread_instance &me = instance();
+    // forget the timers that were stopped on other threads
+    while (!me.current_profilers.empty() &&
+           me.current_profilers.back()->stopped.load(std::memory_order_acquire)) {
+        me.current_profilers.back()->release();
+        me.current_profilers.pop_back();
+    }
+    the_profiler->add_ref();
+    me.current_profilers.push_back(the_profiler);
+    me.current_profiler = the_profiler;
 }
 
 void thread_instance::clear_current_profiler(void) {
     instance().current_profiler = nullptr;
-    /*
-    instance().current_profilers.push_back(the_profiler);
-    */
 }
 
 profiler * thread_instance::get_current_profiler(void) {
     return instance().current_profiler;
 }
 
-    /*
-profiler * thread_instance::get_parent_profiler(void) {
-    if (instance().current_profilers.size() == 0) {
-        //throw empty_stack_exception(); // to be caught by the profiler_listener
+profiler * thread_instance::pop_current_profiler(profiler * requested) {
+    thread_instance &me = instance();
+    std::vector<profiler*> &stack = me.current_profilers;
+    // usually the innermost timer, unless the timers overlap
+    size_t i = stack.size();
+    while (i > 0 && stack[i-1] != requested) { i--; }
+    if (i == 0) {
+        // started on another thread
         return nullptr;
     }
-    return instance().current_profilers.back();
-}
-
-profiler * thread_instance::pop_current_profiler(void) {
-    if (instance().current_profilers.empty()) {
-        //throw empty_stack_exception(); // to be caught by the profiler_listener
-        return nullptr;
+    stack.erase(stack.begin() + (i - 1));
+    requested->release();
+    me.current_profiler = stack.empty() ? nullptr : stack.back();
+    for (i = i - 1 ; i > 0 ; i--) {
+        if (!stack[i-1]->stopped.load(std::memory_order_acquire)) {
+            return stack[i-1];
+        }
     }
-    instance().current_profiler = instance().current_profilers.back();
-    instance().current_profilers.pop_back();
-    return instance().current_profiler;
-}
-
-bool thread_instance::profiler_stack_empty() {
-    return instance().current_profilers.empty();
+    return nullptr;
 }
 
-profiler * thread_instance::pop_current_profiler(profiler * requested) {
-    if (instance().current_profilers.empty()) {
-        //throw empty_stack_exception(); // to be caught by the profiler_listener
-        return requested;
+size_t thread_instance::get_callpath(profiler * p, uint32_t * ids, size_t max_depth) {
+    std::vector<profiler*> &stack = instance().current_profilers;
+    size_t i = stack.size();
+    while (i > 0 && stack[i-1] != p) { i--; }
+    if (i == 0 || max_depth == 0) {
+        return 0;
     }
-    if (instance().current_profilers.back() == requested) {
-      instance().current_profiler = instance().current_profilers.back();
-      instance().current_profilers.pop_back();
-    } else {
-      // work backward over the vector to find the requested profiler
-      std::vector<profiler*>::const_iterator it;
-      int crappy_compiler = 0;
-      for (it = instance().current_profilers.end() ; it != instance().current_profilers.begin() ; it-- ) {
-        profiler * tmp = (*it);
-        if (tmp == requested) {
-          instance().current_profiler = *it;
-//#ifdef __INTEL_COMPILER
-#if __cplusplus < 201400L
-          instance().current_profilers.erase(instance().current_profilers.end()-crappy_compiler);
-#else
-          instance().current_profilers.erase(it);
-#endif
-          return instance().current_profiler;
+    // walk outward from the timer, then reverse
+    size_t depth = 0;
+    for ( ; i > 0 && depth < max_depth ; i--) {
+        if (stack[i-1] == p || !stack[i-1]->stopped.load(std::memory_order_acquire)) {
+            ids[depth++] = stack[i-1]->task_id->id;
         }
-        crappy_compiler++;
-      }
-      //throw empty_stack_exception(); // to be caught by the profiler_listener
-      return requested;
     }
-    return instance().current_profiler; // for completeless
+    std::reverse(ids, ids + depth);
+    return depth;
 }
-    */
 
 }
@@ -53,9 +53,10 @@ private:
   // map from function address to name - unique to all threads to avoid locking
   std::map<apex_function_address, std::string> _function_map;
   profiler * current_profiler;
-  /*
+  /* The timers started on this thread that are still running, innermost
+   * last. Each entry holds a reference, so that a timer stopped on
+   * another thread can still be looked at here until it is removed. */
   std::vector<profiler*> current_profilers;
-  */
   //std::shared_ptr<profiler> current_profiler;
   //std::vector<std::shared_ptr<profiler> > current_profilers;
 public:
@@ -77,12 +78,14 @@ public:
   static void set_current_profiler(profiler * the_profiler);
   static profiler * get_current_profiler(void);
   static void clear_current_profiler(void);
-  /*
-  static profiler * get_parent_profiler(void);
-  static profiler * pop_current_profiler(void);
+  /* Take a timer that has stopped off of this thread's stack. Returns the
+   * timer it was started inside, if that is still running on this
+   * thread, so that the time can be charged to it; otherwise nullptr. */
   static profiler * pop_current_profiler(profiler * requested);
-  static bool profiler_stack_empty(void);
-  */
+  /* Fill in ids with the path to a running timer: the IDs of the timers
+   * it was started inside, outermost first, ending with its own. Only the
+   * innermost max_depth are kept. Returns the length of the path. */
+  static size_t get_callpath(profiler * p, uint32_t * ids, size_t max_depth);
   static const char * program_path(void);
 #ifdef APEX_DEBUG
   static std::mutex _open_profiler_mutex;
@@ -0,0 +1,274 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "tsc.hpp"
+#include "clock_source.hpp"
+#include "apex_options.hpp"
+#include <condition_variable>
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/* How long to measure the TSC against CLOCK_MONOTONIC_RAW at startup,
+ * in seconds, with and without a reported frequency to check, and how
+ * long after startup to refine the measurement */
+#define APEX_TSC_VERIFY_INTERVAL 0.002
+#define APEX_TSC_CALIBRATE_INTERVAL 0.01
+#define APEX_TSC_REFINE_INTERVAL 1.0
+/* How close the reported frequency has to be to the measured one */
+#define APEX_TSC_TOLERANCE 0.01
+/* How many cores, and how many exchanges per core, the skew check uses */
+#define APEX_TSC_SKEW_MAX_CPUS 64
+#define APEX_TSC_SKEW_ROUNDS 100
+
+namespace apex {
+
+std::atomic<double> tsc::_seconds_per_tick(0.0);
+
+static std::mutex _calibration_mutex;
+/* where the calibration started, so it can be refined later */
+static uint64_t _start_ticks = 0;
+static double _start_seconds = 0.0;
+/* set once timestamps have been converted with the calibration */
+static bool _frozen = false;
+
+/* The thread that checks and refines the calibration, and what wakes it
+ * early. Joined by stop_background(), or at exit if finalize() wasn't
+ * called. */
+static std::thread _background;
+static std::mutex _background_mutex;
+static std::condition_variable _background_wake;
+static bool _background_stop = false;
+static struct background_joiner {
+  ~background_joiner(void) { tsc::stop_background(); }
+} _background_joiner;
+
+static double raw_seconds(void) {
+  struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+/* Read the TSC and the raw monotonic clock as close together as we can:
+ * of a few tries, keep the one where the clock reads were closest. */
+static void read_pair(uint64_t &ticks, double &seconds) {
+  double best = 1.0e9;
+  ticks = 0;
+  seconds = 0.0;
+  for (int i = 0 ; i < 5 ; i++) {
+    double before = raw_seconds();
+    uint64_t now = tsc::read();
+    double after = raw_seconds();
+    if (after - before < best) {
+      best = after - before;
+      ticks = now;
+      seconds = before + (best / 2.0);
+    }
+  }
+}
+
+bool tsc::is_invariant(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) {
+    return false;
+  }
+  __cpuid(0x80000007, eax, ebx, ecx, edx);
+  return (edx & (1 << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+double tsc::reported_frequency(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  // The TSC / crystal clock ratio, and the crystal clock frequency
+  if (__get_cpuid_max(0, nullptr) >= 0x15) {
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+    if (eax != 0 && ebx != 0 && ecx != 0) {
+      return (double)ecx * (double)ebx / (double)eax;
+    }
+  }
+#endif
+  // Some kernels export the frequency they calibrated at boot
+  std::ifstream khz_file("/sys/devices/system/cpu/cpu0/tsc_freq_khz");
+  double khz = 0.0;
+  if (khz_file.good() && (khz_file >> khz) && khz > 0.0) {
+    return khz * 1000.0;
+  }
+  return 0.0;
+}
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+static void pin_to(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Pass a TSC value back and forth between two cores. A value read after
+ * seeing the other core's value should never be smaller than it. */
+static bool skewed_pair(int cpu_a, int cpu_b) {
+  std::atomic<uint64_t> stamp(0);
+  std::atomic<int> turn(0);
+  std::atomic<bool> skewed(false);
+  auto player = [&](int cpu, int me) {
+    pin_to(cpu);
+    for (int round = 0 ; round < APEX_TSC_SKEW_ROUNDS ; round++) {
+      int spins = 0;
+      while (turn.load(std::memory_order_acquire) != me) {
+        if (++spins % 1024 == 0) {
+          std::this_thread::yield();
+        }
+      }
+      uint64_t now = tsc::read();
+      if (now < stamp.load(std::memory_order_relaxed)) {
+        skewed = true;
+      }
+      stamp.store(now, std::memory_order_relaxed);
+      turn.store(1 - me, std::memory_order_release);
+    }
+  };
+  std::thread a(player, cpu_a, 0);
+  std::thread b(player, cpu_b, 1);
+  a.join();
+  b.join();
+  return skewed;
+}
+#endif
+
+bool tsc::check_skew(void) {
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return false;
+  }
+  std::vector<int> cpus;
+  for (int i = 0 ; i < CPU_SETSIZE && cpus.size() < APEX_TSC_SKEW_MAX_CPUS ; i++) {
+    if (CPU_ISSET(i, &allowed)) {
+      cpus.push_back(i);
+    }
+  }
+  for (size_t i = 1 ; i < cpus.size() ; i++) {
+    if (skewed_pair(cpus[0], cpus[i])) {
+      return true;
+    }
+  }
+#endif
+  return false;
+}
+
+void tsc::calibrate(void) {
+  std::unique_lock<std::mutex> l(_calibration_mutex);
+  if (_seconds_per_tick.load() != 0.0) {
+    return;
+  }
+  double reported = reported_frequency();
+  read_pair(_start_ticks, _start_seconds);
+  double interval = reported > 0.0 ? APEX_TSC_VERIFY_INTERVAL : APEX_TSC_CALIBRATE_INTERVAL;
+  uint64_t ticks = _start_ticks;
+  double seconds = _start_seconds;
+  while (seconds - _start_seconds < interval || ticks == _start_ticks) {
+    read_pair(ticks, seconds);
+  }
+  double measured = (seconds - _start_seconds) / (double)(ticks - _start_ticks);
+  double result = measured;
+  // if the reported frequency is exact, there is no need to refine it
+  bool exact = reported > 0.0 && fabs((measured * reported) - 1.0) < APEX_TSC_TOLERANCE;
+  if (exact) {
+    result = 1.0 / reported;
+  }
+  _seconds_per_tick.store(result);
+  if (apex_options::use_screen_output()) {
+    std::cout << "CPU is " << (1.0/result) << " Hz." << std::endl;
+  }
+  _background = std::thread(check_in_background, !exact);
+}
+
+/* Check the cores' counters agree, falling back to the monotonic clock if
+ * they don't, then refine the measurement a second after it started. */
+void tsc::check_in_background(bool refine_later) {
+  if (check_skew()) {
+    if (apex_options::use_screen_output()) {
+      std::cout << "The TSCs of different cores are not synchronized, "
+                << "so timers use the monotonic clock." << std::endl;
+    }
+    // the fallback counts in the current ticks, so they must not change
+    clock_source::tsc_unreliable();
+    return;
+  }
+  if (!refine_later) {
+    return;
+  }
+  double wait = _start_seconds + APEX_TSC_REFINE_INTERVAL - raw_seconds();
+  if (wait > 0.0) {
+    std::unique_lock<std::mutex> l(_background_mutex);
+    _background_wake.wait_for(l, std::chrono::duration<double>(wait),
+                              []() { return _background_stop; });
+  }
+  refine();
+}
+
+void tsc::refine(void) {
+  std::unique_lock<std::mutex> l(_calibration_mutex);
+  if (_frozen) {
+    return;
+  }
+  uint64_t ticks;
+  double seconds;
+  read_pair(ticks, seconds);
+  _seconds_per_tick.store((seconds - _start_seconds) / (double)(ticks - _start_ticks));
+}
+
+void tsc::freeze(void) {
+  std::unique_lock<std::mutex> l(_calibration_mutex);
+  _frozen = true;
+}
+
+void tsc::stop_background(void) {
+  {
+    std::unique_lock<std::mutex> l(_background_mutex);
+    _background_stop = true;
+  }
+  _background_wake.notify_all();
+  std::thread background;
+  {
+    // calibrate() starts the thread under this lock, and the thread's
+    // refine() needs it, so join it after letting go
+    std::unique_lock<std::mutex> l(_calibration_mutex);
+    background.swap(_background);
+  }
+  if (background.joinable()) {
+    background.join();
+  }
+}
+
+double tsc::seconds_per_tick(void) {
+  double result = _seconds_per_tick.load(std::memory_order_relaxed);
+  if (result == 0.0) {
+    calibrate();
+    result = _seconds_per_tick.load();
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,61 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace apex {
+
+/* The time stamp counter, and its calibration.
+ *
+ * The TSC frequency is taken from CPUID (leaf 0x15) or sysfs when the
+ * processor or kernel reports it, and checked against a short (a few
+ * milliseconds) measurement against CLOCK_MONOTONIC_RAW. Otherwise the
+ * measurement is used, and refined over a longer interval about a second
+ * later. The refinement, and the check that the counters of all the cores
+ * agree, are made on a thread of their own, off the startup path, which
+ * finalize() stops. If the counters disagree, the TSC clock falls back to
+ * the monotonic clock (see clock_source.hpp). Once a timestamp has been
+ * converted with it, the calibration doesn't change. */
+class tsc {
+private:
+  static std::atomic<double> _seconds_per_tick;
+  static void calibrate(void);
+  static void refine(void);
+  static void check_in_background(bool refine_later);
+public:
+  /* Read the counter. The lfence keeps the read from being executed
+   * before the instructions preceding it have completed. */
+  static inline uint64_t read(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned lo, hi;
+    asm volatile("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+    return 0;
+#endif
+  }
+  /* The length of one tick, in seconds. Calibrates on first use. */
+  static double seconds_per_tick(void);
+  /* Whether the counter runs at a constant rate in all power states
+   * (CPUID 0x80000007, EDX bit 8) */
+  static bool is_invariant(void);
+  /* The frequency reported by CPUID leaf 0x15 or by the kernel, in Hz.
+   * 0 if not reported. */
+  static double reported_frequency(void);
+  /* Compare the counters of each core this process may run on with the
+   * first one. Returns true if a counter was seen to run behind. */
+  static bool check_skew(void);
+  /* Keep the calibration as it is from now on. */
+  static void freeze(void);
+  /* Wake the background check, refine the calibration now if it was
+   * waiting to, and wait for the thread to finish. */
+  static void stop_background(void);
+};
+
+}
+
@@ -0,0 +1,350 @@
+/*
+ * Measure the cost of the APEX instrumentation calls, in nanoseconds per
+ * operation, at 1, 2, 4 ... N threads. The listeners are chosen with the
+ * usual environment variables (APEX_POLICY, APEX_MEASURE_CONCURRENCY,
+ * APEX_TAU, APEX_OTF2), so run the program once for each configuration.
+ *
+ * Usage: apex_benchmark [--output results.json] [--baseline baseline.json]
+ *                       [--threshold percent] [--slack ns]
+ *                       [--iterations n] [--threads max]
+ *
+ * The results are written as JSON, one result per line. With --baseline,
+ * the thread counts are the ones in the baseline (unless --threads is
+ * given), each result is compared with the baseline result for the same
+ * configuration, operation and thread count, and the program fails if it
+ * is more than threshold percent (plus slack nanoseconds, for the noise in
+ * very short operations) slower, or if the baseline has no such result.
+ * A baseline line can carry its own "threshold".
+ *
+ * To make a new baseline, on an otherwise idle machine, run each
+ * configuration alone with the same --threads and --iterations:
+ *   APEX_POLICY=0 apex_benchmark --threads 8 --output profiler.json
+ *   APEX_POLICY=1 apex_benchmark --threads 8 --output policy.json
+ *   APEX_POLICY=0 APEX_MEASURE_CONCURRENCY=1 apex_benchmark --threads 8 \
+ *       --output concurrency.json
+ * and concatenate the result lines into one "benchmarks" list.
+ */
+
+#include "apex_api.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+using namespace std;
+
+struct result {
+    string configuration;
+    string operation;
+    int threads;
+    double ns_per_op;
+    double threshold; // percent, or < 0 for the default
+};
+
+static int iterations = 100000;
+static apex_event_type custom_type;
+static apex::counter_handle counter;
+
+static void dummy_function(void) { }
+
+/* The operations to time. Each does one operation, iterations times. */
+static void start_stop_name(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::stop(apex::start("benchmark timer"));
+    }
+}
+
+static void start_stop_address(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::stop(apex::start((apex_function_address)&dummy_function));
+    }
+}
+
+static void start_stop_handle(int n) {
+    apex::task_identifier * id = apex::register_timer("benchmark handle");
+    for (int i = 0 ; i < n ; i++) {
+        apex::stop(apex::start(id));
+    }
+}
+
+static void yield_resume(int n) {
+    apex::profiler * p = apex::start("benchmark yield");
+    for (int i = 0 ; i < n ; i++) {
+        apex::yield(p);
+        p = apex::resume("benchmark yield");
+    }
+    apex::stop(p);
+}
+
+static void sample_value_name(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::sample_value("benchmark counter", (double)i);
+    }
+}
+
+static void sample_value_handle(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::sample_value(counter, (double)i);
+    }
+}
+
+static void new_task(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::new_task("benchmark task", (uint64_t)i);
+    }
+}
+
+static void custom_event(int n) {
+    for (int i = 0 ; i < n ; i++) {
+        apex::custom_event(custom_type, nullptr);
+    }
+}
+
+/* The threads that run the operations. They are started once, and only
+ * exit at the end: some listeners (the concurrency handler) stop measuring
+ * once any thread exits. */
+static vector<thread> workers;
+static mutex pool_mutex;
+static condition_variable pool_cv;
+static int generation = 0;
+static bool quit = false;
+static function<void(int)> current_operation;
+static int active_threads = 0;
+static atomic<int> ready(0);
+static atomic<int> finished(0);
+static atomic<bool> go(false);
+static vector<double> elapsed;
+
+static void worker(int t) {
+    apex::register_thread("benchmark thread");
+    int seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [&]() { return quit || generation != seen; });
+            if (quit) { break; }
+            seen = generation;
+        }
+        if (t < active_threads) {
+            // warm up - register the timers, fill the caches
+            current_operation(iterations / 100 + 1);
+            ready++;
+            while (!go) { this_thread::yield(); }
+            auto start = chrono::steady_clock::now();
+            current_operation(iterations);
+            auto end = chrono::steady_clock::now();
+            elapsed[t] = chrono::duration<double, nano>(end - start).count();
+        }
+        finished++;
+    }
+    apex::exit_thread();
+}
+
+/* Run the operation on num_threads of the threads at once, and return the
+ * mean time per operation. */
+static double run(function<void(int)> operation, int num_threads) {
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        current_operation = operation;
+        active_threads = num_threads;
+        ready = 0;
+        finished = 0;
+        go = false;
+        generation++;
+    }
+    pool_cv.notify_all();
+    while (ready < num_threads) { this_thread::yield(); }
+    go = true;
+    while (finished < (int)workers.size()) { this_thread::yield(); }
+    double total = 0.0;
+    for (int t = 0 ; t < num_threads ; t++) {
+        total += elapsed[t];
+    }
+    return total / num_threads / iterations;
+}
+
+static void start_workers(int num_threads) {
+    elapsed.resize(num_threads);
+    for (int t = 0 ; t < num_threads ; t++) {
+        workers.push_back(thread(worker, t));
+    }
+}
+
+static void stop_workers(void) {
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        quit = true;
+    }
+    pool_cv.notify_all();
+    for (auto &w : workers) {
+        w.join();
+    }
+}
+
+static string configuration(void) {
+    string name("profiler");
+    if (apex::apex_options::use_policy()) { name += "+policy"; }
+    if (apex::apex_options::use_concurrency() > 0) { name += "+concurrency"; }
+    if (apex::apex_options::use_tau()) { name += "+tau"; }
+    if (apex::apex_options::use_otf2()) { name += "+otf2"; }
+    return name;
+}
+
+static string to_json(const result &r) {
+    stringstream ss;
+    ss << "{\"configuration\": \"" << r.configuration
+       << "\", \"operation\": \"" << r.operation
+       << "\", \"threads\": " << r.threads
+       << ", \"ns_per_op\": " << r.ns_per_op;
+    if (r.threshold >= 0.0) {
+        ss << ", \"threshold\": " << r.threshold;
+    }
+    ss << "}";
+    return ss.str();
+}
+
+static void write_results(ostream &out, const vector<result> &results) {
+    out << "{\"benchmarks\": [" << endl;
+    for (size_t i = 0 ; i < results.size() ; i++) {
+        out << to_json(results[i]) << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "]}" << endl;
+}
+
+/* Find "key": in the line, and return what follows it, or "" */
+static string field(const string &line, const string &key) {
+    size_t pos = line.find("\"" + key + "\":");
+    if (pos == string::npos) { return string(""); }
+    pos = line.find_first_not_of(" \"", pos + key.size() + 3);
+    size_t end = line.find_first_of("\",}", pos);
+    return line.substr(pos, end - pos);
+}
+
+static vector<result> read_baseline(const string &filename) {
+    vector<result> results;
+    ifstream in(filename);
+    if (!in.good()) {
+        cerr << "Can't read the baseline " << filename << endl;
+        exit(1);
+    }
+    string line;
+    while (getline(in, line)) {
+        if (field(line, "operation").empty()) { continue; }
+        result r;
+        r.configuration = field(line, "configuration");
+        r.operation = field(line, "operation");
+        r.threads = atoi(field(line, "threads").c_str());
+        r.ns_per_op = atof(field(line, "ns_per_op").c_str());
+        string threshold = field(line, "threshold");
+        r.threshold = threshold.empty() ? -1.0 : atof(threshold.c_str());
+        results.push_back(r);
+    }
+    return results;
+}
+
+int main (int argc, char** argv) {
+    string output, baseline;
+    double threshold = 100.0;
+    double slack = 50.0;
+    int max_threads = 0;
+    for (int i = 1 ; i < argc - 1 ; i += 2) {
+        string arg(argv[i]);
+        if (arg == "--output") { output = argv[i+1]; }
+        else if (arg == "--baseline") { baseline = argv[i+1]; }
+        else if (arg == "--threshold") { threshold = atof(argv[i+1]); }
+        else if (arg == "--slack") { slack = atof(argv[i+1]); }
+        else if (arg == "--iterations") { iterations = atoi(argv[i+1]); }
+        else if (arg == "--threads") { max_threads = atoi(argv[i+1]); }
+    }
+    vector<result> expected;
+    if (!baseline.empty()) {
+        expected = read_baseline(baseline);
+        // run the thread counts the baseline was measured at
+        if (max_threads == 0) {
+            for (auto &e : expected) {
+                if (e.threads > max_threads) { max_threads = e.threads; }
+            }
+        }
+    }
+    if (max_threads == 0) { max_threads = thread::hardware_concurrency(); }
+    if (max_threads < 1) { max_threads = 1; }
+    // keep the profile of the benchmark itself off the screen
+    apex::apex_options::use_screen_output(false);
+    apex::init(argc, argv, "APEX benchmark");
+    custom_type = apex::register_custom_event("benchmark event");
+    counter = apex::register_counter("benchmark handle counter");
+
+    vector<pair<string, function<void(int)> > > operations = {
+        {"start_stop_name", start_stop_name},
+        {"start_stop_address", start_stop_address},
+        {"start_stop_handle", start_stop_handle},
+        {"yield_resume", yield_resume},
+        {"sample_value_name", sample_value_name},
+        {"sample_value_handle", sample_value_handle},
+        {"new_task", new_task},
+        {"custom_event", custom_event}
+    };
+    vector<result> results;
+    string config = configuration();
+    start_workers(max_threads);
+    for (int threads = 1 ; ; threads *= 2) {
+        if (threads > max_threads) { threads = max_threads; }
+        for (auto &op : operations) {
+            result r = { config, op.first, threads, run(op.second, threads), -1.0 };
+            results.push_back(r);
+        }
+        if (threads == max_threads) { break; }
+    }
+    stop_workers();
+    apex::finalize();
+
+    write_results(cout, results);
+    if (!output.empty()) {
+        ofstream out(output);
+        write_results(out, results);
+    }
+
+    int regressions = 0;
+    if (!baseline.empty()) {
+        for (auto &r : results) {
+            bool found = false;
+            for (auto &e : expected) {
+                if (e.configuration != r.configuration ||
+                    e.operation != r.operation || e.threads != r.threads) {
+                    continue;
+                }
+                found = true;
+                double limit = e.threshold >= 0.0 ? e.threshold : threshold;
+                double allowed = e.ns_per_op * (1.0 + limit / 100.0) + slack;
+                if (r.ns_per_op > allowed) {
+                    cout << "Regression: " << r.configuration << " " << r.operation
+                         << " at " << r.threads << " threads took " << r.ns_per_op
+                         << " ns per operation, the baseline is " << e.ns_per_op
+                         << " (allowed " << allowed << ")." << endl;
+                    regressions++;
+                }
+            }
+            // a result that can't be compared is not a pass
+            if (!found) {
+                cout << "No baseline for " << r.configuration << " " << r.operation
+                     << " at " << r.threads << " threads." << endl;
+                regressions++;
+            }
+        }
+    }
+    apex::cleanup();
+    if (regressions > 0) {
+        return 1;
+    }
+    cout << "Benchmark passed." << endl;
+    return 0;
+}
+
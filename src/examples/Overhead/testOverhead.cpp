@@ -139,13 +139,8 @@ int main(int argc, char **argv)
     double percent = ((with->accumulated/with->calls) / (without->accumulated/without->calls)) - 1.0;
     double foopercall = footime->accumulated / footime->calls;
     std::cout << "Average overhead per timer: ";
-#ifdef APEX_USE_CLOCK_TIMESTAMP
-    std::cout << percall1*1.0e9;
-    std::cout << METRIC << " (" << percent*100.0 << "%), per call time in foo: " << (foopercall*1.0e9) << METRIC << std::endl;
-#else
     std::cout << percall1;
     std::cout << METRIC << " (" << percent*100.0 << "%), per call time in foo: " << foopercall << METRIC << std::endl;
-#endif
   }
   apex::cleanup();
   return(0);
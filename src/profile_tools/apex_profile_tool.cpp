@@ -0,0 +1,115 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+/* Merge, sort and convert the binary profiles APEX writes with
+ * APEX_BINARY_OUTPUT. */
+
+#include "profile_merge.hpp"
+#include "apex_types.h"
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace apex;
+
+static void usage(const char * program) {
+  std::cerr << "Usage: " << program << " [options] apex.<node>.prof ..." << std::endl
+            << "Merges the profiles by timer and counter name. Options:" << std::endl
+            << "  --sort name|calls|inclusive|exclusive   the order to write them in"
+            << " (default: inclusive)" << std::endl
+            << "  --output file   write the merged profile, in the binary format" << std::endl
+            << "  --csv file      write it as CSV" << std::endl
+            << "  --tau file      write it as a TAU profile (profile.0.0.0, for example)" << std::endl
+            << "  --top n         with no output files, how many to list (default: 20)" << std::endl;
+}
+
+int main(int argc, char * argv[]) {
+  profile_merge::sort_key key = profile_merge::by_inclusive;
+  std::string output, csv, tau;
+  size_t top = 20;
+  std::vector<std::string> files;
+  for (int i = 1 ; i < argc ; i++) {
+    std::string arg(argv[i]);
+    bool has_value = i + 1 < argc;
+    if (arg == "--sort" && has_value) {
+      std::string value(argv[++i]);
+      if (value == "name") {
+        key = profile_merge::by_name;
+      } else if (value == "calls") {
+        key = profile_merge::by_calls;
+      } else if (value == "inclusive") {
+        key = profile_merge::by_inclusive;
+      } else if (value == "exclusive") {
+        key = profile_merge::by_exclusive;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (arg == "--output" && has_value) {
+      output = argv[++i];
+    } else if (arg == "--csv" && has_value) {
+      csv = argv[++i];
+    } else if (arg == "--tau" && has_value) {
+      tau = argv[++i];
+    } else if (arg == "--top" && has_value) {
+      top = strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-h" || arg == "--help" || arg.compare(0, 2, "--") == 0) {
+      usage(argv[0]);
+      return arg.compare(0, 2, "--") == 0 && arg != "--help" ? 1 : 0;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  profile_merge merged;
+  profile_file file;
+  int status = 0;
+  for (const std::string &name : files) {
+    if (!file.open(name)) {
+      std::cerr << "Warning: skipping " << file.error() << std::endl;
+      status = 1;
+      continue;
+    }
+    merged.add(file);
+    file.close();
+  }
+  if (merged.num_files() == 0) {
+    return 1;
+  }
+  merged.sort(key);
+
+  if (!output.empty() && !merged.write_profile(output)) {
+    status = 1;
+  }
+  if (!csv.empty() && !merged.write_csv(csv)) {
+    status = 1;
+  }
+  if (!tau.empty() && !merged.write_tau(tau)) {
+    status = 1;
+  }
+  if (output.empty() && csv.empty() && tau.empty()) {
+    std::cout << merged.num_files() << " files, " << merged.size() << " timers and counters" << std::endl;
+    std::cout << std::left << std::setw(48) << "name" << std::right
+              << std::setw(12) << "calls" << std::setw(14) << "inclusive"
+              << std::setw(14) << "exclusive" << std::endl;
+    for (size_t i = 0 ; i < merged.size() && i < top ; i++) {
+      const profile_merge::entry &e = merged[i];
+      std::string name(e.name.size() > 46 ? e.name.substr(0, 43) + "..." : e.name);
+      std::cout << std::left << std::setw(48) << name << std::right
+                << std::setw(12) << e.record.calls;
+      if (e.record.type == APEX_TIMER) {
+        std::cout << std::setw(14) << e.record.accumulated
+                  << std::setw(14) << e.record.exclusive;
+      }
+      std::cout << std::endl;
+    }
+  }
+  return status;
+}
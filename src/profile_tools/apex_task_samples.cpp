@@ -0,0 +1,89 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+/* Merge the task sample files APEX writes with APEX_TASK_SCATTERPLOT into
+ * the apex_task_samples.csv that task_scatterplot.py reads. */
+
+#include "profile_file.hpp"
+#include "output_buffer.hpp"
+#include <glob.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace apex;
+
+static void usage(const char * program) {
+  std::cerr << "Usage: " << program << " [--output file] [apex_task_samples.<node>.<pid>.bin ...]"
+            << std::endl
+            << "Merges the task samples into a CSV file for task_scatterplot.py. With no" << std::endl
+            << "files, merges the apex_task_samples.*.bin files in this directory." << std::endl
+            << "  --output file   the CSV file to write (default: apex_task_samples.csv)" << std::endl;
+}
+
+int main(int argc, char * argv[]) {
+  std::string output("apex_task_samples.csv");
+  std::vector<std::string> files;
+  for (int i = 1 ; i < argc ; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--output" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "-h" || arg == "--help" || arg.compare(0, 2, "--") == 0) {
+      usage(argv[0]);
+      return arg.compare(0, 2, "--") == 0 && arg != "--help" ? 1 : 0;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty()) {
+    glob_t found;
+    if (glob("apex_task_samples.*.bin", 0, nullptr, &found) == 0) {
+      for (size_t i = 0 ; i < found.gl_pathc ; i++) {
+        files.push_back(found.gl_pathv[i]);
+      }
+    }
+    globfree(&found);
+    if (files.empty()) {
+      std::cerr << "No apex_task_samples.*.bin files found." << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  output_buffer csv(1 << 20);
+  csv << "#timestamp value   name\n";
+  sample_file file;
+  int status = 0;
+  size_t num_files = 0;
+  uint64_t num_samples = 0;
+  uint64_t num_seen = 0;
+  for (const std::string &name : files) {
+    if (!file.open(name)) {
+      std::cerr << "Warning: skipping " << file.error() << std::endl;
+      status = 1;
+      continue;
+    }
+    for (uint32_t t = 0 ; t < file.num_timers() ; t++) {
+      const sample_file_sample * samples = file.samples(t);
+      const char * timer = file.name(t);
+      for (uint32_t s = 0 ; s < file.timer(t).num_samples ; s++) {
+        csv.printf("%.9g %g '%s'\n", samples[s].timestamp, samples[s].value, timer);
+      }
+      num_samples += file.timer(t).num_samples;
+      num_seen += file.timer(t).seen;
+    }
+    num_files++;
+    file.close();
+  }
+  if (num_files == 0) {
+    return 1;
+  }
+  if (!csv.write(output)) {
+    return 1;
+  }
+  std::cout << "Wrote " << num_samples << " samples of " << num_seen
+            << " timer stops from " << num_files << " files to " << output << std::endl;
+  return status;
+}
@@ -0,0 +1,197 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "profile_merge.hpp"
+#include "apex_types.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+
+namespace apex {
+
+void profile_merge::add(const profile_file &file) {
+  const profile_file_header &header = file.header();
+  _node = _num_files == 0 ? header.node : 0;
+  _num_files++;
+  _elapsed = std::max(_elapsed, header.elapsed);
+  // which entry each of the file's records went to
+  std::vector<uint32_t> mapping(file.num_records());
+  for (uint32_t i = 0 ; i < file.num_records() ; i++) {
+    const profile_file_record &record = file.record(i);
+    const char * name = file.name(i);
+    auto found = _index.find(name);
+    uint32_t index;
+    if (found == _index.end()) {
+      index = (uint32_t)_entries.size();
+      _index.emplace(name, index);
+      _order.push_back(index);
+      _entries.emplace_back();
+      entry &e = _entries.back();
+      e.name = name;
+      e.record = record;
+      e.parent = APEX_PROFILE_FILE_NONE;
+      e.leaf = APEX_PROFILE_FILE_NONE;
+    } else {
+      index = found->second;
+      profile_file_record &total = _entries[index].record;
+      if (record.calls > 0.0) {
+        total.minimum = total.calls > 0.0 ? std::min(total.minimum, record.minimum) : record.minimum;
+        total.maximum = total.calls > 0.0 ? std::max(total.maximum, record.maximum) : record.maximum;
+      }
+      total.calls += record.calls;
+      total.accumulated += record.accumulated;
+      total.exclusive += record.exclusive;
+      total.sum_squares += record.sum_squares;
+      total.flags |= record.flags;
+    }
+    mapping[i] = index;
+    if (file.has_histograms()) {
+      entry &e = _entries[index];
+      if (e.values == nullptr) {
+        e.values.reset(new histogram());
+      }
+      file.add_histogram(i, *(e.values));
+    }
+  }
+  // the call paths refer to records, so do them once all are mapped
+  for (uint32_t i = 0 ; i < file.num_records() ; i++) {
+    const profile_file_callpath * path = file.callpath(i);
+    if (path == nullptr) {
+      continue;
+    }
+    entry &e = _entries[mapping[i]];
+    if (path->parent < file.num_records()) {
+      e.parent = mapping[path->parent];
+    }
+    if (path->leaf < file.num_records()) {
+      e.leaf = mapping[path->leaf];
+    }
+  }
+}
+
+void profile_merge::sort(sort_key key) {
+  const std::vector<entry> &entries = _entries;
+  std::stable_sort(_order.begin(), _order.end(), [&entries, key](uint32_t a, uint32_t b) {
+    const entry &x = entries[a];
+    const entry &y = entries[b];
+    // counters have no time, so they go after the timers
+    bool timed = key == by_inclusive || key == by_exclusive;
+    if (timed && (x.record.type == APEX_TIMER) != (y.record.type == APEX_TIMER)) {
+      return x.record.type == APEX_TIMER;
+    }
+    switch (key) {
+      case by_calls:
+        return x.record.calls > y.record.calls;
+      case by_inclusive:
+        return x.record.accumulated > y.record.accumulated;
+      case by_exclusive:
+        return x.record.exclusive > y.record.exclusive;
+      default:
+        return x.name < y.name;
+    }
+  });
+}
+
+double profile_merge::quantile(const entry &e, double q) const {
+  if (e.values == nullptr) {
+    return 0.0;
+  }
+  return e.values->quantile(q, e.record.minimum, e.record.maximum);
+}
+
+bool profile_merge::write_profile(const std::string &filename) const {
+  // the merged histograms are already in seconds
+  profile_file_writer writer(_node, _elapsed, 1.0);
+  std::vector<uint32_t> position(_entries.size());
+  for (uint32_t i = 0 ; i < _order.size() ; i++) {
+    position[_order[i]] = i;
+  }
+  for (uint32_t i : _order) {
+    const entry &e = _entries[i];
+    writer.add(e.name, e.record, e.values.get());
+  }
+  for (uint32_t i : _order) {
+    const entry &e = _entries[i];
+    if (e.record.flags & APEX_PROFILE_RECORD_CALLPATH) {
+      writer.set_callpath(position[i],
+          e.parent == APEX_PROFILE_FILE_NONE ? APEX_PROFILE_FILE_NONE : position[e.parent],
+          e.leaf == APEX_PROFILE_FILE_NONE ? APEX_PROFILE_FILE_NONE : position[e.leaf]);
+    }
+  }
+  return writer.write(filename);
+}
+
+bool profile_merge::write_csv(const std::string &filename) const {
+  std::ofstream csv(filename);
+  csv << std::setprecision(17);
+  csv << "\"task\",\"type\",\"calls\",\"accumulated\",\"exclusive\",\"sum squares\",\"minimum\",\"maximum\"";
+  csv << ",\"p50\",\"p90\",\"p99\",\"p99.9\",\"estimated\"" << std::endl;
+  for (uint32_t i : _order) {
+    const entry &e = _entries[i];
+    const profile_file_record &r = e.record;
+    csv << "\"" << e.name << "\",";
+    csv << (r.type == APEX_TIMER ? "timer" : "counter") << ",";
+    csv << r.calls << "," << r.accumulated << "," << r.exclusive << ",";
+    csv << r.sum_squares << "," << r.minimum << "," << r.maximum << ",";
+    csv << quantile(e, 0.5) << "," << quantile(e, 0.9) << ",";
+    csv << quantile(e, 0.99) << "," << quantile(e, 0.999) << ",";
+    csv << ((r.flags & APEX_PROFILE_RECORD_ESTIMATE) ? 1 : 0) << std::endl;
+  }
+  csv.close();
+  if (!csv) {
+    std::cerr << "APEX Warning : can't write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/* The same layout as profiler_listener::write_profile() */
+bool profile_merge::write_tau(const std::string &filename) const {
+  std::ofstream tau(filename);
+  size_t counters = 0;
+  for (const entry &e : _entries) {
+    if (e.record.type != APEX_TIMER) {
+      counters++;
+    }
+  }
+  tau << (_entries.size() - counters) << " templated_functions_MULTI_TIME" << std::endl;
+  tau << "# Name Calls Subrs Excl Incl ProfileCalls #" << std::endl;
+  for (uint32_t i : _order) {
+    const entry &e = _entries[i];
+    const profile_file_record &r = e.record;
+    if (r.type != APEX_TIMER) {
+      continue;
+    }
+    tau << "\"" << e.name << "\" ";
+    tau << r.calls << " " << 0 << " " << r.exclusive << " " << r.accumulated << " " << 0 << " ";
+    tau << "GROUP=\"" << ((r.flags & APEX_PROFILE_RECORD_CALLPATH) ? "TAU_CALLPATH" : "TAU_USER");
+    tau << ((r.flags & APEX_PROFILE_RECORD_ESTIMATE) ? "|APEX_ESTIMATE\" " : "\" ") << std::endl;
+  }
+  tau << "0 aggregates" << std::endl;
+  if (counters > 0) {
+    tau << counters << " userevents" << std::endl;
+    tau << "# eventname numevents max min mean sumsqr" << std::endl;
+    for (uint32_t i : _order) {
+      const entry &e = _entries[i];
+      const profile_file_record &r = e.record;
+      if (r.type == APEX_TIMER) {
+        continue;
+      }
+      tau << "\"" << e.name << "\" ";
+      tau << r.calls << " " << r.maximum << " " << r.minimum << " ";
+      tau << (r.calls > 0.0 ? r.accumulated / r.calls : 0.0) << " " << r.sum_squares << " " << std::endl;
+    }
+  }
+  tau.close();
+  if (!tau) {
+    std::cerr << "APEX Warning : can't write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,55 @@
+//  Copyright (c) 2014 University of Oregon
+//
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "profile_file.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace apex {
+
+/* Profiles from any number of binary profile files, merged by name, and
+ * written back out as one binary profile, as CSV, or as a TAU profile.
+ * Calls, times and sums of squares are added up, the minimum and maximum
+ * are of all of the files, and the histograms are merged, so the
+ * quantiles are for all of the files too. */
+class profile_merge {
+public:
+  struct entry {
+    std::string name;
+    profile_file_record record;
+    std::unique_ptr<histogram> values;  // in seconds, for a timer
+    // the merged entries for a call path's parent and leaf
+    uint32_t parent;
+    uint32_t leaf;
+  };
+  enum sort_key { by_name, by_calls, by_inclusive, by_exclusive };
+private:
+  std::vector<entry> _entries;
+  std::unordered_map<std::string, uint32_t> _index;
+  // the order to write the entries in
+  std::vector<uint32_t> _order;
+  size_t _num_files;
+  uint32_t _node;
+  double _elapsed;
+  double quantile(const entry &e, double q) const;
+public:
+  profile_merge(void) : _num_files(0), _node(0), _elapsed(0.0) { }
+  void add(const profile_file &file);
+  size_t num_files(void) const { return _num_files; }
+  size_t size(void) const { return _entries.size(); }
+  /* The entries, in order */
+  const entry &operator[](size_t i) const { return _entries[_order[i]]; }
+  /* Sort by name, or by the largest values first */
+  void sort(sort_key key);
+  bool write_profile(const std::string &filename) const;
+  bool write_csv(const std::string &filename) const;
+  bool write_tau(const std::string &filename) const;
+};
+
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+
+"""
+Merge the profile snapshots APEX writes with APEX_PROFILE_SNAPSHOT_PERIOD
+(apex.<node>.snapshot.<sequence>.csv), either back into one whole profile,
+or into a time series with one row per timer per snapshot.
+
+Usage: apex_merge_snapshots.py [--timeseries] [--output file] [snapshot files]
+
+With no files, all of the snapshots in the current directory are used.
+"""
+
+from __future__ import print_function
+
+import csv
+import glob
+import re
+import sys
+
+def read_snapshot(fname):
+    """ Returns the header values (node, sequence, timestamp, interval) and
+    the rows, as dictionaries. """
+    header = {}
+    rows = []
+    with open(fname, 'r') as f:
+        lines = []
+        for line in f:
+            if line.startswith('#'):
+                fields = line[1:].split()
+                if len(fields) == 2:
+                    header[fields[0]] = fields[1]
+            else:
+                lines.append(line)
+        for row in csv.DictReader(lines):
+            for key in ['calls', 'accumulated', 'exclusive', 'sum squares', 'minimum', 'maximum']:
+                row[key] = float(row[key])
+            rows.append(row)
+    return header, rows
+
+def snapshot_order(fname):
+    match = re.search(r'apex\.(\d+)\.snapshot\.(\d+)\.csv$', fname)
+    if match:
+        return (int(match.group(1)), int(match.group(2)))
+    return (0, 0)
+
+def merge(snapshots):
+    """ Add up the differences in each snapshot, keeping the last minimum
+    and maximum, which are for the whole run. """
+    merged = {}
+    for header, rows in snapshots:
+        for row in rows:
+            name = row['task']
+            if name not in merged:
+                merged[name] = dict(row)
+                continue
+            total = merged[name]
+            for key in ['calls', 'accumulated', 'exclusive', 'sum squares']:
+                total[key] += row[key]
+            total['minimum'] = row['minimum']
+            total['maximum'] = row['maximum']
+    return merged
+
+def check_sequence(snapshots):
+    expected = {}
+    for header, rows in snapshots:
+        node = header.get('node', '0')
+        sequence = int(header.get('sequence', '0'))
+        if node in expected and sequence != expected[node]:
+            print("Warning: node %s is missing snapshots %d to %d" %
+                  (node, expected[node], sequence - 1), file=sys.stderr)
+        expected[node] = sequence + 1
+
+def main(argv):
+    timeseries = False
+    output = None
+    files = []
+    i = 1
+    while i < len(argv):
+        if argv[i] == '--timeseries':
+            timeseries = True
+        elif argv[i] == '--output' and i + 1 < len(argv):
+            i = i + 1
+            output = argv[i]
+        elif argv[i] in ['-h', '--help']:
+            print(__doc__)
+            return 0
+        else:
+            files.append(argv[i])
+        i = i + 1
+    if len(files) == 0:
+        files = glob.glob('apex.*.snapshot.*.csv')
+    if len(files) == 0:
+        print("No snapshots found.", file=sys.stderr)
+        return 1
+    files.sort(key=snapshot_order)
+    snapshots = [read_snapshot(f) for f in files]
+    check_sequence(snapshots)
+
+    out = open(output, 'w') if output else sys.stdout
+    writer = csv.writer(out, quoting=csv.QUOTE_NONNUMERIC)
+    columns = ['calls', 'accumulated', 'exclusive', 'sum squares', 'minimum', 'maximum']
+    if timeseries:
+        writer.writerow(['node', 'sequence', 'timestamp', 'interval', 'task', 'type'] + columns)
+        for header, rows in snapshots:
+            for row in rows:
+                writer.writerow([int(header.get('node', '0')), int(header.get('sequence', '0')),
+                                 float(header.get('timestamp', '0')), float(header.get('interval', '0')),
+                                 row['task'], row['type']] + [row[c] for c in columns])
+    else:
+        merged = merge(snapshots)
+        writer.writerow(['task', 'type'] + columns)
+        for name in sorted(merged.keys()):
+            row = merged[name]
+            writer.writerow([name, row['type']] + [row[c] for c in columns])
+    if output:
+        out.close()
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -23,6 +23,12 @@ def shorten_name(name):
     short = (tmp[:77] + '...') if len(tmp) > 77 else tmp
     return short.replace('_', '$\_$')
 
+# APEX writes the samples in binary, one file per process; apex_task_samples
+# merges them into this file
+if not os.path.exists('apex_task_samples.csv'):
+    print "apex_task_samples.csv not found: run apex_task_samples first, to merge the apex_task_samples.*.bin files"
+    sys.exit(1)
+
 dictionary = {}
 with open ('apex_task_samples.csv', 'rb') as csvfile:
     spamreader = csv.reader(csvfile, delimiter=' ', quotechar='\'')
@@ -0,0 +1,85 @@
+#include "apex_api.hpp"
+#include "profile_file.hpp"
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+using namespace apex;
+using namespace std;
+
+static uint32_t find_record(const profile_file &file, const string &name) {
+  for (uint32_t i = 0 ; i < file.num_records() ; i++) {
+    if (name == file.name(i)) {
+      return i;
+    }
+  }
+  return APEX_PROFILE_FILE_NONE;
+}
+
+/* Check the record against the profile from the API */
+static bool check_record(const profile_file &file, const string &name, double scale) {
+  uint32_t i = find_record(file, name);
+  apex_profile * profile = get_profile(name);
+  if (i == APEX_PROFILE_FILE_NONE || profile == nullptr) {
+    cout << name << " is missing" << endl;
+    return false;
+  }
+  const profile_file_record &r = file.record(i);
+  size_t count;
+  const profile_file_bucket * buckets = file.buckets(i, count);
+  uint64_t values = 0;
+  for (size_t j = 0 ; j < count ; j++) {
+    values += buckets[j].count;
+  }
+  cout << name << " : " << r.calls << " calls, " << r.accumulated
+       << " accumulated, " << values << " in the histogram" << endl;
+  return r.calls == profile->calls && r.type == (uint32_t)profile->type &&
+         fabs(r.accumulated - profile->accumulated * scale) <= 1.0e-9 * r.accumulated &&
+         values == (uint64_t)profile->calls;
+}
+
+int main (int argc, char** argv) {
+  apex_options::use_binary_output(true);
+  apex_options::callpath_depth(2);
+  init(argc, argv, "apex binary profile unit test");
+  cout << "APEX Version : " << version() << endl;
+  for (int i = 0 ; i < 100 ; i++) {
+    profiler * outer = start("binary outer");
+    profiler * inner = start("binary inner");
+    sample_value("binary counter", i);
+    stop(inner);
+    stop(outer);
+  }
+  finalize();
+
+  profile_file file;
+  bool passed = file.open("apex.0.prof");
+  if (!passed) {
+    cout << file.error() << endl;
+  } else {
+    // the API's timers are in clock ticks, the file's in seconds
+    double scale = file.header().tick_seconds;
+    uint32_t o = find_record(file, "binary outer");
+    passed = check_record(file, "binary outer", scale) &&
+             check_record(file, "binary inner", scale) &&
+             check_record(file, "binary counter", 1.0);
+    uint32_t path = find_record(file, "binary outer => binary inner");
+    const profile_file_callpath * cp = path == APEX_PROFILE_FILE_NONE ? nullptr : file.callpath(path);
+    if (cp == nullptr || cp->parent != o ||
+        cp->leaf != find_record(file, "binary inner") ||
+        file.record(path).calls != 100) {
+      cout << "The call path is missing or wrong" << endl;
+      passed = false;
+    }
+    file.close();
+  }
+  remove("apex.0.prof");
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
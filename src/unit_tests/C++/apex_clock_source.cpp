@@ -0,0 +1,54 @@
+#include "apex_api.hpp"
+#include "profiler.hpp"
+#include <iostream>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_CALLS 10
+#define SLEEP_USEC 20000
+
+/* Time some sleeps with the clock APEX_CLOCK_SOURCE chooses, and check
+ * the total is right to within the clock's resolution. */
+int main (int argc, char** argv) {
+  // measure every call
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex clock source unit test");
+  cout << "APEX Version : " << version() << endl;
+  string source(apex_options::clock_source());
+  // each measurement can be off by up to a tick of the clock
+  double resolution = 1.0e-6;
+  if (source == "monotonic_coarse") {
+    struct timespec res;
+    clock_getres(CLOCK_MONOTONIC_COARSE, &res);
+    resolution = res.tv_sec + res.tv_nsec * 1.0e-9;
+  }
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    profiler * p = start("clock source timer");
+    usleep(SLEEP_USEC);
+    stop(p);
+  }
+  finalize();
+  apex_profile * profile = get_profile("clock source timer");
+  double slept = NUM_CALLS * SLEEP_USEC * 1.0e-6;
+  bool passed = false;
+  if (profile) {
+    // the profiles are kept in clock ticks
+    double measured = profile->accumulated * profiler::get_cpu_mhz();
+    cout << "Clock : " << source << ", resolution : " << resolution
+         << ", slept : " << slept << ", measured : " << measured << endl;
+    // the sleeps can run long, but never short
+    passed = profile->calls == NUM_CALLS &&
+             measured >= slept - NUM_CALLS * resolution &&
+             measured < slept * 2.0 + NUM_CALLS * resolution;
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
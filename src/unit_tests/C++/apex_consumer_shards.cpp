@@ -0,0 +1,80 @@
+#include "apex_api.hpp"
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_THREADS 4
+#define NUM_TIMERS 16
+#define NUM_CALLS 500
+
+static string timer_name(int t) {
+  stringstream name;
+  name << "shard timer " << t;
+  return name.str();
+}
+
+void * worker(void) {
+  register_thread("apex consumer shards worker");
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    for (int t = 0 ; t < NUM_TIMERS ; t++) {
+      profiler * p = start(timer_name(t));
+      stop(p);
+    }
+  }
+  exit_thread();
+  return nullptr;
+}
+
+/* Run with APEX_NUM_CONSUMERS=4: each timer belongs to one consumer's
+ * shard, so each shows up once, with every call, however the timers are
+ * spread over the consumers. */
+int main (int argc, char** argv) {
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex consumer shards unit test");
+  cout << "APEX Version : " << version() << endl;
+  if (apex_options::num_consumers() != 4) {
+    cout << "APEX_NUM_CONSUMERS is " << apex_options::num_consumers()
+         << ", not 4" << endl;
+    cleanup();
+    return 1;
+  }
+  vector<thread> threads;
+  for (int i = 0 ; i < NUM_THREADS ; i++) {
+    threads.push_back(thread(worker));
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+  finalize();
+  map<string, int> seen;
+  bool passed = true;
+  for (auto &it : get_profile_snapshots()) {
+    if (it.first.compare(0, 12, "shard timer ") != 0) {
+      continue;
+    }
+    seen[it.first]++;
+    if (it.second.calls != NUM_THREADS * NUM_CALLS) {
+      cout << it.first << " : " << it.second.calls << " calls" << endl;
+      passed = false;
+    }
+  }
+  for (int t = 0 ; t < NUM_TIMERS ; t++) {
+    if (seen[timer_name(t)] != 1) {
+      cout << timer_name(t) << " has " << seen[timer_name(t)] << " profiles" << endl;
+      passed = false;
+    }
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
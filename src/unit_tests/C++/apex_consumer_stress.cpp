@@ -0,0 +1,116 @@
+/*
+ * A stress harness for the profiler_listener consumer. K producer threads
+ * start and stop a timer at a controlled rate, and the harness reports the
+ * sustained drain rate, the queue high-water mark and the end-to-end event
+ * latency, from the queue health counters.
+ *
+ * Usage: apex_consumer_stress_cpp [producers] [events per second per
+ *                                 producer] [seconds]
+ */
+
+#include "apex_api.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+using namespace std;
+
+static int num_producers = 4;
+static double rate = 100000.0;
+static double seconds = 2.0;
+static atomic<double> busy_seen(-1.0);
+
+/* Stop a timer "rate" times a second, in bursts of 100, sleeping
+ * between bursts to keep to the schedule. */
+static void producer(uint64_t * produced) {
+    apex::register_thread("stress producer");
+    apex::task_identifier * id = apex::register_timer("stress timer");
+    auto start = chrono::steady_clock::now();
+    auto end = start + chrono::duration<double>(seconds);
+    uint64_t count = 0;
+    while (chrono::steady_clock::now() < end) {
+        for (int i = 0 ; i < 100 ; i++) {
+            apex::stop(apex::start(id));
+        }
+        count += 100;
+        auto due = start + chrono::duration<double>(count / rate);
+        this_thread::sleep_until(due);
+    }
+    *produced = count;
+    apex::exit_thread();
+}
+
+/* The counters are visible to policies */
+static int watch_consumer(apex_context const &context) {
+    (void)context;
+    apex_profile * profile = apex::get_profile(string(APEX_CONSUMER_BUSY));
+    if (profile != nullptr && profile->calls > 0) {
+        busy_seen = profile->maximum;
+    }
+    return APEX_NOERROR;
+}
+
+int main (int argc, char** argv) {
+    if (argc > 1) { num_producers = atoi(argv[1]); }
+    if (argc > 2) { rate = atof(argv[2]); }
+    if (argc > 3) { seconds = atof(argv[3]); }
+    apex::init(argc, argv, "apex consumer stress test");
+    apex::register_periodic_policy(100000, watch_consumer);
+
+    vector<uint64_t> produced(num_producers, 0);
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0 ; i < num_producers ; i++) {
+        threads.push_back(thread(producer, &produced[i]));
+    }
+    uint64_t total = 0;
+    for (int i = 0 ; i < num_producers ; i++) {
+        threads[i].join();
+        total += produced[i];
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    apex::finalize();
+
+    cout << "Producers              : " << num_producers << endl;
+    cout << "Offered rate           : " << (total / elapsed) << " events/s" << endl;
+    apex_profile * timer = apex::get_profile(string("stress timer"));
+    apex_profile * drain = apex::get_profile(string(APEX_CONSUMER_DRAIN_RATE));
+    apex_profile * depth = apex::get_profile(string(APEX_QUEUE_DEPTH));
+    apex_profile * busy = apex::get_profile(string(APEX_CONSUMER_BUSY));
+    apex_profile * latency = apex::get_profile(string(APEX_EVENT_LATENCY));
+    if (drain != nullptr && drain->calls > 0) {
+        cout << "Sustained drain rate   : " << (drain->accumulated / drain->calls)
+             << " events/s (peak " << drain->maximum << ")" << endl;
+    }
+    if (depth != nullptr && depth->calls > 0) {
+        cout << "Queue high-water mark  : " << depth->maximum << " events" << endl;
+    }
+    if (busy != nullptr && busy->calls > 0) {
+        cout << "Consumer busy fraction : " << (busy->accumulated / busy->calls)
+             << " (peak " << busy->maximum << ")" << endl;
+    }
+    if (latency != nullptr && latency->calls > 0) {
+        cout << "Event latency          : " << (latency->accumulated / latency->calls * 1.0e6)
+             << " us mean, " << (latency->maximum * 1.0e6) << " us max" << endl;
+    }
+    if (busy_seen >= 0.0) {
+        cout << "Busy fraction seen by a policy : " << busy_seen << endl;
+    }
+    apex_profile * dropped = apex::get_profile(string(APEX_DROPPED_EVENTS));
+    double lost = dropped != nullptr ? dropped->accumulated : 0.0;
+    // every event produced is either processed or counted as lost
+    bool passed = timer != nullptr && (timer->calls + lost) == (double)total &&
+                  depth != nullptr && depth->calls > 0 &&
+                  busy != nullptr && busy->maximum <= 1.0 &&
+                  latency != nullptr && latency->minimum >= 0.0;
+    apex::cleanup();
+    if (passed) {
+        cout << "Test passed." << endl;
+        return 0;
+    }
+    cout << "Test failed." << endl;
+    return 1;
+}
@@ -0,0 +1,79 @@
+#include "apex_api.hpp"
+#include "profile_file.hpp"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <stdio.h>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_CALLS 100
+
+/* Check that the text file has a line that starts with prefix */
+static bool check_file(const string &filename, const string &prefix) {
+  ifstream file(filename);
+  string line;
+  bool found = false;
+  while (!found && getline(file, line)) {
+    found = line.compare(0, prefix.size(), prefix) == 0;
+  }
+  if (!found) {
+    cout << filename << " is missing, or has no line starting with " << prefix << endl;
+  }
+  file.close();
+  remove(filename.c_str());
+  return found;
+}
+
+static bool check_binary(const string &filename, const string &name) {
+  profile_file file;
+  bool found = false;
+  if (!file.open(filename)) {
+    cout << file.error() << endl;
+  } else {
+    for (uint32_t i = 0 ; i < file.num_records() ; i++) {
+      if (name == file.name(i) && file.record(i).calls == NUM_CALLS) {
+        found = true;
+      }
+    }
+    if (!found) {
+      cout << filename << " has no record of " << name << endl;
+    }
+    file.close();
+  }
+  remove(filename.c_str());
+  return found;
+}
+
+/* Write every output at exit, from several finalize threads at once, and
+ * check that each file is there with the timer in it. */
+int main (int argc, char** argv) {
+  apex_options::finalize_threads(4);
+  apex_options::use_screen_output(true);
+  apex_options::use_csv_output(true);
+  apex_options::use_profile_output(true);
+  apex_options::use_taskgraph_output(true);
+  apex_options::use_binary_output(true);
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex finalize outputs unit test");
+  cout << "APEX Version : " << version() << endl;
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    profiler * outer = start("outputs outer");
+    profiler * inner = start("outputs inner");
+    stop(inner);
+    stop(outer);
+  }
+  finalize();
+  bool passed = check_file("apex.0.csv", "\"outputs inner\",100,");
+  passed = check_file("profile.0.0.0", "\"outputs inner\" 100 ") && passed;
+  passed = check_file("taskgraph.0.dot", "  \"outputs inner\" [") && passed;
+  passed = check_binary("apex.0.prof", "outputs inner") && passed;
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
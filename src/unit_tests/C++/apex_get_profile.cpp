@@ -35,6 +35,12 @@ int main (int argc, char** argv) {
   }    
   // The profile should show "foo" was called 3 times
   // and bar was called 4 times.
+  // A profile found now has to stay valid after finalize.
+  apex_profile * early = nullptr;
+  for (int i = 0 ; i < 1000 && early == nullptr ; i++) {
+    early = get_profile("bar");
+    usleep(1000);
+  }
   
   // Call "Test Timer" 100 times
   for(int i = 0; i < 100; ++i) {
@@ -53,13 +59,23 @@ int main (int argc, char** argv) {
   stop(main_profiler);
   finalize();
   apex_profile * profile = get_profile("Test Timer");
+  bool passed = false;
   if (profile) {
     std::cout << "Value Reported : " << profile->calls << std::endl;
-    if (profile->calls <= 25) {  // might be less, some calls might have been missed
-        std::cout << "Test passed." << std::endl;
-    }
+    passed = profile->calls <= 25;  // might be less, some calls might have been missed
+  }
+  apex_profile * bar = get_profile("bar");
+  if (early == nullptr || bar != early) {
+    std::cout << "The profile for bar moved at finalize." << std::endl;
+    passed = false;
+  } else {
+    std::cout << "bar calls : " << early->calls << std::endl;
   }
   cleanup();
-  return 0;
+  if (passed) {
+    std::cout << "Test passed." << std::endl;
+    return 0;
+  }
+  return 1;
 }
 
@@ -0,0 +1,51 @@
+#include "apex_api.hpp"
+#include <iostream>
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+/* Spend about usec microseconds in a timer of its own */
+static void inner(int usec) {
+  profiler * p = start("inner");
+  usleep(usec);
+  stop(p);
+}
+
+int main (int argc, char** argv) {
+  // measure the call paths too, two timers deep
+  apex_options::callpath_depth(2);
+  init(argc, argv, "apex::get_profile exclusive time unit test");
+  cout << "APEX Version : " << version() << endl;
+  profiler * p = start("outer");
+  usleep(10000);
+  inner(20000);
+  inner(20000);
+  stop(p);
+  finalize();
+  apex_profile * outer_profile = get_profile("outer");
+  apex_profile * inner_profile = get_profile("inner");
+  apex_profile * path_profile = get_profile("outer => inner");
+  bool passed = false;
+  if (outer_profile && inner_profile && path_profile) {
+    cout << "outer inclusive : " << outer_profile->accumulated
+         << ", exclusive : " << outer_profile->exclusive << endl;
+    cout << "inner inclusive : " << inner_profile->accumulated
+         << ", exclusive : " << inner_profile->exclusive << endl;
+    cout << "outer => inner calls : " << path_profile->calls << endl;
+    // the inner timers' time is charged to the outer timer
+    double difference = outer_profile->accumulated - inner_profile->accumulated;
+    passed = outer_profile->exclusive > 0.0 &&
+             outer_profile->exclusive < outer_profile->accumulated * 0.5 &&
+             outer_profile->exclusive > difference * 0.99 &&
+             outer_profile->exclusive < difference * 1.01 &&
+             inner_profile->exclusive == inner_profile->accumulated &&
+             path_profile->calls == 2.0;
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
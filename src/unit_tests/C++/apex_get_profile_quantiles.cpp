@@ -0,0 +1,36 @@
+#include "apex_api.hpp"
+#include <iostream>
+#include <math.h>
+
+using namespace apex;
+using namespace std;
+
+/* The histogram buckets are 1/16th of a power of two wide */
+static bool close_to(double estimate, double expected) {
+  return fabs(estimate - expected) <= expected * 0.0625;
+}
+
+int main (int argc, char** argv) {
+  init(argc, argv, "apex::get_profile quantiles unit test");
+  cout << "APEX Version : " << version() << endl;
+  // sample the values 1 to 10000, in a scrambled order
+  for (int i = 0 ; i < 10000 ; i++) {
+    sample_value("quantile counter", (double)(((i * 7919) % 10000) + 1));
+  }
+  finalize();
+  apex_profile * profile = get_profile("quantile counter");
+  bool passed = false;
+  if (profile) {
+    cout << "p50 : " << profile->p50 << ", p90 : " << profile->p90
+         << ", p99 : " << profile->p99 << ", p99.9 : " << profile->p999 << endl;
+    passed = close_to(profile->p50, 5000.0) && close_to(profile->p90, 9000.0) &&
+             close_to(profile->p99, 9900.0) && close_to(profile->p999, 9990.0) &&
+             profile->p999 <= profile->maximum;
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,57 @@
+#include "apex_api.hpp"
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace apex;
+using namespace std;
+
+#define SAMPLES 200000
+
+/* Every sample is 1.0, so in a consistent copy of the profile the
+ * number of calls, the total and the sum of squares are all equal. */
+static bool consistent(const apex_profile &p) {
+  return p.calls == p.accumulated && p.calls == p.sum_squares;
+}
+
+int main (int argc, char** argv) {
+  init(argc, argv, "apex::get_profile_snapshot unit test");
+  cout << "APEX Version : " << version() << endl;
+  atomic<bool> done(false);
+  int snapshots = 0;
+  int torn = 0;
+  // read the profile while the consumer thread is updating it
+  thread reader([&]() {
+    apex_profile snapshot;
+    while (!done) {
+      if (get_profile_snapshot("snapshot counter", snapshot)) {
+        snapshots++;
+        if (!consistent(snapshot)) { torn++; }
+      }
+    }
+  });
+  for (int i = 0 ; i < SAMPLES ; i++) {
+    sample_value("snapshot counter", 1.0);
+  }
+  done = true;
+  reader.join();
+  finalize();
+  apex_profile snapshot;
+  bool found = get_profile_snapshot("snapshot counter", snapshot);
+  bool in_all = false;
+  for (auto &it : get_profile_snapshots()) {
+    if (it.first == "snapshot counter") {
+      in_all = consistent(it.second) && it.second.calls == snapshot.calls;
+    }
+  }
+  cout << "Snapshots taken : " << snapshots << ", inconsistent : " << torn << endl;
+  cout << "Value Reported : " << snapshot.calls << endl;
+  bool passed = found && consistent(snapshot) && in_all && torn == 0 &&
+                !get_profile_snapshot("no such counter", snapshot);
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,87 @@
+#include "apex_api.hpp"
+#include "apex.hpp"
+#include "profiler_listener.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_CALLS 200
+
+static double lost_events(const string &counter) {
+  apex_profile * profile = get_profile(counter + " : overflow timer");
+  return profile == nullptr ? 0.0 : profile->accumulated;
+}
+
+/* Run with a tiny APEX_EVENT_RING_SIZE and each APEX_OVERFLOW_POLICY
+ * (with APEX_OVERFLOW_TIMEOUT for "block"). The consumer is stalled while
+ * the timer is stopped, so the ring fills, and every stop is either
+ * processed or counted as lost, the way the policy says. */
+int main (int argc, char** argv) {
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex overflow policy unit test");
+  cout << "APEX Version : " << version() << endl;
+  string policy(apex_options::overflow_policy());
+  int ring_size = apex_options::event_ring_size();
+  if (ring_size > NUM_CALLS / 4 ||
+      (policy == "block" && apex_options::overflow_timeout() <= 0)) {
+    cout << "Run with a small APEX_EVENT_RING_SIZE, and an APEX_OVERFLOW_TIMEOUT for block" << endl;
+    cleanup();
+    return 1;
+  }
+  profiler_listener * listener = apex::apex::instance()->the_profiler_listener;
+  listener->pause_consumers(true);
+  auto start_time = chrono::steady_clock::now();
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    profiler * p = apex::start("overflow timer");
+    apex::stop(p);
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start_time;
+  listener->pause_consumers(false);
+  /* Let the consumer empty the ring before finalize stops more timers,
+   * or "drop_oldest" would make room for them. The processed calls stop
+   * changing once it has. */
+  apex_profile snapshot;
+  double last = -1.0;
+  int steady = 0;
+  for (int i = 0 ; i < 5000 && steady < 100 ; i++) {
+    usleep(1000);
+    double calls = get_profile_snapshot("overflow timer", snapshot) ? snapshot.calls : 0.0;
+    steady = (calls > 0.0 && calls == last) ? steady + 1 : 0;
+    last = calls;
+  }
+  finalize();
+  apex_profile * profile = get_profile("overflow timer");
+  double processed = profile == nullptr ? 0.0 : profile->calls;
+  double dropped = lost_events(APEX_DROPPED_EVENTS);
+  double sampled = lost_events(APEX_SAMPLED_EVENTS);
+  cout << "Policy : " << policy << ", processed : " << processed
+       << ", dropped : " << dropped << ", sampled : " << sampled
+       << ", elapsed : " << elapsed.count() << " seconds" << endl;
+  // nothing is lost without being counted, and the ring didn't grow
+  bool passed = processed + dropped + sampled == NUM_CALLS &&
+                processed > 0.0 && processed <= ring_size;
+  if (policy == "sample") {
+    // some are skipped without trying the ring
+    passed = passed && sampled > 0.0;
+  } else {
+    // the ring is full when the consumer resumes
+    passed = passed && processed == ring_size && dropped == NUM_CALLS - ring_size &&
+             sampled == 0.0;
+  }
+  if (policy == "block") {
+    // each drop waited for the timeout first
+    double timeout = apex_options::overflow_timeout() * 1.0e-6;
+    passed = passed && elapsed.count() >= dropped * timeout;
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
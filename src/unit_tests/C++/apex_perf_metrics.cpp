@@ -0,0 +1,63 @@
+#include "apex_api.hpp"
+#include "perf_events.hpp"
+#include "profiler.hpp"
+#include "task_identifier.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_CALLS 10
+
+/* Keep the CPU busy for about usec microseconds */
+static void spin(double usec) {
+  profiler * p = start("perf metrics timer");
+  auto end = std::chrono::steady_clock::now() + std::chrono::microseconds((long)usec);
+  volatile double sum = 0.0;
+  while (std::chrono::steady_clock::now() < end) {
+    sum = sum + 1.0;
+  }
+  stop(p);
+}
+
+/* Run with APEX_PERF_METRICS=task-clock: the CPU time counted for a
+ * timer that keeps the CPU busy is more than none, and no more than the
+ * time it ran. */
+int main (int argc, char** argv) {
+  // measure every call
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex perf metrics unit test");
+  cout << "APEX Version : " << version() << endl;
+  if (perf_events::num_metrics() != 1 || perf_events::metric_name(0) != "task-clock") {
+    cout << "APEX_PERF_METRICS is \"" << apex_options::perf_metrics()
+         << "\", not task-clock, or task-clock can't be read" << endl;
+    cleanup();
+    return 1;
+  }
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    spin(5000);
+  }
+  finalize();
+  apex_profile * profile = get_profile("perf metrics timer");
+  uint32_t id = task_identifier::get_task_id("perf metrics timer")->id;
+  vector<double> totals;
+  perf_events::totals(totals);
+  bool passed = false;
+  if (profile != nullptr && id < totals.size()) {
+    // task-clock counts nanoseconds; the profiles are kept in clock ticks
+    double cpu = totals[id] * 1.0e-9;
+    double elapsed = profile->accumulated * profiler::get_cpu_mhz();
+    cout << "task-clock : " << cpu << " seconds, elapsed : " << elapsed
+         << " seconds" << endl;
+    passed = profile->calls == NUM_CALLS && cpu > 0.0 && cpu <= elapsed * 1.01;
+  }
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
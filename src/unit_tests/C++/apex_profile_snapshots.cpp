@@ -0,0 +1,73 @@
+#include "apex_api.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <stdio.h>
+
+using namespace apex;
+using namespace std;
+
+/* Add up the calls to the timer in the snapshot files, checking that the
+ * sequence numbers have no gaps. Returns the number of snapshots. */
+static int read_snapshots(const string &timer, double &calls) {
+  int sequence = 0;
+  for ( ; ; sequence++) {
+    stringstream name;
+    name << "apex.0.snapshot." << sequence << ".csv";
+    ifstream snapshot(name.str());
+    if (!snapshot.good()) {
+      break;
+    }
+    string line;
+    while (getline(snapshot, line)) {
+      if (line == "# sequence " + to_string(sequence)) {
+        continue;
+      }
+      // "task",type,calls,...
+      if (line.compare(0, timer.size() + 2, "\"" + timer + "\"") == 0) {
+        size_t type_end = line.find(',', timer.size() + 3);
+        calls += stod(line.substr(type_end + 1));
+      }
+    }
+    snapshot.close();
+    remove(name.str().c_str());
+  }
+  return sequence;
+}
+
+int main (int argc, char** argv) {
+  // a snapshot every second
+  apex_options::profile_snapshot_period(1);
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex profile snapshot unit test");
+  cout << "APEX Version : " << version() << endl;
+  auto end = chrono::steady_clock::now() + chrono::milliseconds(2500);
+  double made = 0.0;
+  while (chrono::steady_clock::now() < end) {
+    profiler * p = start("snapshot timer");
+    this_thread::sleep_for(chrono::milliseconds(1));
+    stop(p);
+    made++;
+  }
+  finalize();
+  apex_profile * profile = get_profile("snapshot timer");
+  double calls = 0.0;
+  int snapshots = read_snapshots("snapshot timer", calls);
+  cout << "Snapshots : " << snapshots << ", calls in the snapshots : " << calls
+       << ", calls in the profile : " << (profile ? profile->calls : 0.0)
+       << ", calls made : " << made << endl;
+  // two periodic snapshots, and the last one at exit, which includes the
+  // events still on the rings at exit
+  bool passed = profile != nullptr && snapshots >= 3 &&
+                calls == made && profile->calls == made;
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
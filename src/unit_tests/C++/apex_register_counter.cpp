@@ -0,0 +1,36 @@
+#include "apex_api.hpp"
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+int main (int argc, char** argv) {
+  init(argc, argv, "apex::register_counter unit test");
+  cout << "APEX Version : " << version() << endl;
+  set_node_id(0);
+  profiler * main_profiler = start((apex_function_address)(main));
+  // Register the counters once...
+  counter_handle length = register_counter("queue length");
+  counter_handle sent = register_counter("bytes sent", APEX_COUNTER_MONOTONIC);
+  // ...and sample them as often as needed.
+  for(int i = 0; i < 100; ++i) {
+    sample_value(length, (double)(i % 10));
+    // a running total - the profile gets the 99 increases of 10 bytes
+    sample_value(sent, (double)(i * 10));
+  }
+  stop(main_profiler);
+  finalize();
+  apex_profile * length_profile = get_profile("queue length");
+  apex_profile * sent_profile = get_profile("bytes sent");
+  if (length_profile && sent_profile) {
+    std::cout << "Samples of queue length : " << length_profile->calls << std::endl;
+    std::cout << "Bytes sent : " << sent_profile->accumulated << std::endl;
+    // might be less, some samples might have been missed
+    if (length_profile->calls <= 100 && sent_profile->calls <= 99 &&
+        sent_profile->maximum == 10.0) {
+        std::cout << "Test passed." << std::endl;
+    }
+  }
+  cleanup();
+  return 0;
+}
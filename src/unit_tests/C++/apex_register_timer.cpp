@@ -0,0 +1,40 @@
+#include "apex_api.hpp"
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+int main (int argc, char** argv) {
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex::register_timer unit test");
+  cout << "APEX Version : " << version() << endl;
+  set_node_id(0);
+  profiler * main_profiler = start((apex_function_address)(main));
+  // Register the timer once, then use the handle for every start.
+  task_identifier * foo = register_timer("foo");
+  // Registering the same name again gives the same handle.
+  bool passed = foo != nullptr && foo == register_timer("foo");
+  if (!passed) {
+    std::cout << "Registering foo again gave a different handle." << std::endl;
+  }
+  // Call "foo" 30 times
+  for(int i = 0; i < 30; ++i) {
+    profiler * p = start(foo);
+    stop(p);
+  }    
+  stop(main_profiler);
+  finalize();
+  apex_profile * profile = get_profile("foo");
+  if (profile) {
+    std::cout << "Value Reported : " << profile->calls << std::endl;
+  }
+  passed = passed && profile != nullptr && profile->calls == 30;
+  cleanup();
+  if (passed) {
+    std::cout << "Test passed." << std::endl;
+    return 0;
+  }
+  std::cout << "Test failed." << std::endl;
+  return 1;
+}
@@ -0,0 +1,32 @@
+#include "apex_api.hpp"
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+void foo(void) {
+  // Time the whole function. The timer is registered on the first call.
+  APEX_SCOPED_TIMER("foo");
+}
+
+int main (int argc, char** argv) {
+  init(argc, argv, "apex::scoped_timer unit test");
+  cout << "APEX Version : " << version() << endl;
+  set_node_id(0);
+  profiler * main_profiler = start((apex_function_address)(main));
+  // Call "foo" 30 times
+  for(int i = 0; i < 30; ++i) {
+    foo();
+  }    
+  stop(main_profiler);
+  finalize();
+  apex_profile * profile = get_profile("foo");
+  if (profile) {
+    std::cout << "Value Reported : " << profile->calls << std::endl;
+    if (profile->calls <= 30) {  // might be less, some calls might have been missed
+        std::cout << "Test passed." << std::endl;
+    }
+  }
+  cleanup();
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include "apex_api.hpp"
+#include "profile_file.hpp"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_THREADS 4
+#define FREQUENT_CALLS 5000
+#define RARE_CALLS 3
+#define SAMPLES 50
+
+void * worker(void) {
+  register_thread("apex task samples worker");
+  for (int i = 0 ; i < FREQUENT_CALLS ; i++) {
+    profiler * p = start("samples frequent");
+    stop(p);
+  }
+  exit_thread();
+  return nullptr;
+}
+
+/* Check the timer stopped expected times, and kept the samples it should
+ * have, in time order */
+static bool check_timer(const sample_file &file, const string &name,
+                        uint64_t expected, uint32_t kept) {
+  for (uint32_t t = 0 ; t < file.num_timers() ; t++) {
+    if (name != file.name(t)) {
+      continue;
+    }
+    const sample_file_timer &timer = file.timer(t);
+    const sample_file_sample * samples = file.samples(t);
+    cout << name << " : " << timer.seen << " stops, " << timer.num_samples
+         << " samples" << endl;
+    bool passed = timer.seen == expected && timer.num_samples == kept;
+    for (uint32_t s = 0 ; s < timer.num_samples ; s++) {
+      if (samples[s].value < 0.0 ||
+          (s > 0 && samples[s].timestamp < samples[s-1].timestamp)) {
+        passed = false;
+      }
+    }
+    return passed;
+  }
+  cout << name << " is missing" << endl;
+  return false;
+}
+
+int main (int argc, char** argv) {
+  apex_options::task_scatterplot(true);
+  apex_options::task_scatterplot_samples(SAMPLES);
+  // measure every call, so the stops can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex task samples unit test");
+  cout << "APEX Version : " << version() << endl;
+  vector<thread> threads;
+  for (int i = 0 ; i < NUM_THREADS ; i++) {
+    threads.push_back(thread(worker));
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+  for (int i = 0 ; i < RARE_CALLS ; i++) {
+    profiler * p = start("samples rare");
+    stop(p);
+  }
+  finalize();
+
+  stringstream filename;
+  filename << "apex_task_samples.0." << getpid() << ".bin";
+  sample_file file;
+  bool passed = file.open(filename.str());
+  if (!passed) {
+    cout << file.error() << endl;
+  } else {
+    // the rare timer keeps all its samples, however many the other has
+    passed = check_timer(file, "samples frequent", NUM_THREADS * FREQUENT_CALLS, SAMPLES) &&
+             check_timer(file, "samples rare", RARE_CALLS, RARE_CALLS);
+    file.close();
+  }
+  remove(filename.str().c_str());
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,62 @@
+#include "apex_api.hpp"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_THREADS 4
+#define NUM_CALLS 1000
+
+void * worker(void) {
+  register_thread("apex thread local worker");
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    profiler * p = start("thread local timer");
+    stop(p);
+  }
+  exit_thread();
+  return nullptr;
+}
+
+/* Run with APEX_AGGREGATION=thread_local: each thread adds up its own
+ * timers, and the totals are merged when they are asked for. */
+int main (int argc, char** argv) {
+  // measure every call, so the calls can be counted
+  apex_options::throttle_timers(false);
+  init(argc, argv, "apex thread local aggregation unit test");
+  cout << "APEX Version : " << version() << endl;
+  if (string(apex_options::aggregation()) != "thread_local") {
+    cout << "APEX_AGGREGATION is " << apex_options::aggregation()
+         << ", not thread_local" << endl;
+    cleanup();
+    return 1;
+  }
+  vector<thread> threads;
+  for (int i = 0 ; i < NUM_THREADS ; i++) {
+    threads.push_back(thread(worker));
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+  // the threads' tables are merged for the query, so nothing is missing,
+  // even from the threads that have exited
+  apex_profile before;
+  bool found = get_profile_snapshot("thread local timer", before);
+  finalize();
+  apex_profile * after = get_profile("thread local timer");
+  cout << "Calls before finalize : " << (found ? before.calls : 0.0)
+       << ", after : " << (after ? after->calls : 0.0) << endl;
+  bool passed = found && after != nullptr &&
+                before.calls == NUM_THREADS * NUM_CALLS &&
+                after->calls == NUM_THREADS * NUM_CALLS &&
+                after->accumulated >= before.accumulated &&
+                after->accumulated > 0.0;
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
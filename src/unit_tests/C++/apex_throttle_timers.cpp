@@ -0,0 +1,73 @@
+#include "apex_api.hpp"
+#include "apex.hpp"
+#include "profile.hpp"
+#include "profiler_listener.hpp"
+#include "task_identifier.hpp"
+#include <iostream>
+#include <math.h>
+#include <unistd.h>
+
+using namespace apex;
+using namespace std;
+
+#define NUM_CALLS 10000000
+#define MAX_LONG_CALLS 5000
+
+/* Wait until the consumer has processed what it has been sent: until the
+ * calls to the timer stop changing */
+static double processed_calls(const char * name) {
+  apex_profile snapshot;
+  double last = -1.0;
+  int steady = 0;
+  for (int i = 0 ; i < 5000 && steady < 100 ; i++) {
+    usleep(1000);
+    double calls = get_profile_snapshot(name, snapshot) ? snapshot.calls : 0.0;
+    steady = (calls > 0.0 && calls == last) ? steady + 1 : 0;
+    last = calls;
+  }
+  return last;
+}
+
+/* Run with APEX_THROTTLE_TIMERS=1: a timer too short to measure every
+ * call is measured 1 in N times, its calls are extrapolated, and it is
+ * measured in full again once its calls get longer. */
+int main (int argc, char** argv) {
+  init(argc, argv, "apex throttle timers unit test");
+  cout << "APEX Version : " << version() << endl;
+  if (!apex_options::throttle_timers()) {
+    cout << "Run with APEX_THROTTLE_TIMERS=1" << endl;
+    cleanup();
+    return 1;
+  }
+  task_identifier * id = task_identifier::get_task_id("throttled timer");
+  for (int i = 0 ; i < NUM_CALLS ; i++) {
+    profiler * p = start("throttled timer");
+    stop(p);
+  }
+  double estimate = processed_calls("throttled timer");
+  uint32_t period = id->throttle_period.load();
+  profile * p = apex::apex::instance()->the_profiler_listener->get_profile(id);
+  bool estimated = p != nullptr && p->is_estimate();
+  cout << "Calls : " << NUM_CALLS << ", estimated : " << estimate
+       << ", 1 in " << period << " measured" << endl;
+  // each measured call stands for N, chosen at random
+  bool passed = period > 1 && estimated &&
+                fabs(estimate - NUM_CALLS) < NUM_CALLS * 0.05;
+  // now make the calls long enough to measure every one
+  int long_calls = 0;
+  while (long_calls < MAX_LONG_CALLS && id->throttle_period.load() > 1) {
+    profiler * p = start("throttled timer");
+    usleep(1000);
+    stop(p);
+    long_calls++;
+  }
+  cout << "Measured in full again after " << long_calls << " longer calls" << endl;
+  passed = passed && id->throttle_period.load() == 1;
+  finalize();
+  cleanup();
+  if (passed) {
+    cout << "Test passed." << endl;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,27 @@
+#include "apex.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+int main (int argc, char** argv) {
+  apex_init_args(argc, argv, "apex_get_profile_snapshot unit test");
+  printf("APEX Version : %s\n", apex_version());
+  int i = 0;
+  // Call "Test Timer" 25 times
+  for(i = 0; i < 25; ++i) {
+    apex_profiler_handle p = apex_start(APEX_NAME_STRING,"Test Timer");
+    apex_stop(p);
+  }    
+  apex_finalize();
+  apex_profile snapshot;
+  int result = 1;
+  if (apex_get_profile_snapshot(APEX_NAME_STRING, "Test Timer", &snapshot) == APEX_NOERROR) {
+    printf("Value Reported : %f\n", snapshot.calls);
+    if (snapshot.calls <= 25 &&  // might be less, some calls might have been missed
+        apex_get_profile_snapshot(APEX_NAME_STRING, "No Such Timer", &snapshot) == APEX_ERROR) {
+        printf("Test passed.\n");
+        result = 0;
+    }
+  }
+  apex_cleanup();
+  return result;
+}
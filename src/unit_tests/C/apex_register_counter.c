@@ -0,0 +1,18 @@
+#include "apex.h"
+#include <unistd.h>
+#include <stdio.h>
+
+int main (int argc, char** argv) {
+  apex_init_args(argc, argv, "apex_register_counter unit test");
+  apex_set_use_screen_output(1);
+  apex_counter_handle counterA = apex_register_counter("counterA", APEX_COUNTER_GAUGE);
+  apex_counter_handle counterB = apex_register_counter("counterB", APEX_COUNTER_MONOTONIC);
+  int i;
+  for (i = 0 ; i < 10 ; i++) {
+    apex_sample_counter(counterA, 1);
+    apex_sample_counter(counterB, i);
+  }
+  apex_finalize();
+  apex_cleanup();
+  return 0;
+}